@@ -0,0 +1,102 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace bench {
+
+namespace {
+
+// Benchmarks may allocate from several threads.
+static std::atomic<std::size_t> sNumAllocations(0);
+static const char *sFilter = nullptr;
+static volatile long sSink = 0;
+
+}
+
+std::size_t allocationCount() _ut_noexcept
+{
+    return sNumAllocations.load(std::memory_order_relaxed);
+}
+
+bool isSelected(const char *name) _ut_noexcept
+{
+    return sFilter == nullptr || std::strstr(name, sFilter) != nullptr;
+}
+
+void check(bool condition, const char *what) _ut_noexcept
+{
+    if (!condition) {
+        fprintf(stderr, "check failed: %s\n", what);
+        std::abort();
+    }
+}
+
+void consume(long value) _ut_noexcept
+{
+    sSink = sSink + value;
+}
+
+void escape(void *p) _ut_noexcept
+{
+    if (p == nullptr)
+        sSink = sSink + 1;
+}
+
+void setFilter(const char *filter) _ut_noexcept
+{
+    sFilter = filter;
+}
+
+}
+
+//
+// Count allocations by replacing global operator new / delete
+//
+
+void* operator new(std::size_t size)
+{
+    bench::sNumAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+
+#ifdef UT_NO_EXCEPTIONS
+    std::abort();
+#else
+    throw std::bad_alloc();
+#endif
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) _ut_noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) _ut_noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,107 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <CppAsync/impl/Common.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+#ifndef UT_NO_EXCEPTIONS
+#include <stdexcept>
+#endif
+
+namespace bench {
+
+/** Number of calls to operator new since program start, from any thread */
+std::size_t allocationCount() _ut_noexcept;
+
+/** Run only benchmarks whose name contains filter, or all if null */
+void setFilter(const char *filter) _ut_noexcept;
+
+/** Check if benchmark matches the filter */
+bool isSelected(const char *name) _ut_noexcept;
+
+/** Report a failed benchmark self-check and abort */
+void check(bool condition, const char *what) _ut_noexcept;
+
+/** Prevent the optimizer from discarding results */
+void consume(long value) _ut_noexcept;
+
+/** Opaque to the optimizer, see doNotOptimize() */
+void escape(void *p) _ut_noexcept;
+
+/** Force object to be materialized in memory, and assume it may be modified */
+template <class T>
+inline void doNotOptimize(T& value) _ut_noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    escape(&value);
+#endif
+}
+
+/** Error that is cheap to create in both configurations */
+inline ut::Error makeError()
+{
+#ifdef UT_NO_EXCEPTIONS
+    return ut::Error(-1);
+#else
+    return ut::makeExceptionPtr(std::runtime_error("bench"));
+#endif
+}
+
+/**
+ * Run f(numOps) a few times, report best time per operation and average
+ * allocations per operation.
+ */
+template <class F>
+void measure(const char *name, long numOps, F&& f)
+{
+    using clock = std::chrono::steady_clock;
+
+    static const int NUM_ROUNDS = 5;
+
+    if (!isSelected(name))
+        return;
+
+    // Warm up caches and allocator.
+    f(numOps / 10 + 1);
+
+    double bestNs = 0;
+    std::size_t numAllocs = 0;
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        std::size_t allocsBefore = allocationCount();
+        clock::time_point start = clock::now();
+
+        f(numOps);
+
+        double elapsedNs = (double) std::chrono::duration_cast<
+            std::chrono::nanoseconds>(clock::now() - start).count();
+
+        numAllocs += allocationCount() - allocsBefore;
+        bestNs = (round == 0) ? elapsedNs : std::min(bestNs, elapsedNs);
+    }
+
+    printf("%-46s %10.1f ns/op %8.2f allocs/op\n", name,
+        bestNs / numOps, (double) numAllocs / NUM_ROUNDS / numOps);
+}
+
+}
@@ -0,0 +1,204 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/util/ChainedArena.h>
+#include <CppAsync/util/SlabArena.h>
+#include <CppAsync/util/TlsfArena.h>
+#include <memory>
+#include <new>
+
+//
+// Arenas
+//
+
+namespace {
+
+static const int NUM_LIVE = 64;
+static const int NUM_SIZES = 16;
+
+// Sizes of a typical mix of frames and buffers
+static const std::size_t SIZES[NUM_SIZES] = {
+    48, 96, 200, 64, 512, 80, 1024, 160, 64, 320, 48, 768, 128, 96, 2000, 256
+};
+
+// Keeps NUM_LIVE chunks alive, each step frees the oldest one and allocates
+// a new one, so frees interleave with allocations.
+template <class Alloc>
+void churn(Alloc& alloc, long n, bool isFixedSize)
+{
+    char *chunks[NUM_LIVE] = { };
+    std::size_t sizes[NUM_LIVE] = { };
+
+    for (long i = 0; i < n; i++) {
+        int slot = (int) (i % NUM_LIVE); // safe cast
+
+        if (chunks[slot] != nullptr)
+            alloc.deallocate(chunks[slot], sizes[slot]);
+
+        sizes[slot] = isFixedSize ? 64 : SIZES[i % NUM_SIZES];
+        chunks[slot] = alloc.allocate(sizes[slot]);
+        bench::doNotOptimize(chunks[slot]);
+    }
+
+    for (int slot = 0; slot < NUM_LIVE; slot++) {
+        if (chunks[slot] != nullptr)
+            alloc.deallocate(chunks[slot], sizes[slot]);
+    }
+}
+
+struct EmptyFrame : ut::AsyncFrame<int>
+{
+    EmptyFrame(int value)
+        : value(value) { }
+
+    void operator()()
+    {
+        ut_begin();
+        ut_return(value);
+        ut_end();
+    }
+
+private:
+    int value;
+};
+
+template <class Alloc>
+void startFrames(const Alloc& alloc, long n)
+{
+    long sum = 0;
+
+    for (long i = 0; i < n; i++) {
+        ut::Task<int> task = ut::startAsyncOf<EmptyFrame>(std::allocator_arg, alloc,
+            (int) i); // safe cast
+        sum += task.get();
+    }
+    bench::consume(sum);
+}
+
+// Overflows a linear arena, with and without upstream, and checks telemetry.
+static void checkUpstreamFallback()
+{
+    static const std::size_t CHUNK_SIZE = 200;
+    const std::size_t chunkSpace = ut::detail::arena::roundUp(CHUNK_SIZE, ut::max_align_size);
+
+    ut::LinearStackArena<256> arena;
+    arena.setUpstream(&ut::HeapUpstream::instance());
+
+    char *a = arena.allocate<char>(CHUNK_SIZE);
+    char *b = arena.allocate<char>(CHUNK_SIZE); // doesn't fit
+
+    bench::check(a != nullptr && b != nullptr, "fallback allocation succeeds");
+    bench::check(arena.stats().numAllocations == 2, "allocations counted");
+    bench::check(arena.stats().numFallbacks == 1, "fallback counted");
+    bench::check(arena.stats().fallbackUsed == CHUNK_SIZE, "fallback bytes tracked");
+    bench::check(arena.stats().peakUsed == chunkSpace, "peak usage tracked");
+
+    arena.deallocate(b, CHUNK_SIZE);
+    bench::check(arena.stats().fallbackUsed == 0, "fallback bytes released");
+
+    // A frame started while the arena is occupied also falls back.
+    {
+        ut::Task<int> task = ut::startAsyncOf<EmptyFrame>(arena, 1);
+        bench::check(task.isValid() && task.get() == 1, "frame started from upstream");
+        bench::check(arena.stats().numFallbacks == 2, "frame fallback counted");
+    }
+    bench::check(arena.stats().fallbackUsed == 0, "frame released to upstream");
+
+    arena.setUpstream(nullptr);
+
+#ifdef UT_NO_EXCEPTIONS
+    bench::check(arena.allocate<char>(CHUNK_SIZE) == nullptr, "allocation fails");
+#else
+    bool hasThrown = false;
+    try {
+        arena.allocate<char>(CHUNK_SIZE);
+    } catch (const std::bad_alloc&) {
+        hasThrown = true;
+    }
+    bench::check(hasThrown, "allocation fails");
+#endif
+
+    bench::check(arena.stats().numFailures == 1, "failure counted");
+    bench::check(arena.stats().numFallbacks == 2, "failure is not a fallback");
+
+    arena.deallocate(a, CHUNK_SIZE);
+    bench::check(arena.used() == 0, "buffer released");
+    bench::check(arena.stats().peakUsed == chunkSpace, "peak usage kept");
+}
+
+}
+
+void bench_arena()
+{
+    checkUpstreamFallback();
+
+    bench::measure("arena: std::allocator, fixed size churn", 1000000, [](long n) {
+        std::allocator<char> alloc;
+        churn(alloc, n, true);
+    });
+
+    bench::measure("arena: slab, fixed size churn", 1000000, [](long n) {
+        ut::SlabStackArena<64, NUM_LIVE> arena;
+        auto alloc = ut::makeArenaAlloc(arena);
+        churn(alloc, n, true);
+    });
+
+    bench::measure("arena: std::allocator, mixed size churn", 1000000, [](long n) {
+        std::allocator<char> alloc;
+        churn(alloc, n, false);
+    });
+
+    bench::measure("arena: TLSF, mixed size churn", 1000000, [](long n) {
+        std::unique_ptr<ut::TlsfStackArena<256 * 1024>> arena(
+            new ut::TlsfStackArena<256 * 1024>());
+        auto alloc = ut::makeArenaAlloc(*arena);
+        churn(alloc, n, false);
+    });
+
+    bench::measure("arena: chained blocks, mixed size churn", 1000000, [](long n) {
+        ut::ChainedBlockArena arena;
+        auto alloc = ut::makeArenaAlloc(arena);
+        churn(alloc, n, false);
+    });
+
+    // Most chunks don't fit and go to the heap.
+    bench::measure("arena: linear + heap upstream, mixed churn", 1000000, [](long n) {
+        ut::LinearStackArena<4096> arena;
+        arena.setUpstream(&ut::HeapUpstream::instance());
+        auto alloc = ut::makeArenaAlloc(arena);
+        churn(alloc, n, false);
+
+        bench::check(arena.stats().numFallbacks > 0 && arena.stats().fallbackUsed == 0,
+            "upstream chunks released");
+    });
+
+    bench::measure("arena: startAsyncOf, slab", 1000000, [](long n) {
+        ut::SlabStackArena<128, 4> arena;
+        startFrames(ut::makeArenaAlloc(arena), n);
+    });
+
+    bench::measure("arena: startAsyncOf, TLSF", 1000000, [](long n) {
+        ut::TlsfStackArena<4096> arena;
+        startFrames(ut::makeArenaAlloc(arena), n);
+    });
+
+    bench::measure("arena: startAsyncOf, chained blocks", 1000000, [](long n) {
+        ut::ChainedBlockArena arena;
+        startFrames(ut::makeArenaAlloc(arena), n);
+    });
+}
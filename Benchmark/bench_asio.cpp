@@ -0,0 +1,134 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_BOOST
+
+#include "Bench.h"
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/Boost/Asio.h>
+
+//
+// Asio adaptors: asTask with recycled handler storage
+//
+
+namespace {
+
+namespace asio {
+    using namespace boost::asio;
+    using namespace ut::asio;
+}
+using asio::ip::tcp;
+
+static const long NUM_WARMUP_LINES = 10;
+
+// Socket pair over loopback, lines are written synchronously and read back
+// through asTask.
+struct Context
+{
+    asio::io_service io;
+    tcp::socket reader;
+    tcp::socket writer;
+    asio::streambuf buf;
+    asio::HandlerMemory<> memory;
+
+    Context()
+        : reader(io)
+        , writer(io)
+    {
+        tcp::acceptor acceptor(io, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        writer.connect(acceptor.local_endpoint());
+        acceptor.accept(reader);
+        writer.set_option(tcp::no_delay(true));
+    }
+};
+
+// Reads numLines, and counts allocations made after the first few.
+//
+struct ReadLinesFrame : ut::AsyncFrame<void>
+{
+    ReadLinesFrame(Context *ctx, long numLines, std::size_t *steadyAllocs)
+        : ctx(ctx)
+        , numLines(numLines)
+        , steadyAllocs(steadyAllocs)
+        , allocsBefore(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (i = 0; i < numLines; i++) {
+            if (i == NUM_WARMUP_LINES)
+                allocsBefore = bench::allocationCount();
+
+            asio::write(ctx->writer, asio::buffer("line\n", 5));
+
+            task = asio::async_read_until(ctx->reader, ctx->buf, '\n',
+                asio::asTask[ctx->memory]);
+
+            // Asio recycles its own handler storage too, make sure ours is used.
+            bench::check(ctx->memory.isInUse(), "read handler uses HandlerMemory");
+            ut_await_(task);
+            ctx->buf.consume(task.get());
+        }
+
+        if (numLines > NUM_WARMUP_LINES)
+            *steadyAllocs = bench::allocationCount() - allocsBefore;
+
+        ut_end();
+    }
+
+private:
+    Context *ctx;
+    long numLines;
+    std::size_t *steadyAllocs;
+    std::size_t allocsBefore;
+    long i;
+    ut::Task<std::size_t> task;
+};
+
+static std::size_t readLines(Context& ctx, long numLines)
+{
+    std::size_t steadyAllocs = 0;
+
+    ut::Task<void> task = ut::startAsyncOf<ReadLinesFrame>(&ctx, numLines, &steadyAllocs);
+    ctx.io.reset();
+    ctx.io.run();
+
+    bench::check(task.isReady() && !task.hasError(), "asTask read loop finished");
+
+    return steadyAllocs;
+}
+
+}
+
+void bench_asio()
+{
+    static const char *name = "asio: async_read_until, recycled handler";
+
+    if (!bench::isSelected(name))
+        return;
+
+    Context ctx;
+
+    bench::measure(name, 100000, [&ctx](long n) {
+        readLines(ctx, n);
+    });
+
+    // Only the coroutine frame may allocate, never the read loop itself.
+    bench::check(readLines(ctx, 10000) == 0, "asTask read loop doesn't allocate");
+}
+
+#endif // HAVE_BOOST
@@ -0,0 +1,180 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/AwaitableSet.h>
+#include <CppAsync/Combinators.h>
+#include <CppAsync/StacklessAsync.h>
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <random>
+#include <vector>
+
+//
+// Wait for tasks one at a time through an AwaitableSet, vs calling whenAny()
+// again after each completion
+//
+
+namespace {
+
+// Drains tasks in completion order, rebuilding whenAny() on every wakeup.
+//
+struct WhenAnyFrame : ut::AsyncFrame<long>
+{
+    WhenAnyFrame(std::list<ut::Task<int>>& tasks)
+        : tasks(tasks)
+        , sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (!tasks.empty()) {
+            anyTask = ut::whenAny(tasks);
+            ut_await_(anyTask);
+
+            sum += anyTask.get()->get();
+            tasks.erase(anyTask.get());
+        }
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    std::list<ut::Task<int>>& tasks;
+    long sum;
+    ut::Task<std::list<ut::Task<int>>::iterator> anyTask;
+};
+
+// Drains tasks in completion order, each one attached to the set just once.
+//
+struct AwaitableSetFrame : ut::AsyncFrame<long>
+{
+    AwaitableSetFrame(ut::AwaitableSet<ut::Task<int>>& tasks)
+        : tasks(tasks)
+        , sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (!tasks.isEmpty()) {
+            takeTask = tasks.asyncTake();
+            ut_await_(takeTask);
+
+            sum += takeTask.get().get();
+        }
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    ut::AwaitableSet<ut::Task<int>>& tasks;
+    long sum;
+    ut::Task<ut::Task<int>> takeTask;
+};
+
+static std::vector<int> shuffledOrder(int n)
+{
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+
+    std::mt19937 rng(42);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    return order;
+}
+
+// Only the drain gets measured, setup is excluded. Operations are completions.
+template <class Frame, class Tasks>
+static void measure(const char *name, Tasks& tasks, std::vector<ut::Promise<int>>& promises)
+{
+    using clock = std::chrono::steady_clock;
+
+    const int n = (int) promises.size(); // safe cast
+    std::vector<int> order = shuffledOrder(n);
+
+    std::size_t allocsBefore = bench::allocationCount();
+    clock::time_point start = clock::now();
+
+    ut::Task<long> task = ut::startAsyncOf<Frame>(tasks);
+
+    // Each completion resumes the awaiting frame right away.
+    for (int i : order)
+        promises[i].complete(i);
+
+    double elapsedNs = (double) std::chrono::duration_cast<
+        std::chrono::nanoseconds>(clock::now() - start).count();
+    std::size_t numAllocs = bench::allocationCount() - allocsBefore;
+
+    bench::check(task.isReady() && task.get() == (long) n * (n - 1) / 2,
+        "all tasks drained");
+
+    printf("%-46s %10.1f ns/op %8.2f allocs/op\n", name,
+        elapsedNs / n, (double) numAllocs / n);
+}
+
+static void measureWhenAny(const char *name, int n)
+{
+    if (!bench::isSelected(name))
+        return;
+
+    std::list<ut::Task<int>> tasks(n);
+    std::vector<ut::Promise<int>> promises;
+    promises.reserve(n);
+
+    for (auto& task : tasks)
+        promises.push_back(task.takePromise());
+
+    measure<WhenAnyFrame>(name, tasks, promises);
+}
+
+static void measureAwaitableSet(const char *name, int n)
+{
+    if (!bench::isSelected(name))
+        return;
+
+    ut::AwaitableSet<ut::Task<int>> tasks;
+    std::vector<ut::Promise<int>> promises;
+    promises.reserve(n);
+
+    for (int i = 0; i < n; i++) {
+        ut::Task<int> task;
+        promises.push_back(task.takePromise());
+        tasks.add(std::move(task));
+    }
+
+    measure<AwaitableSetFrame>(name, tasks, promises);
+}
+
+}
+
+void bench_awaitableSet()
+{
+    for (int n = 1000; n <= 16000; n *= 4) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "drain %d tasks: whenAny re-armed", n);
+        measureWhenAny(name, n);
+
+        snprintf(name, sizeof(name), "drain %d tasks: AwaitableSet", n);
+        measureAwaitableSet(name, n);
+    }
+}
@@ -0,0 +1,261 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#if defined(HAVE_BOOST) && defined(__linux__)
+
+#include "Bench.h"
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/Boost/Asio.h>
+#include <CppAsync/Boost/AsioWriteQueue.h>
+#include <CppAsync/util/StringUtil.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <sys/resource.h>
+
+//
+// Chat broadcast: one sender, 10k receivers
+//
+
+namespace {
+
+namespace asio {
+    using namespace boost::asio;
+    using namespace ut::asio;
+}
+using asio::local::stream_protocol;
+
+using Msg = std::shared_ptr<const std::string>;
+
+static const int MAX_RECEIVERS = 10000;
+static const int NUM_BURSTS = 20;
+static const int BURST_SIZE = 10;
+static const int MSG_SIZE = 64;
+
+// Each receiver needs two descriptors, raise the soft limit as far as allowed.
+static int receiverLimit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return 0;
+
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+
+    rlim_t numFree = limit.rlim_cur > 64 ? limit.rlim_cur - 64 : 0;
+    return (int) std::min<rlim_t>(MAX_RECEIVERS, numFree / 2); // safe cast
+}
+
+// Previous session writer: copies every message and sends it on its own.
+//
+class CopyingWriter
+{
+public:
+    CopyingWriter(std::shared_ptr<void> owner, stream_protocol::socket& socket)
+        : mSocket(socket)
+        , mCtx(std::move(owner), std::allocator<char>()) { }
+
+    void push(const Msg& msg)
+    {
+        mQueue.push_back(*msg);
+        mEvtQueued();
+    }
+
+    ut::Task<void> asyncRun()
+    {
+        return ut::startAsync(this, &CopyingWriter::asyncWriter);
+    }
+
+private:
+    struct Context
+    {
+        std::string msg;
+        asio::HandlerMemory<> memory;
+    };
+
+    void asyncWriter(ut::AsyncCoroState<void>& coroState)
+    {
+        ut_begin_function(coroState);
+
+        do {
+            if (mQueue.empty()) {
+                mEvtTask = ut::Task<void>();
+                mEvtQueued = mEvtTask.takePromise();
+                ut_await_(mEvtTask);
+            } else {
+                mCtx->msg = std::move(mQueue.front());
+                mQueue.pop_front();
+
+                mWriteTask = asio::async_write(mSocket, asio::buffer(mCtx->msg),
+                    asio::withMemory(asio::asTask[mCtx], mCtx->memory));
+                ut_await_(mWriteTask);
+            }
+        } while (true);
+
+        ut_end();
+    }
+
+    stream_protocol::socket& mSocket;
+    std::deque<std::string> mQueue;
+    ut::Promise<void> mEvtQueued;
+    ut::ContextRef<Context> mCtx;
+    ut::Task<void> mEvtTask;
+    ut::Task<std::size_t> mWriteTask;
+};
+
+// Reads until the expected number of bytes has arrived.
+//
+struct DrainFrame : ut::AsyncFrame<void>
+{
+    DrainFrame(stream_protocol::socket& socket, std::size_t numBytes)
+        : socket(socket)
+        , numLeft(numBytes)
+        , ctx(ut::makeContext<Context>()) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (numLeft > 0) {
+            readTask = socket.async_read_some(asio::buffer(ctx->buf),
+                asio::withMemory(asio::asTask[ctx], ctx->memory));
+            ut_await_(readTask);
+
+            numLeft -= readTask.get();
+        }
+
+        ut_end();
+    }
+
+private:
+    struct Context
+    {
+        char buf[1024];
+        asio::HandlerMemory<> memory;
+    };
+
+    stream_protocol::socket& socket;
+    std::size_t numLeft;
+    ut::ContextRef<Context> ctx;
+    ut::Task<std::size_t> readTask;
+};
+
+struct Sockets
+{
+    stream_protocol::socket sender;
+    stream_protocol::socket receiver;
+
+    Sockets(asio::io_service& io)
+        : sender(io)
+        , receiver(io) { }
+};
+
+template <class Writer>
+struct Peer
+{
+    ut::ContextRef<Sockets> sockets;
+    Writer writer;
+    ut::Task<void> writerTask;
+    ut::Task<void> drainTask;
+
+    Peer(asio::io_service& io)
+        : sockets(ut::makeContext<Sockets>(io))
+        , writer(sockets.ptr(), sockets->sender) { }
+};
+
+template <class Writer>
+static void measure(const char *name, int numReceivers)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (!bench::isSelected(name))
+        return;
+
+    asio::io_service io;
+    std::vector<std::unique_ptr<Peer<Writer>>> peers;
+    peers.reserve(numReceivers);
+
+    const std::size_t numBytes = (std::size_t) NUM_BURSTS * BURST_SIZE * MSG_SIZE;
+
+    for (int i = 0; i < numReceivers; i++) {
+        std::unique_ptr<Peer<Writer>> peer(new Peer<Writer>(io));
+        asio::local::connect_pair(peer->sockets->sender, peer->sockets->receiver);
+
+        peer->writerTask = peer->writer.asyncRun();
+        peer->drainTask = ut::startAsyncOf<DrainFrame>(peer->sockets->receiver, numBytes);
+        peers.push_back(std::move(peer));
+    }
+
+    std::size_t allocsBefore = bench::allocationCount();
+    clock::time_point start = clock::now();
+
+    // Bursts of messages arrive between event loop iterations.
+    for (int i = 0; i < NUM_BURSTS; i++) {
+        for (int j = 0; j < BURST_SIZE; j++) {
+            std::string line = ut::string_printf("sender: message %d", i * BURST_SIZE + j);
+            line.resize(MSG_SIZE - 1, '.');
+            line.push_back('\n');
+
+            Msg msg = std::make_shared<const std::string>(std::move(line));
+            for (auto& peer : peers)
+                peer->writer.push(msg);
+        }
+
+        io.poll();
+    }
+
+    // Writers idle on their queues, the loop exits once receivers are done.
+    io.run();
+
+    double elapsedNs = (double) std::chrono::duration_cast<
+        std::chrono::nanoseconds>(clock::now() - start).count();
+    std::size_t numAllocs = bench::allocationCount() - allocsBefore;
+    double numDeliveries = (double) NUM_BURSTS * BURST_SIZE * numReceivers;
+
+    for (auto& peer : peers) {
+        bench::check(peer->drainTask.isReady() && !peer->drainTask.hasError(),
+            "every receiver gets all messages");
+    }
+
+    printf("%-46s %10.1f ns/op %8.2f allocs/op\n", name,
+        elapsedNs / numDeliveries, numAllocs / numDeliveries);
+}
+
+}
+
+// Operations are message deliveries, i.e. messages times receivers.
+void bench_broadcast()
+{
+    static const char *copyingName = "broadcast: copy & write each";
+    static const char *gatheredName = "broadcast: shared & gathered";
+
+    if (!bench::isSelected(copyingName) && !bench::isSelected(gatheredName))
+        return;
+
+    int numReceivers = receiverLimit();
+
+    if (numReceivers < MAX_RECEIVERS)
+        printf("(descriptor limit allows only %d broadcast receivers)\n", numReceivers);
+
+    measure<CopyingWriter>(copyingName, numReceivers);
+    measure<asio::WriteQueue<stream_protocol::socket, std::string>>(gatheredName, numReceivers);
+}
+
+#endif // HAVE_BOOST && __linux__
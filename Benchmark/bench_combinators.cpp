@@ -0,0 +1,161 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/Combinators.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <random>
+#include <vector>
+
+//
+// Combinators
+//
+
+namespace {
+
+static const int FAN_IN = 16;
+static const int MAX_CHILDREN = 100000;
+
+// Awaits n children, completed in random order. The last child fails if
+// isLastFailing is set. Only the completions get measured, operations are
+// children.
+static void measureWide(const char *name, int n, int count, bool isLastFailing)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (!bench::isSelected(name))
+        return;
+
+    std::vector<ut::Task<int>> tasks(n);
+    std::vector<ut::Promise<int>> promises;
+    promises.reserve(n);
+
+    for (auto& task : tasks)
+        promises.push_back(task.takePromise());
+
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+
+    // A failing child stays last.
+    std::mt19937 rng(42);
+    std::shuffle(order.begin(), isLastFailing ? order.end() - 1 : order.end(), rng);
+
+    std::size_t allocsBefore = bench::allocationCount();
+    clock::time_point start = clock::now();
+
+    auto task = (count == n) ? ut::whenAll(tasks) : ut::whenSome(count, tasks);
+
+    for (int i : order) {
+        if (isLastFailing && i == n - 1)
+            promises[i].fail(bench::makeError());
+        else
+            promises[i].complete(i);
+
+        if (task.isReady())
+            break;
+    }
+
+    double elapsedNs = (double) std::chrono::duration_cast<
+        std::chrono::nanoseconds>(clock::now() - start).count();
+    std::size_t numAllocs = bench::allocationCount() - allocsBefore;
+
+    // A failed child is reported through the returned iterator.
+    bench::check(task.isReady() && !task.hasError()
+        && task.get() == (isLastFailing ? tasks.end() - 1 : tasks.end()),
+        "wide combinator completes");
+
+    printf("%-46s %10.1f ns/op %8.2f allocs/op\n", name,
+        elapsedNs / n, (double) numAllocs / n);
+}
+
+}
+
+void bench_combinators()
+{
+    bench::measure("whenAll: 16 tasks, complete in order", 100000, [](long n) {
+        std::array<ut::Task<int>, FAN_IN> tasks;
+        std::array<ut::Promise<int>, FAN_IN> promises;
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            for (int k = 0; k < FAN_IN; k++) {
+                tasks[k] = ut::Task<int>();
+                promises[k] = tasks[k].takePromise();
+            }
+
+            auto all = ut::whenAll(tasks);
+
+            for (auto& promise : promises)
+                promise.complete(1);
+
+            sum += all.isReady() ? 1 : 0;
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("whenAny: 16 tasks, complete last", 100000, [](long n) {
+        std::array<ut::Task<int>, FAN_IN> tasks;
+        std::array<ut::Promise<int>, FAN_IN> promises;
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            for (int k = 0; k < FAN_IN; k++) {
+                tasks[k] = ut::Task<int>();
+                promises[k] = tasks[k].takePromise();
+            }
+
+            auto any = ut::whenAny(tasks);
+            promises[FAN_IN - 1].complete(1);
+
+            sum += (any.get() == tasks.end() - 1) ? 1 : 0;
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("whenAll: 2 tasks (variadic)", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> a, b;
+            ut::Promise<int> pa = a.takePromise();
+            ut::Promise<int> pb = b.takePromise();
+
+            auto all = ut::whenAll(a, b);
+            pb.complete(1);
+            pa.complete(1);
+
+            sum += all.isReady() ? 1 : 0;
+        }
+        bench::consume(sum);
+    });
+
+    // Time per child should stay flat as the number of children grows.
+    for (int n = MAX_CHILDREN / 16; n <= MAX_CHILDREN; n *= 4) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "whenAll: %d tasks, random order", n);
+        measureWide(name, n, n, false);
+
+        snprintf(name, sizeof(name), "whenSome: half of %d tasks, random order", n);
+        measureWide(name, n, n / 2, false);
+
+        snprintf(name, sizeof(name), "whenAll: %d tasks, last one fails", n);
+        measureWide(name, n, n, true);
+    }
+}
@@ -0,0 +1,238 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef __linux__
+
+#include "Bench.h"
+#include "../Examples/util/Chrono.h"
+#include "../Examples/util/EpollLoop.h"
+#include "../Examples/util/Schedule.h"
+#include "../Examples/util/Thread.h"
+#include <CppAsync/StacklessAsync.h>
+#include <cerrno>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//
+// Examples/util/EpollLoop.h: socket ping-pong, deadlines and posted actions
+//
+
+namespace {
+
+static const long NUM_ROUNDTRIPS = 100000;
+static const long NUM_TIMERS = 100000;
+static const long NUM_POSTS = 1000000;
+
+static util::EpollLoop *sLoop;
+
+// Echoes bytes back until the peer hangs up.
+//
+struct EchoFrame : ut::AsyncFrame<void>
+{
+    EchoFrame(int fd)
+        : fd(fd) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (true) {
+            n = read(fd, buf, sizeof(buf));
+
+            if (n > 0) {
+                // Only a few bytes are in flight, the socket buffer never fills up.
+                if (write(fd, buf, n) != n)
+                    break;
+            } else if (n < 0 && errno == EAGAIN) {
+                readable = sLoop->asyncReadable(fd);
+                ut_await_(readable);
+            } else {
+                break; // peer hung up
+            }
+        }
+
+        ut_end();
+    }
+
+private:
+    int fd;
+    ssize_t n;
+    char buf[64];
+    ut::Task<void> readable;
+};
+
+// Sends one byte at a time and waits for it to come back.
+//
+struct PingFrame : ut::AsyncFrame<long>
+{
+    PingFrame(int fd, long numRoundtrips)
+        : fd(fd)
+        , numRoundtrips(numRoundtrips) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (i = 0; i < numRoundtrips; i++) {
+            if (write(fd, "x", 1) != 1)
+                break;
+
+            while (read(fd, &reply, 1) != 1) {
+                readable = sLoop->asyncReadable(fd);
+                ut_await_(readable);
+            }
+        }
+
+        // Hang up, so the echo task finishes.
+        shutdown(fd, SHUT_WR);
+
+        ut_return(i);
+        ut_end();
+    }
+
+private:
+    int fd;
+    long numRoundtrips;
+    long i;
+    char reply;
+    ut::Task<void> readable;
+};
+
+static void pingPong(util::EpollLoop& loop, long numRoundtrips)
+{
+    int fds[2];
+    bench::check(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0,
+        "socketpair");
+
+    ut::Task<void> echoTask = ut::startAsyncOf<EchoFrame>(fds[1]);
+    ut::Task<long> pingTask = ut::startAsyncOf<PingFrame>(fds[0], numRoundtrips);
+
+    loop.run();
+
+    bench::check(echoTask.isReady() && pingTask.isReady()
+        && pingTask.get() == numRoundtrips, "all roundtrips done");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Deadlines that are already due, expired on the next loop iteration.
+static void expireTimers(util::EpollLoop& loop, long numTimers)
+{
+    std::vector<ut::Task<void>> tasks;
+    tasks.reserve(numTimers);
+
+    util::Timepoint now = util::monotonicTime();
+    for (long i = 0; i < numTimers; i++)
+        tasks.push_back(loop.asyncWaitUntil(now));
+
+    loop.run();
+
+    bench::check(tasks.back().isReady(), "all timers expired");
+}
+
+static void postLocal(util::EpollLoop& loop, long numPosts)
+{
+    long counter = 0;
+
+    for (long i = 0; i < numPosts; i++)
+        ut::schedule([&counter] { counter++; });
+
+    loop.run();
+
+    bench::check(counter == numPosts, "all posts ran");
+}
+
+// Waits for actions posted by another thread, then stops the loop. A deadline
+// keeps the loop alive in the meantime.
+//
+struct RemotePostsFrame : ut::AsyncFrame<long>
+{
+    RemotePostsFrame(long numPosts)
+        : numPosts(numPosts)
+        , numReceived(0) { }
+
+    void operator()()
+    {
+        ut::AwaitableBase *doneTask;
+        ut_begin();
+
+        allReceived = ut::Task<void>();
+        promise = allReceived.takePromise();
+
+        worker = util::threading::thread([this] {
+            for (long i = 0; i < numPosts; i++) {
+                ut::schedule([this] {
+                    if (++numReceived == numPosts)
+                        promise();
+                });
+            }
+        });
+
+        deadline = sLoop->asyncDelay(60000);
+        ut_await_any_(doneTask, allReceived, deadline);
+
+        worker.join();
+        sLoop->quit();
+
+        ut_return(numReceived);
+        ut_end();
+    }
+
+private:
+    long numPosts;
+    long numReceived;
+    util::threading::thread worker;
+    ut::Promise<void> promise;
+    ut::Task<void> allReceived;
+    ut::Task<void> deadline;
+};
+
+static void postRemote(util::EpollLoop& loop, long numPosts)
+{
+    ut::Task<long> task = ut::startAsyncOf<RemotePostsFrame>(numPosts);
+    loop.run();
+
+    bench::check(task.isReady() && task.get() == numPosts, "all remote posts ran");
+}
+
+}
+
+void bench_epollLoop()
+{
+    util::EpollLoop loop;
+    sLoop = &loop;
+
+    // ut::schedule() posts to the loop.
+    util::ScheduleGuard scheduleGuard(loop);
+
+    bench::measure("epoll socket ping-pong (roundtrip)", NUM_ROUNDTRIPS,
+        [&](long n) { pingPong(loop, n); });
+
+    bench::measure("epoll expire due timer", NUM_TIMERS,
+        [&](long n) { expireTimers(loop, n); });
+
+    bench::measure("epoll post + run (loop thread)", NUM_POSTS,
+        [&](long n) { postLocal(loop, n); });
+
+    bench::measure("epoll post + run (other thread)", NUM_POSTS,
+        [&](long n) { postRemote(loop, n); });
+
+    sLoop = nullptr;
+}
+
+#endif // __linux__
@@ -0,0 +1,170 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/util/FramePool.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+//
+// Latency of starting request handlers on a fragmented heap
+//
+
+namespace {
+
+static const int NUM_REQUESTS = 1000000;
+static const int NUM_IN_FLIGHT = 1000;
+static const int NUM_NOISE_BLOCKS = 20000;
+
+struct RequestFrame : ut::AsyncFrame<int>
+{
+    RequestFrame(int id, ut::Task<int>& io)
+        : id(id)
+        , io(io) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        scratch[0] = (char) id;
+        ut_await_(io);
+
+        ut_return(io.get() + scratch[0]);
+        ut_end();
+    }
+
+private:
+    int id;
+    ut::Task<int>& io;
+    char scratch[200];
+};
+
+// Stands in for the rest of the server, keeping the global heap fragmented.
+// Uses malloc, so it doesn't show up in allocation counts.
+struct HeapNoise
+{
+    std::vector<void*> blocks;
+    std::uniform_int_distribution<std::size_t> sizes;
+
+    HeapNoise()
+        : blocks(NUM_NOISE_BLOCKS, nullptr)
+        , sizes(16, 1024) { }
+
+    ~HeapNoise()
+    {
+        for (void *p : blocks)
+            free(p);
+    }
+
+    void churn(std::mt19937& rng)
+    {
+        void*& p = blocks[rng() % blocks.size()];
+        free(p);
+        p = malloc(sizes(rng));
+    }
+};
+
+// Reports latency percentiles of startAsyncOf() and allocations per start.
+template <class Alloc>
+static void measure(const char *name, const Alloc& alloc)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (!bench::isSelected(name))
+        return;
+
+    std::mt19937 rng(1234);
+    HeapNoise noise;
+    std::vector<ut::Task<int>> io(NUM_IN_FLIGHT);
+    std::vector<ut::Promise<int>> promises(NUM_IN_FLIGHT);
+    std::vector<ut::Task<int>> handlers(NUM_IN_FLIGHT);
+    std::vector<float> latencies;
+    latencies.reserve(NUM_REQUESTS);
+    std::size_t numAllocs = 0;
+    long sum = 0;
+
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        // Finish a random request, then start a new one in its place.
+        int slot = (int) (rng() % NUM_IN_FLIGHT); // safe cast
+
+        if (promises[slot].isCompletable()) {
+            promises[slot].complete(1);
+            bench::check(handlers[slot].isReady() && !handlers[slot].hasError(),
+                "request handler finishes");
+            sum += handlers[slot].get();
+        }
+        handlers[slot] = ut::Task<int>();
+
+        io[slot] = ut::Task<int>();
+        promises[slot] = io[slot].takePromise();
+
+        for (int j = 0; j < 4; j++)
+            noise.churn(rng);
+
+        std::size_t allocsBefore = bench::allocationCount();
+        clock::time_point start = clock::now();
+
+        handlers[slot] = ut::startAsyncOf<RequestFrame>(std::allocator_arg, alloc, i, io[slot]);
+
+        clock::time_point end = clock::now();
+        numAllocs += bench::allocationCount() - allocsBefore;
+
+        latencies.push_back(std::chrono::duration<float, std::nano>(end - start).count());
+    }
+
+    bench::consume(sum);
+    std::sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&latencies](double p) {
+        return latencies[(std::size_t) (p * (latencies.size() - 1))];
+    };
+
+    printf("%-46s %10.1f ns/op %8.2f allocs/op\n", name,
+        percentile(0.5), (double) numAllocs / NUM_REQUESTS);
+    printf("%-46s p99 %.0f ns, p99.9 %.0f ns, max %.0f ns\n", "  latency",
+        percentile(0.99), percentile(0.999), latencies.back());
+}
+
+}
+
+// 1M requests, 1000 in flight. Reported ns/op is the median startAsyncOf() latency.
+void bench_framePool()
+{
+    measure("frame pool: startAsyncOf p50, std::allocator", std::allocator<char>());
+
+    static const char *pooledName = "frame pool: startAsyncOf p50, FramePoolAlloc";
+
+    if (!bench::isSelected(pooledName))
+        return;
+
+    ut::FramePool& pool = ut::FramePool::local();
+    pool.resetStats();
+
+    measure(pooledName, ut::FramePoolAlloc<>());
+
+    const ut::FramePoolStats& stats = pool.stats();
+    printf("%-46s %.4f hit rate, peak %d blocks in use, %d cached (%d KB)\n", "  frame pool",
+        stats.hitRate(), (int) stats.peakInUse, (int) stats.numCached,
+        (int) (stats.bytesCached / 1024));
+
+    bench::check(stats.hitRate() > 0.99, "frame pool serves steady state requests");
+
+    pool.trim();
+}
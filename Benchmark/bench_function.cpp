@@ -0,0 +1,120 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/util/UniqueFunction.h>
+#include <array>
+#include <memory>
+
+//
+// UniqueFunction
+//
+
+namespace {
+
+static int twice(int x)
+{
+    return 2 * x;
+}
+
+struct MoveOnlyClosure
+{
+    std::unique_ptr<long> p;
+
+    long operator()(int x) const
+    {
+        return *p + x;
+    }
+};
+
+using IntAction = ut::UniqueFunction<void (int)>;
+using LongFunction = ut::UniqueFunction<long (int)>;
+
+// Functions get stored as function pointers, even when the signature differs.
+static_assert(std::is_constructible<IntAction, int (&)(int)>::value,
+    "Function references should convert to UniqueFunction");
+static_assert(LongFunction::IsInline<int (&)(int)>::value,
+    "Function references should be stored inline");
+
+}
+
+void bench_function()
+{
+    if (bench::isSelected("UniqueFunction")) {
+        // Return values are discarded, or converted to the wrapper's result.
+        int sum = 0;
+        IntAction action = twice;
+        action(1);
+        action = [&sum](int x) { sum += x; };
+        action(3);
+        bench::check(sum == 3, "UniqueFunction<void (int)> calls the latest closure");
+
+        LongFunction f(twice);
+        bench::check(f(21) == 42, "UniqueFunction<long (int)> wraps int (&)(int)");
+        f = &twice;
+        bench::check(f(5) == 10, "UniqueFunction<long (int)> wraps int (*)(int)");
+
+        int (*none)(int) = nullptr;
+        f = none;
+        bench::check(!f, "Null function pointers make an empty function");
+    }
+
+    bench::measure("UniqueFunction: wrap function, call", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            LongFunction f(twice);
+            bench::doNotOptimize(f);
+            sum += f((int) i); // safe cast
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("UniqueFunction: wrap 4 pointer closure, call", 1000000, [](long n) {
+        long a = 1, b = 2, c = 3, d = 4;
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            LongFunction f([&a, &b, &c, &d](int x) { return a + b + c + d + x; });
+            bench::doNotOptimize(f);
+            sum += f((int) i); // safe cast
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("UniqueFunction: wrap move-only closure, call", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            LongFunction f(MoveOnlyClosure { std::unique_ptr<long>(new long(i)) });
+            bench::doNotOptimize(f);
+            sum += f(1);
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("UniqueFunction: wrap 16 pointer closure, call", 1000000, [](long n) {
+        std::array<long, 16> values = { };
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            LongFunction f([values](int x) { return values[0] + x; });
+            bench::doNotOptimize(f);
+            sum += f((int) i); // safe cast
+        }
+        bench::consume(sum);
+    });
+}
@@ -0,0 +1,143 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_BOOST_CONTEXT
+
+#include "Bench.h"
+#include <CppAsync/StackfulAsync.h>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+//
+// Resident memory of idle fibers on lazily committed, pooled stacks
+//
+
+namespace {
+
+static const int NUM_FIBERS = 10000;
+static const int STACK_SIZE = 256 * 1024;
+static const int DEEP_CALL_DEPTH = 48; // ~48KB of stack
+
+static long residentKB()
+{
+#ifdef __linux__
+    long numPages = 0, numResident = 0;
+
+    if (FILE *file = fopen("/proc/self/statm", "r")) {
+        if (fscanf(file, "%ld %ld", &numPages, &numResident) != 2)
+            numResident = 0;
+        fclose(file);
+    }
+
+    return numResident * (long) (boost::context::stack_traits::page_size() / 1024);
+#else
+    return -1;
+#endif
+}
+
+static int deepCall(int depth)
+{
+    volatile char frame[1024];
+    memset(const_cast<char*>(frame), depth, sizeof(frame));
+
+    return depth == 0 ? frame[0] : deepCall(depth - 1) + frame[1];
+}
+
+// Starts fibers that touch callDepth KB of stack, then sit idle on a task.
+// Reports time and allocations per fiber start, and RSS while all are idle.
+static void runWave(const char *name, int callDepth)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<ut::Task<void>> idleTasks(NUM_FIBERS);
+    std::vector<ut::Promise<void>> promises;
+    std::vector<ut::Task<int>> fibers;
+
+    promises.reserve(NUM_FIBERS);
+    fibers.reserve(NUM_FIBERS);
+
+    for (auto& idleTask : idleTasks)
+        promises.push_back(idleTask.takePromise());
+
+    std::size_t allocsBefore = bench::allocationCount();
+    clock::time_point start = clock::now();
+
+    for (int i = 0; i < NUM_FIBERS; i++) {
+        ut::Task<void> *idleTask = &idleTasks[i];
+
+        fibers.push_back(ut::stackful::startAsync([idleTask, callDepth]() -> int {
+            int result = deepCall(callDepth);
+            ut::stackful::await_(*idleTask);
+            return result;
+        }, ut::stackful::LazyPooledStack(STACK_SIZE)));
+    }
+
+    double elapsedNs = (double) std::chrono::duration_cast<
+        std::chrono::nanoseconds>(clock::now() - start).count();
+    std::size_t numAllocs = bench::allocationCount() - allocsBefore;
+
+    printf("%-46s %10.1f ns/op %8.2f allocs/op\n", name,
+        elapsedNs / NUM_FIBERS, (double) numAllocs / NUM_FIBERS);
+    printf("%-46s %10ld KB resident\n", "  all fibers idle", residentKB());
+
+    for (auto& promise : promises)
+        promise.complete();
+
+    for (auto& fiber : fibers)
+        bench::check(fiber.isReady() && !fiber.hasError(), "idle fiber finishes");
+}
+
+static void measure(const char *deepName, const char *idleName, std::size_t trimWatermark)
+{
+    if (!bench::isSelected(deepName) && !bench::isSelected(idleName))
+        return;
+
+    auto& pool = ut::stackful::StackPool::local();
+    pool.setHighWaterMark(NUM_FIBERS);
+    pool.setTrimWatermark(trimWatermark);
+    pool.resetStats();
+
+    // Second wave reuses the stacks dirtied by the first.
+    runWave(deepName, DEEP_CALL_DEPTH);
+    runWave(idleName, 0);
+
+    // Stacks are only inspected when they might be trimmed.
+    const ut::stackful::StackPoolStats& stats = pool.stats();
+    if (stats.numSampled > 0) {
+        printf("%-46s %10.1f touched pages per stack (peak %d), %d pages trimmed\n",
+            "  stack pool", stats.meanTouchedPages(), (int) stats.peakTouchedPages,
+            (int) stats.numTrimmedPages);
+    }
+
+    pool.trim();
+    pool.setHighWaterMark(ut::stackful::StackPool::DEFAULT_HIGH_WATER_MARK);
+    pool.setTrimWatermark(ut::stackful::StackPool::DEFAULT_TRIM_WATERMARK);
+}
+
+}
+
+// 10k fibers on 256 KB lazy stacks. Operations are fiber starts.
+void bench_lazyStacks()
+{
+    measure("lazy stacks: 10k deep fibers, no trimming",
+        "lazy stacks: 10k idle fibers, no trimming", (std::size_t) -1);
+
+    measure("lazy stacks: 10k deep fibers, trim past 16 KB",
+        "lazy stacks: 10k idle fibers, trim past 16 KB", 16 * 1024);
+}
+
+#endif // HAVE_BOOST_CONTEXT
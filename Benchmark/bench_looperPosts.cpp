@@ -0,0 +1,199 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include "../Examples/util/Looper.h"
+#include "../Examples/util/RemotePromise.h"
+#include "../Examples/util/Thread.h"
+#include <CppAsync/Task.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+//
+// Post to a Looper from several threads at once, and complete promises owned by
+// the loop thread from a worker thread. Also checks that a long delayed remote
+// action doesn't make ticket bookkeeping grow with later posts.
+//
+
+namespace {
+
+static const int MAX_PRODUCERS = 4;
+static const long NUM_POSTS = 1000000;
+static const long NUM_COMPLETIONS = 250000;
+static const long NUM_BOUNDED_POSTS = 2000000;
+static const long BOUNDED_BURST_SIZE = 1000;
+static const std::size_t MAX_REMOTE_SLOTS = 4 * BOUNDED_BURST_SIZE;
+
+static void posts(int numProducers, long numPosts)
+{
+    util::Looper looper;
+    std::atomic<bool> isStarted(false);
+    long numReceived = 0;
+    const long numPostsPerProducer = numPosts / numProducers;
+    const long numExpected = numPostsPerProducer * numProducers;
+
+    std::vector<util::threading::thread> producers;
+
+    for (int i = 0; i < numProducers; i++) {
+        producers.emplace_back([&] {
+            while (!isStarted)
+                util::threading::this_thread::yield();
+
+            for (long j = 0; j < numPostsPerProducer; j++)
+                looper.post([&] { numReceived++; });
+        });
+    }
+
+    // Keep looping until all posts have been received.
+    std::function<void ()> poll = [&] {
+        if (numReceived < numExpected)
+            looper.schedule(poll, 1);
+    };
+    looper.post(poll);
+
+    isStarted = true;
+    looper.run();
+
+    for (auto& producer : producers)
+        producer.join();
+
+    bench::check(numReceived == numExpected, "all posts received");
+}
+
+static void completions(bool useRemotePromise, long numCompletions)
+{
+    util::Looper looper;
+    std::vector<ut::Task<long>> tasks(numCompletions);
+    std::vector<ut::SharedPromise<long>> sharedPromises;
+    std::vector<util::RemotePromise<long>> remotePromises;
+
+    // Promises are taken on the loop thread, then handed over to the worker.
+    for (auto& task : tasks) {
+        if (useRemotePromise)
+            remotePromises.push_back(util::makeRemotePromise(looper, task.takePromise()));
+        else
+            sharedPromises.push_back(task.takePromise().share());
+    }
+
+    util::threading::thread worker([&] {
+        for (long i = 0; i < numCompletions; i++) {
+            if (useRemotePromise) {
+                remotePromises[i].complete(i);
+            } else {
+                ut::SharedPromise<long> promise = sharedPromises[i];
+                looper.post([promise, i] { promise(i); });
+            }
+        }
+    });
+
+    // Completions arrive in order, keep looping until the last one.
+    std::function<void ()> poll = [&] {
+        if (!tasks.back().isReady())
+            looper.schedule(poll, 1);
+    };
+    looper.post(poll);
+    looper.run();
+
+    worker.join();
+
+    long sum = 0;
+    for (auto& task : tasks)
+        sum += task.isReady() ? task.get() : 0;
+
+    bench::check(sum == numCompletions * (numCompletions - 1) / 2, "all tasks completed");
+}
+
+// Returns the largest remote slot capacity seen.
+static std::size_t postsBehindLongDelayedRemote(long numPosts)
+{
+    util::Looper looper;
+    std::atomic<util::Ticket> longTicket(0);
+    std::atomic<long> numReceived(0);
+    std::size_t maxCapacity = 0;
+
+    numPosts = std::max(BOUNDED_BURST_SIZE, numPosts / BOUNDED_BURST_SIZE * BOUNDED_BURST_SIZE);
+
+    util::threading::thread producer([&] {
+        longTicket = looper.schedule([] { bench::check(false, "long timer canceled"); },
+            3600 * 1000);
+
+        // Bursts are throttled, so at most one burst is pending at a time.
+        for (long i = 0; i < numPosts; i += BOUNDED_BURST_SIZE) {
+            for (long j = 0; j < BOUNDED_BURST_SIZE; j++)
+                looper.post([&] { numReceived.fetch_add(1, std::memory_order_relaxed); });
+
+            while (numReceived < i + BOUNDED_BURST_SIZE)
+                util::threading::this_thread::yield();
+        }
+    });
+
+    // Once all posts have arrived, cancel the long delayed action so the loop can exit.
+    std::function<void ()> poll = [&] {
+        maxCapacity = std::max(maxCapacity, looper.remoteSlotCapacity());
+
+        if (numReceived < numPosts)
+            looper.schedule(poll, 1);
+        else
+            bench::check(looper.cancel(longTicket), "long timer canceled");
+    };
+    looper.post(poll);
+    looper.run();
+
+    producer.join();
+
+    bench::check(numReceived == numPosts, "all posts received");
+
+    // Bookkeeping tracks pending remote actions, not the distance to the oldest one.
+    bench::check(maxCapacity <= MAX_REMOTE_SLOTS, "remote slots bounded by pending posts");
+
+    return maxCapacity;
+}
+
+}
+
+void bench_looperPosts()
+{
+    for (int numProducers = 1; numProducers <= MAX_PRODUCERS; numProducers *= 2) {
+        char name[64];
+        snprintf(name, sizeof(name), "looper: remote post, %d producer(s)", numProducers);
+
+        bench::measure(name, NUM_POSTS, [numProducers](long n) {
+            posts(numProducers, n);
+        });
+    }
+
+    bench::measure("looper: completion, posted SharedPromise", NUM_COMPLETIONS, [](long n) {
+        completions(false, n);
+    });
+
+    bench::measure("looper: completion, RemotePromise", NUM_COMPLETIONS, [](long n) {
+        completions(true, n);
+    });
+
+    static const char *boundedName = "looper: remote post behind 1 h remote timer";
+
+    if (bench::isSelected(boundedName)) {
+        std::size_t maxCapacity = 0;
+
+        bench::measure(boundedName, NUM_BOUNDED_POSTS, [&maxCapacity](long n) {
+            maxCapacity = std::max(maxCapacity, postsBehindLongDelayedRemote(n));
+        });
+
+        printf("  at most %d ticket slots for remote actions\n", (int) maxCapacity);
+    }
+}
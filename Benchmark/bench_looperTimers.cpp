@@ -0,0 +1,104 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include "../Examples/util/Looper.h"
+#include <random>
+#include <vector>
+
+//
+// Schedule and cancel lots of Looper timers
+//
+
+namespace {
+
+static const int NUM_TIMERS = 1000000;
+
+static util::Looper *sLooper;
+
+// Random delays, so that timers land all over the queue.
+static std::vector<long> randomDelays(long minDelay, long maxDelay)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<long> delays(minDelay, maxDelay);
+
+    std::vector<long> result(NUM_TIMERS);
+    for (long& delay : result)
+        delay = delays(rng);
+
+    return result;
+}
+
+// Long timeouts, canceled before firing.
+static void scheduleCancel(const std::vector<long>& delays, long n)
+{
+    std::vector<util::Ticket> tickets(n);
+    long numCanceled = 0;
+
+    // Cancel may only be called from inside the loop.
+    sLooper->post([&] {
+        for (long i = 0; i < n; i++)
+            tickets[i] = sLooper->schedule([] { bench::check(false, "canceled timer fired"); },
+                delays[i]);
+
+        for (util::Ticket ticket : tickets)
+            numCanceled += sLooper->cancel(ticket) ? 1 : 0;
+    });
+
+    sLooper->run();
+
+    bench::check(numCanceled == n, "all timers canceled");
+}
+
+// Short timeouts, every other one canceled.
+static void scheduleFire(const std::vector<long>& delays, long n)
+{
+    std::vector<util::Ticket> tickets(n);
+    long numFired = 0;
+
+    sLooper->post([&] {
+        for (long i = 0; i < n; i++)
+            tickets[i] = sLooper->schedule([&numFired] { numFired++; }, delays[i]);
+
+        for (long i = 0; i < n; i += 2)
+            sLooper->cancel(tickets[i]);
+    });
+
+    sLooper->run();
+
+    bench::check(numFired == n / 2, "uncanceled timers fired");
+}
+
+}
+
+void bench_looperTimers()
+{
+    util::Looper looper;
+    sLooper = &looper;
+
+    std::vector<long> longDelays = randomDelays(1000, 60000);
+    std::vector<long> shortDelays = randomDelays(0, 5);
+
+    bench::measure("looper: schedule + cancel timer", NUM_TIMERS, [&](long n) {
+        scheduleCancel(longDelays, n);
+    });
+
+    bench::measure("looper: schedule timer, fire or cancel", NUM_TIMERS, [&](long n) {
+        scheduleFire(shortDelays, n);
+    });
+
+    sLooper = nullptr;
+}
@@ -0,0 +1,140 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_BOOST_CONTEXT
+
+#include "Bench.h"
+#include <CppAsync/StackfulAsync.h>
+
+//
+// Stackful coroutines
+//
+
+namespace {
+
+static const int STACK_SIZE = 16 * 1024;
+
+template <class StackAllocator>
+static void startAsyncChurn(long n)
+{
+    long sum = 0;
+
+    for (long i = 0; i < n; i++) {
+        ut::Task<int> task = ut::stackful::startAsync([]() -> int {
+            return 1;
+        }, StackAllocator(STACK_SIZE));
+        sum += task.get();
+    }
+    bench::consume(sum);
+}
+
+}
+
+void bench_stackful()
+{
+    bench::measure("stackful: startAsync, run to completion", 100000,
+        &startAsyncChurn<ut::stackful::FixedSizeStack>);
+
+    bench::measure("stackful: startAsync, protected stack", 100000,
+        &startAsyncChurn<ut::stackful::ProtectedFixedSizeStack>);
+
+    ut::stackful::StackPool::local().resetStats();
+
+    bench::measure("stackful: startAsync, pooled stack", 100000,
+        &startAsyncChurn<ut::stackful::PooledStack>);
+
+    bench::measure("stackful: startAsync, lazy pooled stack", 100000,
+        &startAsyncChurn<ut::stackful::LazyPooledStack>);
+
+    const ut::stackful::StackPoolStats& stats = ut::stackful::StackPool::local().stats();
+    if (bench::isSelected("stackful: startAsync, pooled stack")) {
+        printf("%-46s %9.4f%% hits, %d created, peak %d in use\n", "  stack pool",
+            100.0 * stats.hitRate(), (int) stats.numCreated, (int) stats.peakInUse);
+    }
+
+    // Each step switches into the coroutine and back.
+    bench::measure("stackful: await_ suspend, resume", 1000000, [](long n) {
+        ut::Promise<int> promise;
+
+        ut::Task<long> task = ut::stackful::startAsync([n, &promise]() -> long {
+            long sum = 0;
+
+            for (long i = 0; i < n; i++) {
+                ut::Task<int> subtask;
+                promise = subtask.takePromise();
+                sum += ut::stackful::await_(subtask);
+            }
+            return sum;
+        }, STACK_SIZE);
+
+        for (long i = 0; i < n; i++)
+            promise.complete(1);
+
+        bench::consume(task.get());
+    });
+
+    // Producer hands values to a consumer. Without symmetric transfer, each
+    // hand-off bounces through the main stack.
+    bench::measure("stackful: hand-off through parent", 1000000, [](long n) {
+        long sum = 0;
+
+        ut::stackful::StackfulCoroutine producer([]() {
+            for (long i = 0; ; i++)
+                ut::stackful::yield_(&i);
+        }, ut::stackful::FixedSizeStack(STACK_SIZE));
+
+        ut::stackful::StackfulCoroutine consumer([&sum](void *arg) {
+            while (true) {
+                sum += *static_cast<long*>(arg);
+                arg = ut::stackful::yield_();
+            }
+        }, ut::stackful::FixedSizeStack(STACK_SIZE));
+
+        for (long i = 0; i < n; i++) {
+            producer();
+            consumer(producer.value());
+        }
+        bench::check(sum == n * (n - 1) / 2, "hand-off through parent sum");
+        bench::consume(sum);
+    });
+
+    bench::measure("stackful: hand-off by transferTo", 1000000, [](long n) {
+        long sum = 0;
+        ut::stackful::StackfulCoroutine *pProducer = nullptr;
+
+        ut::stackful::StackfulCoroutine consumer([&sum, &pProducer](void *arg) {
+            while (true) {
+                sum += *static_cast<long*>(arg);
+                arg = ut::stackful::transferTo(*pProducer);
+            }
+        }, ut::stackful::FixedSizeStack(STACK_SIZE));
+
+        ut::stackful::StackfulCoroutine producer([n, &consumer]() {
+            for (long i = 0; i < n; i++)
+                ut::stackful::transferTo(consumer, &i);
+        }, ut::stackful::FixedSizeStack(STACK_SIZE));
+
+        pProducer = &producer;
+        bool isRunning = producer();
+
+        // Consumer is left parked in transferTo(), producer finished the chain.
+        bench::check(!isRunning && producer.isDone(), "producer finishes the chain");
+        bench::check(sum == n * (n - 1) / 2, "hand-off by transferTo sum");
+        bench::consume(sum);
+    });
+}
+
+#endif // HAVE_BOOST_CONTEXT
@@ -0,0 +1,200 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/util/FramePool.h>
+
+//
+// Stackless coroutines
+//
+
+namespace {
+
+struct EmptyFrame : ut::AsyncFrame<int>
+{
+    EmptyFrame(int value)
+        : value(value) { }
+
+    void operator()()
+    {
+        ut_begin();
+        ut_return(value);
+        ut_end();
+    }
+
+private:
+    int value;
+};
+
+// Suspends on each step until the promise gets completed from outside.
+//
+struct AwaitLoopFrame : ut::AsyncFrame<long>
+{
+    AwaitLoopFrame(long numSteps, ut::Promise<int>& promise)
+        : numSteps(numSteps)
+        , promise(promise)
+        , sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (step = 0; step < numSteps; step++) {
+            subtask = ut::Task<int>();
+            promise = subtask.takePromise();
+
+            ut_await_(subtask);
+            sum += subtask.get();
+        }
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    long numSteps;
+    ut::Promise<int>& promise;
+    long step;
+    long sum;
+    ut::Task<int> subtask;
+};
+
+// Awaits tasks that are ready already, never suspends.
+//
+struct AwaitReadyFrame : ut::AsyncFrame<long>
+{
+    AwaitReadyFrame(long numSteps)
+        : numSteps(numSteps)
+        , sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (step = 0; step < numSteps; step++) {
+            subtask = ut::makeCompletedTask<int>(1);
+
+            ut_await_(subtask);
+            sum += subtask.get();
+        }
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    long numSteps;
+    long step;
+    long sum;
+    ut::Task<int> subtask;
+};
+
+// Each step fails, and the error gets caught by the frame.
+//
+struct AwaitFailLoopFrame : ut::AsyncFrame<long>
+{
+    AwaitFailLoopFrame(long numSteps, ut::Promise<int>& promise)
+        : numSteps(numSteps)
+        , promise(promise)
+        , numFailed(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (step = 0; step < numSteps; step++) {
+            subtask = ut::Task<int>();
+            promise = subtask.takePromise();
+
+            ut_await_no_throw_(subtask);
+            numFailed += subtask.hasError() ? 1 : 0;
+        }
+
+        ut_return(numFailed);
+        ut_end();
+    }
+
+private:
+    long numSteps;
+    ut::Promise<int>& promise;
+    long step;
+    long numFailed;
+    ut::Task<int> subtask;
+};
+
+}
+
+void bench_stackless()
+{
+    bench::measure("stackless: startAsyncOf, run to completion", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task = ut::startAsyncOf<EmptyFrame>((int) i); // safe cast
+            sum += task.get();
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("stackless: startAsyncOf in arena, completion", 1000000, [](long n) {
+        ut::AsyncFrameArena<EmptyFrame> arena;
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task = ut::startAsyncOf<EmptyFrame>(arena, (int) i); // safe cast
+            sum += task.get();
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("stackless: startAsyncOf pooled, completion", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task = ut::startAsyncOf<EmptyFrame>(std::allocator_arg,
+                ut::FramePoolAlloc<>(), (int) i); // safe cast
+            sum += task.get();
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("stackless: ut_await_ suspend, resume", 1000000, [](long n) {
+        ut::Promise<int> promise;
+        ut::Task<long> task = ut::startAsyncOf<AwaitLoopFrame>(n, promise);
+
+        for (long i = 0; i < n; i++)
+            promise.complete(1);
+
+        bench::consume(task.get());
+    });
+
+    bench::measure("stackless: ut_await_ ready task", 1000000, [](long n) {
+        ut::Task<long> task = ut::startAsyncOf<AwaitReadyFrame>(n);
+
+        bench::consume(task.get());
+    });
+
+    bench::measure("stackless: ut_await_no_throw_ failed task", 1000000, [](long n) {
+        ut::Promise<int> promise;
+        ut::Task<long> task = ut::startAsyncOf<AwaitFailLoopFrame>(n, promise);
+
+        for (long i = 0; i < n; i++)
+            promise.fail(bench::makeError());
+
+        bench::consume(task.get());
+    });
+}
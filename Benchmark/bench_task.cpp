@@ -0,0 +1,99 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <CppAsync/Task.h>
+
+//
+// Task / Promise primitives
+//
+
+void bench_task()
+{
+    bench::measure("Task<int>: create, complete, get", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task;
+            ut::Promise<int> promise = task.takePromise();
+            bench::doNotOptimize(task);
+            promise.complete((int) i); // safe cast
+            sum += task.get();
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("Task<int>: create, cancel", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task;
+            ut::Promise<int> promise = task.takePromise();
+            bench::doNotOptimize(task);
+            task.cancel();
+            sum += promise.isCompletable() ? 1 : 0;
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("Task<int>: create, fail", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task;
+            bench::doNotOptimize(task);
+            task.takePromise().fail(bench::makeError());
+            sum += task.hasError() ? 1 : 0;
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("makeCompletedTask<int>", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task = ut::makeCompletedTask<int>((int) i); // safe cast
+            bench::doNotOptimize(task);
+            sum += task.get();
+        }
+        bench::consume(sum);
+    });
+
+    bench::measure("Task<int>: move", 1000000, [](long n) {
+        ut::Task<int> a;
+        ut::Promise<int> promise = a.takePromise();
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> b(std::move(a));
+            bench::doNotOptimize(b);
+            a = std::move(b);
+        }
+        promise.complete(1);
+        bench::consume(a.get());
+    });
+
+    bench::measure("SharedPromise<int>: share, complete", 1000000, [](long n) {
+        long sum = 0;
+
+        for (long i = 0; i < n; i++) {
+            ut::Task<int> task;
+            ut::SharedPromise<int> promise = task.takePromise().share();
+            promise((int) i); // safe cast
+            sum += task.get();
+        }
+        bench::consume(sum);
+    });
+}
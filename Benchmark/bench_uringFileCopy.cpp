@@ -0,0 +1,252 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_IO_URING
+
+#include "Bench.h"
+#include "../Examples/util/EpollLoop.h"
+#include "../Examples/util/UringService.h"
+#include <CppAsync/StacklessAsync.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+//
+// Copy a local file with blocking read() / write() vs io_uring, per chunk
+//
+// Results vary a lot between machines, kernels and file systems. With a warm
+// page cache, blocking calls may well win, and more reads in flight may be
+// slower than one.
+//
+
+namespace {
+
+static const std::size_t FILE_SIZE = 64 << 20;
+static const std::size_t CHUNK_SIZE = 128 << 10;
+static const long NUM_CHUNKS = (long) (FILE_SIZE / CHUNK_SIZE);
+static const int QUEUE_DEPTH = 8;
+
+static util::UringService *sService;
+
+struct CopyState
+{
+    int srcFd;
+    int dstFd;
+    std::size_t nextOffset;
+    std::size_t size;
+};
+
+// Copies chunks until the range is exhausted. Several workers keep multiple
+// reads and writes in flight.
+//
+struct CopyWorkerFrame : ut::AsyncFrame<void>
+{
+    CopyWorkerFrame(CopyState *state)
+        : state(state)
+        , buf(CHUNK_SIZE) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (state->nextOffset < state->size) {
+            offset = state->nextOffset;
+            state->nextOffset += CHUNK_SIZE;
+
+            io = sService->asyncRead(state->srcFd, buf.data(), CHUNK_SIZE, offset);
+            ut_await_(io);
+            size = io.get();
+
+            for (written = 0; written < size; written += io.get()) {
+                io = sService->asyncWrite(state->dstFd, buf.data() + written,
+                    size - written, offset + written);
+                ut_await_(io);
+            }
+        }
+
+        ut_end();
+    }
+
+private:
+    CopyState *state;
+    std::vector<char> buf;
+    std::size_t offset;
+    std::size_t size;
+    std::size_t written;
+    ut::Task<std::size_t> io;
+};
+
+// E.g. io_uring_setup blocked by a seccomp filter
+static bool isUringAvailable()
+{
+    io_uring_params params = io_uring_params();
+
+    int ringFd = util::detail::uring::setup(1, &params);
+    if (ringFd < 0)
+        return false;
+
+    close(ringFd);
+    return true;
+}
+
+static bool makeSourceFile(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+
+    std::vector<char> chunk(CHUNK_SIZE);
+    for (std::size_t offset = 0; offset < FILE_SIZE; offset += CHUNK_SIZE) {
+        for (std::size_t i = 0; i < CHUNK_SIZE; i++)
+            chunk[i] = (char) ((offset / CHUNK_SIZE + i) * 31); // safe cast
+
+        if (write(fd, chunk.data(), CHUNK_SIZE) != (ssize_t) CHUNK_SIZE) {
+            close(fd);
+            return false;
+        }
+    }
+
+    close(fd);
+    return true;
+}
+
+static bool isSameContent(const char *pathA, const char *pathB)
+{
+    int fdA = open(pathA, O_RDONLY | O_CLOEXEC);
+    int fdB = open(pathB, O_RDONLY | O_CLOEXEC);
+    bool isSame = (fdA >= 0 && fdB >= 0);
+
+    std::vector<char> a(CHUNK_SIZE), b(CHUNK_SIZE);
+    while (isSame) {
+        ssize_t sizeA = read(fdA, a.data(), CHUNK_SIZE);
+        ssize_t sizeB = read(fdB, b.data(), CHUNK_SIZE);
+
+        isSame = (sizeA == sizeB && sizeA >= 0 && memcmp(a.data(), b.data(), sizeA) == 0);
+        if (sizeA <= 0)
+            break;
+    }
+
+    close(fdA);
+    close(fdB);
+    return isSame;
+}
+
+static void copyBlocking(int srcFd, int dstFd, long numChunks, std::vector<char>& buf)
+{
+    for (long i = 0; i < numChunks; i++) {
+        ssize_t size = read(srcFd, buf.data(), CHUNK_SIZE);
+        if (size <= 0)
+            return;
+
+        for (ssize_t written = 0; written < size; ) {
+            ssize_t result = write(dstFd, buf.data() + written, size - written);
+            if (result < 0)
+                return;
+
+            written += result;
+        }
+    }
+}
+
+static void copyUring(util::EpollLoop& loop, int srcFd, int dstFd, long numChunks,
+    int queueDepth)
+{
+    CopyState state = { srcFd, dstFd, 0, numChunks * CHUNK_SIZE };
+
+    std::vector<ut::Task<void>> workers;
+    for (int i = 0; i < queueDepth; i++)
+        workers.push_back(ut::startAsyncOf<CopyWorkerFrame>(&state));
+
+    loop.run();
+
+    for (auto& worker : workers)
+        bench::check(worker.isReady() && !worker.hasError(), "io_uring copy");
+}
+
+// Copies the first numChunks of the source file, the destination is truncated.
+template <class F>
+static void measure(const char *name, const std::string& srcPath,
+    const std::string& dstPath, F&& copy)
+{
+    if (!bench::isSelected(name))
+        return;
+
+    bench::measure(name, NUM_CHUNKS, [&](long n) {
+        int srcFd = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+        int dstFd = open(dstPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bench::check(srcFd >= 0 && dstFd >= 0, "opening files");
+
+        copy(srcFd, dstFd, n);
+
+        close(srcFd);
+        close(dstFd);
+    });
+
+    // Last round copies the whole file.
+    bench::check(isSameContent(srcPath.c_str(), dstPath.c_str()), "copy matches source");
+}
+
+}
+
+void bench_uringFileCopy()
+{
+    static const char *blockingName = "file copy, read / write (chunk)";
+    static const char *uringName = "file copy, io_uring 1 in flight (chunk)";
+    static const char *uringQueuedName = "file copy, io_uring 8 in flight (chunk)";
+
+    if (!bench::isSelected(blockingName) && !bench::isSelected(uringName)
+            && !bench::isSelected(uringQueuedName))
+        return;
+
+    if (!isUringAvailable()) {
+        printf("  io_uring unavailable, skipping file copy\n");
+        return;
+    }
+
+    const char *tmpDir = getenv("TMPDIR");
+    std::string srcPath = std::string(tmpDir != nullptr ? tmpDir : "/tmp") + "/ut_copy_src";
+    std::string dstPath = std::string(tmpDir != nullptr ? tmpDir : "/tmp") + "/ut_copy_dst";
+
+    bench::check(makeSourceFile(srcPath.c_str()), "creating source file");
+
+    // Set up once, so only the copy itself gets measured.
+    util::EpollLoop loop;
+    util::UringService service(loop);
+    sService = &service;
+
+    std::vector<char> buf(CHUNK_SIZE);
+
+    measure(blockingName, srcPath, dstPath,
+        [&](int srcFd, int dstFd, long n) { copyBlocking(srcFd, dstFd, n, buf); });
+
+    measure(uringName, srcPath, dstPath,
+        [&](int srcFd, int dstFd, long n) { copyUring(loop, srcFd, dstFd, n, 1); });
+
+    measure(uringQueuedName, srcPath, dstPath,
+        [&](int srcFd, int dstFd, long n) { copyUring(loop, srcFd, dstFd, n, QUEUE_DEPTH); });
+
+    printf("  %d KB chunks, page cache is warm\n", (int) (CHUNK_SIZE >> 10));
+
+    sService = nullptr;
+
+    unlink(srcPath.c_str());
+    unlink(dstPath.c_str());
+}
+
+#endif // HAVE_IO_URING
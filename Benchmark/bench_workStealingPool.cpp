@@ -0,0 +1,355 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include "../Examples/util/Looper.h"
+#include "../Examples/util/RemotePromise.h"
+#include "../Examples/util/Schedule.h"
+#include "../Examples/util/Thread.h"
+#include "../Examples/util/WorkStealingPool.h"
+#include <CppAsync/Combinators.h>
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/util/MoveOnCopy.h>
+#include <atomic>
+#include <vector>
+
+//
+// ut::schedule() backed by a single-threaded Looper vs a WorkStealingPool
+//
+
+namespace {
+
+enum Backend
+{
+    BACKEND_LOOPER,
+    BACKEND_POOL
+};
+
+static Backend sBackend;
+static util::Looper *sLooper;
+
+static const int FIBO_N = 34;
+static const int FIBO_CUTOFF = 16;
+static const int NUM_COUNTDOWNS = 1000;
+static const int COUNTDOWN_STEPS = 200;
+static const int NUM_TICKETS = 200000;
+static const int NUM_OFFLOADED = 64;
+static const int OFFLOADED_FIBO_N = 27;
+
+// Signals the main thread once all work has drained from the pool.
+//
+class Latch
+{
+public:
+    Latch()
+        : mIsSet(false) { }
+
+    void set()
+    {
+        util::threading::lock_guard<util::threading::mutex> _(mMutex);
+        mIsSet = true;
+        mCond.notify_all();
+    }
+
+    void wait()
+    {
+        util::threading::unique_lock<util::threading::mutex> lock(mMutex);
+        while (!mIsSet)
+            mCond.wait(lock);
+    }
+
+private:
+    bool mIsSet;
+    util::threading::mutex mMutex;
+    util::threading::condition_variable mCond;
+};
+
+static Latch *sLatch;
+
+static void runUntilDone()
+{
+    if (sBackend == BACKEND_POOL)
+        sLatch->wait();
+    else
+        sLooper->run(); // Looper returns once there is nothing left to do.
+}
+
+static long serialFibo(int n)
+{
+    return n < 2 ? n : serialFibo(n - 1) + serialFibo(n - 2);
+}
+
+// Actions scheduled by forkFibo(n)
+static long numFiboActions(int n)
+{
+    return n <= FIBO_CUTOFF ? 0 : 2 + numFiboActions(n - 1) + numFiboActions(n - 2);
+}
+
+//
+// Fibonacci: recursive fork-join through ut::schedule()
+//
+
+struct FiboJoin
+{
+    FiboJoin *parent;
+    std::atomic<int> numPending;
+    std::atomic<long> sum;
+
+    FiboJoin(FiboJoin *parent, int numPending)
+        : parent(parent)
+        , numPending(numPending)
+        , sum(0) { }
+};
+
+static void deliverFibo(FiboJoin *join, long value)
+{
+    while (true) {
+        join->sum += value;
+
+        if (join->numPending.fetch_sub(1) != 1)
+            return; // Sibling still running.
+
+        if (join->parent == nullptr) {
+            sLatch->set();
+            return;
+        }
+
+        value = join->sum;
+        FiboJoin *parent = join->parent;
+        delete join;
+        join = parent;
+    }
+}
+
+static void forkFibo(int n, FiboJoin *join)
+{
+    if (n <= FIBO_CUTOFF) {
+        deliverFibo(join, serialFibo(n));
+        return;
+    }
+
+    FiboJoin *child = new FiboJoin(join, 2);
+
+    ut::schedule([n, child] { forkFibo(n - 1, child); });
+    ut::schedule([n, child] { forkFibo(n - 2, child); });
+}
+
+static bool benchFibo()
+{
+    FiboJoin root(nullptr, 1);
+
+    forkFibo(FIBO_N, &root);
+    runUntilDone();
+
+    return root.sum == serialFibo(FIBO_N);
+}
+
+//
+// Countdown: many independent chains, each step rescheduling the next one
+//
+
+static std::atomic<int> sNumCountdowns;
+
+static void countdownStep(int *n)
+{
+    if (--*n == 0) {
+        if (sNumCountdowns.fetch_sub(1) == 1)
+            sLatch->set();
+        return;
+    }
+
+    ut::schedule([n] { countdownStep(n); });
+}
+
+static bool benchCountdown()
+{
+    std::vector<int> countdowns(NUM_COUNTDOWNS, COUNTDOWN_STEPS + 1);
+    sNumCountdowns = NUM_COUNTDOWNS;
+
+    for (auto& n : countdowns)
+        countdownStep(&n);
+
+    runUntilDone();
+
+    for (int n : countdowns) {
+        if (n != 0)
+            return false;
+    }
+    return true;
+}
+
+//
+// Tickets: actions bound to tickets held by the main thread
+//
+
+static std::atomic<int> sNumTicketed;
+
+static bool benchTickets()
+{
+    std::vector<ut::SchedulerTicket> tickets;
+    tickets.reserve(NUM_TICKETS);
+    sNumTicketed = NUM_TICKETS;
+
+    // Actions may start running on the pool while tickets are still being
+    // moved into place. Tickets are never touched by the actions.
+    for (int i = 0; i < NUM_TICKETS; i++) {
+        tickets.push_back(ut::scheduleWithTicket([] {
+            if (sNumTicketed.fetch_sub(1) == 1)
+                sLatch->set();
+        }));
+    }
+
+    runUntilDone();
+
+    for (auto& ticket : tickets) {
+        if (ticket)
+            return false;
+    }
+    return true;
+}
+
+//
+// Task graph: CPU-bound subtasks awaited via whenAll() from the Looper thread
+//
+
+static ut::Task<long> asyncFibo(int n)
+{
+    ut::Task<long> task;
+
+    // Promises are not thread safe. Compute on any thread, but complete
+    // the task from the Looper thread which owns it.
+    auto mvPromise = ut::makeMoveOnCopy(util::makeRemotePromise(*sLooper, task.takePromise()));
+
+    ut::schedule([n, mvPromise] {
+        mvPromise->complete(serialFibo(n));
+    });
+
+    return task;
+}
+
+struct FanOutFrame : ut::AsyncFrame<long>
+{
+    FanOutFrame(int n)
+        : n(n)
+        , sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (int i = 0; i < NUM_OFFLOADED; i++)
+            subtasks.push_back(asyncFibo(n));
+
+        alltask = ut::whenAll(subtasks);
+        ut_await_(alltask);
+
+        for (auto& subtask : subtasks)
+            sum += subtask.get();
+
+        // Stop keep-alive.
+        sLooper->cancelAll();
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    int n;
+    long sum;
+    std::vector<ut::Task<long>> subtasks;
+    ut::Task<std::vector<ut::Task<long>>::iterator> alltask;
+};
+
+static void keepAlive()
+{
+    // Looper must not quit while subtasks are running on the pool.
+    sLooper->schedule(&keepAlive, 10);
+}
+
+static bool benchTaskGraph()
+{
+    ut::Task<long> task = ut::startAsyncOf<FanOutFrame>(OFFLOADED_FIBO_N);
+
+    keepAlive();
+    sLooper->run();
+
+    return task.isReady() && task.get() == NUM_OFFLOADED * serialFibo(OFFLOADED_FIBO_N);
+}
+
+// Each operation is one scheduled action, or one offloaded subtask for the
+// task graph. Runs the scenario as many times as needed to cover numOps.
+// Returns true if any backend was selected.
+static bool measure(const char *name, long opsPerRun, bool (*scenario)())
+{
+    static const char *backendNames[] = { "looper", "pool" };
+    bool isAnySelected = false;
+
+    for (Backend backend : { BACKEND_LOOPER, BACKEND_POOL }) {
+        char fullName[64];
+        snprintf(fullName, sizeof(fullName), "sched: %s, %s", name, backendNames[backend]);
+
+        if (!bench::isSelected(fullName))
+            continue;
+
+        isAnySelected = true;
+
+        util::Looper looper;
+        util::WorkStealingPool pool;
+
+        sBackend = backend;
+        sLooper = &looper;
+
+        bench::measure(fullName, opsPerRun, [&](long n) {
+            for (long i = 0; i < n; i += opsPerRun) {
+                Latch latch;
+                sLatch = &latch;
+
+                bool isOk;
+                if (backend == BACKEND_POOL) {
+                    util::ScheduleGuard scheduleGuard(pool);
+                    isOk = scenario();
+                } else {
+                    util::ScheduleGuard scheduleGuard(looper);
+                    isOk = scenario();
+                }
+
+                bench::check(isOk, name);
+                sLatch = nullptr;
+            }
+        });
+
+        sLooper = nullptr;
+    }
+
+    return isAnySelected;
+}
+
+}
+
+void bench_workStealingPool()
+{
+    bool isAnySelected = false;
+
+    isAnySelected |= measure("fibonacci fork-join", numFiboActions(FIBO_N), &benchFibo);
+    isAnySelected |= measure("countdown chains", (long) NUM_COUNTDOWNS * COUNTDOWN_STEPS,
+        &benchCountdown);
+    isAnySelected |= measure("ticketed actions", NUM_TICKETS, &benchTickets);
+    isAnySelected |= measure("offloaded subtask", NUM_OFFLOADED, &benchTaskGraph);
+
+    if (isAnySelected)
+        printf("  work-stealing pool with %d workers\n",
+            util::WorkStealingPool::defaultConcurrency());
+}
@@ -0,0 +1,94 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bench.h"
+#include <cstdio>
+
+void bench_task();
+void bench_stackless();
+void bench_framePool();
+void bench_combinators();
+void bench_awaitableSet();
+void bench_arena();
+void bench_function();
+void bench_workStealingPool();
+void bench_looperTimers();
+void bench_looperPosts();
+#ifdef HAVE_BOOST_CONTEXT
+void bench_stackful();
+void bench_lazyStacks();
+#endif
+#ifdef __linux__
+void bench_epollLoop();
+#endif
+#ifdef HAVE_IO_URING
+void bench_uringFileCopy();
+#endif
+#ifdef HAVE_BOOST
+void bench_asio();
+#endif
+#if defined(HAVE_BOOST) && defined(__linux__)
+void bench_broadcast();
+#endif
+
+int main(int argc, char *argv[])
+{
+    // Optional argument selects benchmarks by name, e.g. "whenAll".
+    bench::setFilter(argc > 1 ? argv[1] : nullptr);
+
+#ifdef UT_NO_EXCEPTIONS
+    printf("CppAsync micro-benchmarks (UT_NO_EXCEPTIONS)\n\n");
+#else
+    printf("CppAsync micro-benchmarks (exceptions enabled)\n\n");
+#endif
+
+#ifndef NDEBUG
+    printf("warning: assertions are enabled, build with -DCMAKE_BUILD_TYPE=Release "
+        "for meaningful numbers\n\n");
+#endif
+
+    // Note: allocs/op counts calls to operator new. Coroutine stacks allocated
+    // directly by Boost.Context are not included.
+
+    bench_task();
+    bench_stackless();
+    bench_framePool();
+    bench_combinators();
+    bench_awaitableSet();
+    bench_arena();
+    bench_function();
+    bench_workStealingPool();
+    bench_looperTimers();
+    bench_looperPosts();
+#ifdef HAVE_BOOST_CONTEXT
+    bench_stackful();
+    bench_lazyStacks();
+#endif
+#ifdef __linux__
+    bench_epollLoop();
+#endif
+#ifdef HAVE_IO_URING
+    bench_uringFileCopy();
+#endif
+#ifdef HAVE_BOOST
+    bench_asio();
+#endif
+#if defined(HAVE_BOOST) && defined(__linux__)
+    bench_broadcast();
+#endif
+
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "impl/Common.h"
+#include "impl/Assert.h"
+#include "util/TypeTraits.h"
+#include "Task.h"
+#include <iterator>
+#include <list>
+
+namespace ut {
+
+//
+// AwaitableSet
+//
+
+/**
+ * Persistent, incremental alternative to whenAny(). Members are added and removed
+ * one at a time, and each member keeps its own awaiter for as long as it belongs
+ * to the set. Once a member completes, it is moved to a ready list.
+ *
+ * Adding, removing and taking a completed member are all O(1), regardless of set
+ * size. By contrast, whenAny() has to attach to and detach from every awaitable
+ * each time it is called.
+ *
+ * Items are stored by value. Any type with a selectAwaitable() overload may be
+ * used, e.g. Task<R>, AwaitableBase* or std::unique_ptr<C> where C is awaitable.
+ *
+ * Not thread safe. The set can't be copied or moved, since members point back
+ * to it.
+ */
+template <class T, class Alloc = std::allocator<T>>
+class AwaitableSet
+{
+    struct Member;
+
+    using list_type = std::list<Member, RebindAlloc<Alloc, Member>>;
+
+public:
+    /** Identifies a member while it belongs to the set */
+    class Handle
+    {
+    public:
+        Handle() _ut_noexcept
+            : mMember(nullptr) { }
+
+        explicit operator bool() const _ut_noexcept
+        {
+            return mMember != nullptr;
+        }
+
+        T& operator*() const _ut_noexcept
+        {
+            ut_dcheck(mMember != nullptr);
+
+            return mMember->item;
+        }
+
+        T* operator->() const _ut_noexcept
+        {
+            ut_dcheck(mMember != nullptr);
+
+            return &mMember->item;
+        }
+
+        bool operator==(const Handle& other) const _ut_noexcept
+        {
+            return mMember == other.mMember;
+        }
+
+        bool operator!=(const Handle& other) const _ut_noexcept
+        {
+            return mMember != other.mMember;
+        }
+
+    private:
+        explicit Handle(Member *member) _ut_noexcept
+            : mMember(member) { }
+
+        Member *mMember;
+
+        friend class AwaitableSet;
+    };
+
+    explicit AwaitableSet(const Alloc& alloc = Alloc())
+        : mPending(alloc)
+        , mReady(alloc) { }
+
+    ~AwaitableSet() _ut_noexcept
+    {
+        for (Member& member : mPending)
+            detach(member);
+    }
+
+    /** Number of members, both pending and ready */
+    std::size_t size() const _ut_noexcept
+    {
+        return mPending.size() + mReady.size();
+    }
+
+    bool isEmpty() const _ut_noexcept
+    {
+        return mPending.empty() && mReady.empty();
+    }
+
+    /** Check if some member has completed and can be taken right away */
+    bool hasReady() const _ut_noexcept
+    {
+        return !mReady.empty();
+    }
+
+    /**
+     * Insert item. Awaitable must be valid and not awaited by others.
+     *
+     * If the item is ready already and there is a pending asyncTake(), it is
+     * taken right away and the returned handle is null.
+     */
+    template <class U>
+    Handle add(U&& item)
+    {
+        mPending.emplace_back(this, std::forward<U>(item));
+
+        auto pos = std::prev(mPending.end());
+        Member& member = *pos;
+        member.self = pos;
+
+        AwaitableBase& awt = selectAwaitable(member.item);
+
+        ut_dcheck(awt.isValid() &&
+            "Can't add invalid objects");
+
+        if (awt.isReady()) {
+            moveToReady(member);
+
+            if (mPromise.isCompletable()) {
+                notify();
+                return Handle();
+            }
+        } else {
+            ut_dcheck(awt.awaiter() == nullptr &&
+                "Awaitable is already being awaited");
+
+            awt.setAwaiter(&member);
+        }
+
+        return Handle(&member);
+    }
+
+    /** Remove member and return its item */
+    T remove(Handle handle) _ut_noexcept
+    {
+        ut_dcheck(handle && handle.mMember->set == this);
+
+        Member& member = *handle.mMember;
+
+        if (!member.isReady)
+            detach(member);
+
+        T item(std::move(member.item));
+        listOf(member).erase(member.self);
+
+        return item;
+    }
+
+    /**
+     * Take the earliest completed member, removing it from the set. Must have
+     * some member ready.
+     */
+    T takeReady() _ut_noexcept
+    {
+        ut_dcheck(hasReady());
+
+        return remove(Handle(&mReady.front()));
+    }
+
+    /**
+     * Wait for the next member to complete, then take it out of the set. Keeps
+     * waiting while the set is empty. The returned task may be canceled without
+     * losing any member. Starting another asyncTake() cancels the previous one.
+     */
+    Task<T> asyncTake()
+    {
+        if (hasReady())
+            return makeCompletedTask<T>(takeReady());
+
+        Task<T> task;
+        mPromise = task.takePromise();
+
+        return task;
+    }
+
+private:
+    AwaitableSet(const AwaitableSet& other) = delete;
+    AwaitableSet& operator=(const AwaitableSet& other) = delete;
+
+    struct Member : Awaiter
+    {
+        AwaitableSet *set;
+        T item;
+        typename list_type::iterator self;
+        bool isReady;
+
+        template <class U>
+        Member(AwaitableSet *set, U&& item)
+            : set(set)
+            , item(std::forward<U>(item))
+            , isReady(false) { }
+
+        void resume(AwaitableBase *resumer) _ut_noexcept final
+        {
+            ut_assert(resumer == &selectAwaitable(item));
+            ut_assert(resumer->isReady() && resumer->awaiter() == nullptr);
+            (void) resumer;
+
+            set->moveToReady(*this);
+            set->notify();
+        }
+    };
+
+    list_type& listOf(Member& member) _ut_noexcept
+    {
+        return member.isReady ? mReady : mPending;
+    }
+
+    void detach(Member& member) _ut_noexcept
+    {
+        AwaitableBase& awt = selectAwaitable(member.item);
+
+        ut_dcheck(awt.isValid() && !awt.isReady() && awt.awaiter() == &member &&
+            "Awaitables may not be altered while in AwaitableSet. Make sure to "
+            "remove them in advance.");
+
+        awt.setAwaiter(nullptr);
+    }
+
+    void moveToReady(Member& member) _ut_noexcept
+    {
+        ut_assert(!member.isReady);
+
+        // Splice keeps the iterator valid.
+        mReady.splice(mReady.end(), mPending, member.self);
+        member.isReady = true;
+    }
+
+    void notify() _ut_noexcept
+    {
+        if (mPromise.isCompletable())
+            mPromise.complete(takeReady());
+    }
+
+    list_type mPending;
+    list_type mReady;
+    Promise<T> mPromise;
+};
+
+}
@@ -21,11 +21,162 @@
 #include "../util/ContextRef.h"
 #include "../util/MoveOnCopy.h"
 #include <boost/asio/async_result.hpp>
-#include <boost/asio/handler_type.hpp>
 #include <boost/system/system_error.hpp>
+#include <boost/version.hpp>
+#include <new>
+
+// Boost 1.66 introduced async_result<CompletionToken, Signature>, and 1.70
+// removed the handler_type customization point it replaces.
+#if BOOST_VERSION < 106600
+#define UT_ASIO_LEGACY_HANDLER_TYPE 1
+#include <boost/asio/handler_type.hpp>
+#else
+#define UT_ASIO_LEGACY_HANDLER_TYPE 0
+#endif
 
 namespace ut { namespace asio {
 
+//
+// HandlerMemory
+//
+
+/**
+ * Recycling buffer for the handler storage of one asynchronous operation
+ * at a time. Asio releases operation storage before invoking the handler,
+ * so a loop that keeps starting the same kind of operation gets the same
+ * block back every time instead of going to the heap.
+ *
+ * Requests that don't fit, or arrive while the block is in use, fall back
+ * to operator new. Must outlive the operations using it.
+ *
+ * Size it for the operation: a composed operation such as a gather write
+ * carries its buffer sequence in the handler storage.
+ */
+class HandlerMemoryBase
+{
+public:
+    void* allocate(std::size_t size)
+    {
+        if (!mIsInUse && size <= mCapacity) {
+            mIsInUse = true;
+            return mStorage;
+        } else {
+            return ::operator new(size);
+        }
+    }
+
+    void deallocate(void *p) _ut_noexcept
+    {
+        if (p == mStorage) {
+            ut_dcheck(mIsInUse);
+            mIsInUse = false;
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    bool isInUse() const _ut_noexcept
+    {
+        return mIsInUse;
+    }
+
+    std::size_t capacity() const _ut_noexcept
+    {
+        return mCapacity;
+    }
+
+protected:
+    HandlerMemoryBase(void *storage, std::size_t capacity) _ut_noexcept
+        : mStorage(storage)
+        , mCapacity(capacity)
+        , mIsInUse(false) { }
+
+    ~HandlerMemoryBase() = default;
+
+private:
+    HandlerMemoryBase(const HandlerMemoryBase& other) = delete;
+    HandlerMemoryBase& operator=(const HandlerMemoryBase& other) = delete;
+
+    void *mStorage;
+    std::size_t mCapacity;
+    bool mIsInUse;
+};
+
+/** HandlerMemory with inline storage of the given capacity */
+template <std::size_t Capacity = 256>
+class HandlerMemory : public HandlerMemoryBase
+{
+public:
+    static const std::size_t CAPACITY = Capacity;
+
+    HandlerMemory() _ut_noexcept
+        : HandlerMemoryBase(&mStorage, Capacity) { }
+
+private:
+    MaxAlignedStorage<Capacity> mStorage;
+};
+
+//
+// HandlerAllocator
+//
+
+/** Allocator over HandlerMemoryBase. Uses the global heap if memory is null. */
+template <class T>
+class HandlerAllocator
+{
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemoryBase *memory) _ut_noexcept
+        : mMemory(memory) { }
+
+    template <class U>
+    HandlerAllocator(const HandlerAllocator<U>& other) _ut_noexcept
+        : mMemory(other.memory()) { }
+
+    T* allocate(std::size_t n)
+    {
+        std::size_t size = n * sizeof(T);
+        void *p = (mMemory == nullptr)
+            ? ::operator new(size)
+            : mMemory->allocate(size);
+
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T *p, std::size_t /* n */) _ut_noexcept
+    {
+        if (mMemory == nullptr)
+            ::operator delete(p);
+        else
+            mMemory->deallocate(p);
+    }
+
+    HandlerMemoryBase* memory() const _ut_noexcept
+    {
+        return mMemory;
+    }
+
+    template <class U>
+    bool operator==(const HandlerAllocator<U>& other) const _ut_noexcept
+    {
+        return mMemory == other.memory();
+    }
+
+    template <class U>
+    bool operator!=(const HandlerAllocator<U>& other) const _ut_noexcept
+    {
+        return mMemory != other.memory();
+    }
+
+private:
+    HandlerMemoryBase *mMemory;
+};
+
+//
+// AsTask
+//
+
 template <class Context>
 struct AsTask;
 
@@ -33,23 +184,38 @@ template <>
 struct AsTask<std::shared_ptr<void>>
 {
     std::shared_ptr<void> ctx;
+    HandlerMemoryBase *memory;
 
-    AsTask(std::shared_ptr<void> ctx) _ut_noexcept
-        : ctx(std::move(ctx)) { }
+    AsTask(std::shared_ptr<void> ctx, HandlerMemoryBase *memory = nullptr) _ut_noexcept
+        : ctx(std::move(ctx))
+        , memory(memory) { }
 
     AsTask(AsTask&& other) _ut_noexcept
-        : ctx(std::move(other.ctx)) { }
+        : ctx(std::move(other.ctx))
+        , memory(other.memory) { }
 
     AsTask& operator=(AsTask&& other) _ut_noexcept
     {
         ut_assert(this != &other);
 
         ctx = std::move(other.ctx);
+        memory = other.memory;
 
         return *this;
     }
 };
 
+/**
+ * Allocate handler storage from a recycling buffer, e.g.
+ * withMemory(asTask[ctx], ctx->readMemory). Takes over the context of the
+ * tag, so it only accepts temporaries.
+ */
+inline AsTask<std::shared_ptr<void>> withMemory(AsTask<std::shared_ptr<void>>&& tag,
+    HandlerMemoryBase& memory) _ut_noexcept
+{
+    return AsTask<std::shared_ptr<void>>(std::move(tag.ctx), &memory);
+}
+
 template <>
 struct AsTask<Nothing>
 {
@@ -65,6 +231,12 @@ struct AsTask<Nothing>
     {
         return (*this)[ctx.ptr()];
     }
+
+    AsTask<std::shared_ptr<void>> operator[](
+        HandlerMemoryBase& memory) const _ut_noexcept
+    {
+        return AsTask<std::shared_ptr<void>>(nullptr, &memory);
+    }
 };
 
 #if defined(_MSC_VER) && _MSC_VER < 1900
@@ -145,11 +317,58 @@ namespace detail
     class AsTaskHandler<R, std::shared_ptr<void>> : public AsTaskHandlerBase<R>
     {
     public:
+        using allocator_type = HandlerAllocator<void>;
+
         explicit AsTaskHandler(AsTask<std::shared_ptr<void>> tag) _ut_noexcept
-            : mCtx(std::move(tag.ctx)) { }
+            : mCtx(std::move(tag.ctx))
+            , mMemory(tag.memory) { }
+
+        // Picked up by associated_allocator (Boost 1.66+).
+        allocator_type get_allocator() const _ut_noexcept
+        {
+            return allocator_type(mMemory);
+        }
+
+        // Custom allocation hooks for older Asio versions.
+        friend void* asio_handler_allocate(std::size_t size, AsTaskHandler *handler)
+        {
+            return HandlerAllocator<char>(handler->mMemory).allocate(size);
+        }
+
+        friend void asio_handler_deallocate(void *p, std::size_t size,
+            AsTaskHandler *handler) _ut_noexcept
+        {
+            HandlerAllocator<char>(handler->mMemory).deallocate(static_cast<char*>(p), size);
+        }
 
     private:
         std::shared_ptr<void> mCtx;
+        HandlerMemoryBase *mMemory;
+    };
+
+    // Links the handler's promise to the task returned by the initiating function.
+    template <class R, class Context>
+    class AsTaskResult
+    {
+    public:
+        using completion_handler_type = AsTaskHandler<R, Context>;
+        using return_type = Task<R>;
+
+        explicit AsTaskResult(completion_handler_type& handler) _ut_noexcept
+        {
+            handler.initialize(mTask.takePromise());
+        }
+
+        return_type get() _ut_noexcept
+        {
+            return std::move(mTask);
+        }
+
+    private:
+        AsTaskResult(const AsTaskResult& other) = delete;
+        AsTaskResult& operator=(const AsTaskResult& other) = delete;
+
+        Task<R> mTask;
     };
 }
 
@@ -157,27 +376,17 @@ namespace detail
 
 namespace boost { namespace asio {
 
+#if UT_ASIO_LEGACY_HANDLER_TYPE
+
 template <class R, class Context>
 class async_result<ut::asio::detail::AsTaskHandler<R, Context>>
+    : public ut::asio::detail::AsTaskResult<R, Context>
 {
 public:
     using type = ut::Task<R>;
 
     explicit async_result(ut::asio::detail::AsTaskHandler<R, Context>& handler) _ut_noexcept
-    {
-        handler.initialize(mTask.takePromise());
-    }
-
-    ut::Task<R> get() _ut_noexcept
-    {
-        return std::move(mTask);
-    }
-
-private:
-    async_result(const async_result& other) = delete;
-    async_result& operator=(const async_result& other) = delete;
-
-    ut::Task<R> mTask;
+        : ut::asio::detail::AsTaskResult<R, Context>(handler) { }
 };
 
 template <class Context>
@@ -192,4 +401,26 @@ struct handler_type<ut::asio::AsTask<Context>, void(boost::system::error_code, R
     using type = ut::asio::detail::AsTaskHandler<R, Context>;
 };
 
+#else
+
+template <class Context>
+class async_result<ut::asio::AsTask<Context>, void(boost::system::error_code)>
+    : public ut::asio::detail::AsTaskResult<void, Context>
+{
+public:
+    explicit async_result(ut::asio::detail::AsTaskHandler<void, Context>& handler) _ut_noexcept
+        : ut::asio::detail::AsTaskResult<void, Context>(handler) { }
+};
+
+template <class R, class Context>
+class async_result<ut::asio::AsTask<Context>, void(boost::system::error_code, R)>
+    : public ut::asio::detail::AsTaskResult<R, Context>
+{
+public:
+    explicit async_result(ut::asio::detail::AsTaskHandler<R, Context>& handler) _ut_noexcept
+        : ut::asio::detail::AsTaskResult<R, Context>(handler) { }
+};
+
+#endif // UT_ASIO_LEGACY_HANDLER_TYPE
+
 } } // boost::asio
@@ -0,0 +1,220 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../impl/Common.h"
+#include "AsioTraits.h"
+#include "../StacklessAsync.h"
+#include "../util/ContextRef.h"
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/write.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ut { namespace asio {
+
+namespace detail
+{
+    // Non-owning buffer sequence. Composed writes copy their buffer sequence,
+    // which for a std::vector would mean an allocation per write.
+    class BufferListView
+    {
+    public:
+        using value_type = boost::asio::const_buffer;
+        using const_iterator = const boost::asio::const_buffer*;
+
+        explicit BufferListView(const std::vector<boost::asio::const_buffer>& buffers) _ut_noexcept
+            : mBegin(buffers.data())
+            , mEnd(buffers.data() + buffers.size()) { }
+
+        const_iterator begin() const _ut_noexcept
+        {
+            return mBegin;
+        }
+
+        const_iterator end() const _ut_noexcept
+        {
+            return mEnd;
+        }
+
+    private:
+        const_iterator mBegin;
+        const_iterator mEnd;
+    };
+
+    template <class AsyncWriteStream, class Payload>
+    struct WriteQueueState
+    {
+        using payload_ptr = std::shared_ptr<const Payload>;
+
+        // Gather writes keep their buffer sequence state in the handler
+        // storage, 480 bytes with Boost 1.74 and GCC on x86-64.
+        static const std::size_t HANDLER_CAPACITY = 1024;
+
+        WriteQueueState(AsyncWriteStream& stream)
+            : stream(stream)
+            , numQueuedBytes(0) { }
+
+        // Owned by the parent context, which this state keeps alive.
+        AsyncWriteStream& stream;
+
+        // Swapped on every flush, capacity is retained.
+        std::vector<payload_ptr> queued;
+        std::vector<payload_ptr> inFlight;
+        std::vector<boost::asio::const_buffer> buffers;
+
+        std::size_t numQueuedBytes;
+        Promise<void> evtQueued;
+        HandlerMemory<HANDLER_CAPACITY> memory;
+    };
+
+    template <class AsyncWriteStream, class Payload>
+    struct WriteQueueFrame : AsyncFrame<void>
+    {
+        using state_type = WriteQueueState<AsyncWriteStream, Payload>;
+
+        WriteQueueFrame(const ContextRef<state_type>& state)
+            : state(state) { }
+
+        void operator()()
+        {
+            ut_begin();
+
+            do {
+                if (state->queued.empty()) {
+                    evtTask = Task<void>();
+                    state->evtQueued = evtTask.takePromise();
+
+                    // Suspend while the queue is empty.
+                    ut_await_(evtTask);
+
+                    // Woken up by the first push of a burst. Let the pushing
+                    // handler finish so the whole burst goes out in one write:
+                    // an empty write completes on the next loop turn without
+                    // touching the stream.
+                    writeTask = state->stream.async_write_some(boost::asio::buffer("", 0),
+                        withMemory(asTask[state], state->memory));
+                    ut_await_no_throw_(writeTask);
+                } else {
+                    state->inFlight.swap(state->queued);
+                    state->numQueuedBytes = 0;
+
+                    state->buffers.clear();
+                    for (auto& payload : state->inFlight)
+                        state->buffers.push_back(boost::asio::buffer(*payload));
+
+                    // Suspend until everything queued so far has been sent.
+                    // Buffer list stays untouched until the write completes.
+                    writeTask = boost::asio::async_write(state->stream,
+                        BufferListView(state->buffers),
+                        withMemory(asTask[state], state->memory));
+                    ut_await_no_throw_(writeTask);
+
+                    // Release the payloads, whether or not the write failed.
+                    state->inFlight.clear();
+                    state->buffers.clear();
+
+                    if (writeTask.hasError())
+                        ut_return_error(std::move(writeTask.error()));
+                }
+            } while (true);
+
+            ut_end();
+        }
+
+    private:
+        ContextRef<state_type> state;
+        Task<void> evtTask;
+        Task<std::size_t> writeTask;
+    };
+}
+
+//
+// WriteQueue
+//
+
+/**
+ * Outbound queue of shared payloads for a stream. Payloads are referenced,
+ * not copied, so one message may be pushed to any number of queues.
+ *
+ * asyncRun() returns a Task that keeps writing until canceled or until a
+ * write fails. An idle queue flushes on the next event loop turn, so a burst
+ * of payloads pushed from one handler goes out in a single gather write.
+ * Payloads pushed while a write is in flight are likewise coalesced once it
+ * completes.
+ *
+ * Payloads and buffer lists live in a context spawned from the owner of the
+ * stream. In-flight writes keep both alive, so the queue and the owner's
+ * other references may be dropped before the write loop finishes.
+ */
+template <class AsyncWriteStream, class Payload = std::string>
+class WriteQueue
+{
+public:
+    using payload_ptr = std::shared_ptr<const Payload>;
+
+    /** The stream must belong to owner, typically a member of its context. */
+    WriteQueue(std::shared_ptr<void> owner, AsyncWriteStream& stream)
+        : mState(std::move(owner), std::allocator<char>(), stream) { }
+
+    /** Start the write loop. At most one may run at a time. */
+    Task<void> asyncRun()
+    {
+        return startAsyncOf<frame_type>(mState);
+    }
+
+    /** Queue a payload. An idle write loop flushes on the next loop turn. */
+    void push(payload_ptr payload)
+    {
+        ut_dcheck(payload != nullptr);
+
+        mState->numQueuedBytes += boost::asio::buffer_size(boost::asio::buffer(*payload));
+        mState->queued.push_back(std::move(payload));
+
+        mState->evtQueued();
+    }
+
+    /** Number of payloads waiting for the next write */
+    std::size_t numQueued() const _ut_noexcept
+    {
+        return mState->queued.size();
+    }
+
+    /** Number of bytes waiting for the next write */
+    std::size_t numQueuedBytes() const _ut_noexcept
+    {
+        return mState->numQueuedBytes;
+    }
+
+    /** Whether a write is in progress */
+    bool isWriting() const _ut_noexcept
+    {
+        return !mState->inFlight.empty();
+    }
+
+private:
+    WriteQueue(const WriteQueue& other) = delete;
+    WriteQueue& operator=(const WriteQueue& other) = delete;
+
+    using state_type = detail::WriteQueueState<AsyncWriteStream, Payload>;
+    using frame_type = detail::WriteQueueFrame<AsyncWriteStream, Payload>;
+
+    ContextRef<state_type> mState;
+};
+
+} } // ut::asio
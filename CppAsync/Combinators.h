@@ -20,6 +20,7 @@
 #include "impl/AwaitableOps.h"
 #include "util/AllocElementPtr.h"
 #include "Task.h"
+#include <array>
 
 namespace ut {
 
@@ -150,12 +151,14 @@ namespace detail
     struct SomeAwaiter : Awaiter
     {
         Container awts;
-        std::size_t count;
+        std::size_t count;      // successful completions still needed
+        std::size_t numPending; // awaitables still attached
         Promise<R> promise;
 
-        SomeAwaiter(std::size_t count, Container&& awts)
+        SomeAwaiter(std::size_t count, std::size_t numPending, Container&& awts)
             : awts(std::move(awts))
             , count(count)
+            , numPending(numPending)
         {
             detail::ops::rSetAwaiter(this, makeRange(this->awts));
         }
@@ -163,8 +166,10 @@ namespace detail
         ~SomeAwaiter() _ut_noexcept
         {
             if (promise.state() == PromiseBase::ST_OpCanceled) {
-                for (auto& item : makeRange(awts)) {
-                    auto& awt = selectAwaitable(item);
+                auto range = makeRange(awts);
+
+                for (auto it = range.first; numPending > 0 && it != range.last; ++it) {
+                    auto& awt = selectAwaitable(*it);
 
                     ut_dcheck(awt.isValid() &&
                         "Awaitables may not be altered while being awaited. Make sure they are "
@@ -176,6 +181,7 @@ namespace detail
                             "destruct or cancel the whenSome/whenAll() Task in advance.");
 
                         awt.setAwaiter(nullptr);
+                        numPending--;
                     }
                 }
             }
@@ -183,50 +189,61 @@ namespace detail
 
         void resume(AwaitableBase *resumer) _ut_noexcept final
         {
-            using namespace detail::ops;
-
-            ut_assert(count > 0);
+            // Constant work per completion. The range is traversed only once, when
+            // the combinator finishes with some awaitables still pending, or when
+            // looking up the position of a failed awaitable.
 
-            auto range = makeRange(awts);
-
-            ut_assert(rIsAnyOf(resumer, range));
+            ut_assert(count > 0 && numPending > 0);
             ut_assert(resumer->isReady() && resumer->awaiter() == nullptr);
-            ut_assert(resumer->hasError() || !rAny<hasError>(range));
+
+            numPending--;
 
             if (resumer->hasError()) {
-                for (auto it = range.first; it != range.last; ++it) {
-                    AwaitableBase *awt = &selectAwaitable(*it);
-
-                    if (awt == resumer) {
-                        auto pos(it); // Iterator might not be copy assignable, hence inner loop.
-                        while (++it != range.last) {
-                            awt = &selectAwaitable(*it);
-                            if (!awt->isReady()) {
-                                ut_assert(awt->awaiter() == this);
-                                awt->setAwaiter(nullptr);
-                            }
-                        }
-                        completeCombinator(std::move(promise), pos, range.last);
-                        return;
-                    }
+                completeWithError(resumer);
+            } else if (--count == 0) {
+                auto range = makeRange(awts);
 
-                    if (!awt->isReady()) {
-                        ut_assert(awt->awaiter() == this);
-                        awt->setAwaiter(nullptr);
-                    }
-                }
+                detachPending(range.first, range.last);
+                completeCombinator(std::move(promise), range.last, range.last);
+            }
+        }
 
-                ut_assert(false); // Resumer should have been one of the awaited.
-            } else if (--count == 0) {
-                for (auto it = range.first; it != range.last; ++it) {
-                    AwaitableBase& awt = selectAwaitable(*it);
+    private:
+        void completeWithError(AwaitableBase *resumer) _ut_noexcept
+        {
+            auto range = makeRange(awts);
 
-                    if (!awt.isReady()) {
-                        ut_assert(awt.awaiter() == this);
-                        awt.setAwaiter(nullptr);
-                    }
+            for (auto it = range.first; it != range.last; ++it) {
+                AwaitableBase& awt = selectAwaitable(*it);
+
+                if (&awt == resumer) {
+                    auto pos(it); // Iterator might not be copy assignable.
+                    detachPending(++it, range.last);
+                    completeCombinator(std::move(promise), pos, range.last);
+                    return;
                 }
-                completeCombinator(std::move(promise), range.last, range.last);
+
+                detach(awt);
+            }
+
+            ut_assert(false); // Resumer should have been one of the awaited.
+        }
+
+        template <class It>
+        void detachPending(It it, It last) _ut_noexcept
+        {
+            for (; numPending > 0 && it != last; ++it)
+                detach(selectAwaitable(*it));
+
+            ut_assert(numPending == 0);
+        }
+
+        void detach(AwaitableBase& awt) _ut_noexcept
+        {
+            if (!awt.isReady()) {
+                ut_assert(awt.awaiter() == this);
+                awt.setAwaiter(nullptr);
+                numPending--;
             }
         }
     };
@@ -246,6 +263,7 @@ namespace detail
             "Can't combine invalid objects");
 
         auto range = makeRange(awts);
+        std::size_t numPending = 0;
 
         for (auto it = range.first; it != range.last; ++it) {
             AwaitableBase& awt = selectAwaitable(*it);
@@ -259,6 +277,8 @@ namespace detail
 
                 if (count > 0)
                     count--;
+            } else {
+                numPending++;
             }
         }
 
@@ -271,7 +291,7 @@ namespace detail
         using awaiter_handle_type = AllocElementPtr<detail::SomeAwaiter<R, Container>, Alloc>;
         using listener_type = detail::BoundResourceListener<R, awaiter_handle_type>;
 
-        awaiter_handle_type handle(alloc, count, std::move(awts));
+        awaiter_handle_type handle(alloc, count, numPending, std::move(awts));
 
 #ifdef UT_NO_EXCEPTIONS
         if (handle == nullptr) {
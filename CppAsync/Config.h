@@ -32,6 +32,6 @@
 #define UT_CUSTOM_ERROR_TYPE int32_t
 
 /**
- * Maximum supported depth for stackful coroutines
+ * Uncomment to measure stack usage of stackful coroutines. See ut::stackful::StackProfiler.
  */
-#define UT_MAX_COROUTINE_DEPTH 16
+// #define UT_STACK_PROFILING
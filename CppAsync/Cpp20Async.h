@@ -0,0 +1,536 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "impl/Common.h"
+
+// Standard C++20 coroutines. The experimental headers target the older N4402 draft.
+#if _ut_has_cpp20_coroutines
+
+#include "impl/Assert.h"
+#include "util/Optional.h"
+#include "util/TypeTraits.h"
+#include "Task.h"
+#include <coroutine>
+#include <memory>
+#include <new>
+
+// GCC at -O0 warns (-Wmismatched-new-delete) when a frame from the allocator_arg
+// operator new is released by the usual operator delete, since they don't look
+// like a pair. They are: delete calls the deallocator stored with the frame. The
+// warning points at the coroutine rather than this header, so a pragma can't
+// silence it. Inlining the template makes the frame come from
+// FrameAllocator::allocate(), which GCC doesn't treat as an allocation function.
+#if defined(__GNUC__) && !defined(__clang__)
+#define _ut_frame_operator_new __attribute__((always_inline))
+#else
+#define _ut_frame_operator_new
+#endif
+
+// Without exceptions, allocators report failure by returning null. The frame
+// operator new has to be noexcept then, so the coroutine checks its result.
+#ifdef UT_NO_EXCEPTIONS
+#define _ut_frame_operator_new_noexcept _ut_noexcept
+#else
+#define _ut_frame_operator_new_noexcept
+#endif
+
+namespace ut {
+
+namespace detail
+{
+    namespace cpp20
+    {
+        //
+        // Frame allocation
+        //
+        // Frames are allocated through the allocator that follows std::allocator_arg in
+        // the coroutine's parameter list, or std::allocator otherwise. A copy of the
+        // allocator is kept after the frame, behind a pointer to the matching deallocate.
+        //
+
+        using FrameDeallocator = void (*)(void *frame, std::size_t size);
+
+        inline std::size_t frameDeallocatorOffset(std::size_t size) _ut_noexcept
+        {
+            return (size + alignof(FrameDeallocator) - 1) & ~(alignof(FrameDeallocator) - 1);
+        }
+
+        template <class Alloc>
+        struct FrameAllocator
+        {
+            using unit_type = MaxAlignedStorage<max_align_size>;
+            using alloc_type = RebindAlloc<Alloc, unit_type>;
+            using alloc_traits = std::allocator_traits<alloc_type>;
+
+            static std::size_t allocOffset(std::size_t size) _ut_noexcept
+            {
+                std::size_t offset = frameDeallocatorOffset(size) + sizeof(FrameDeallocator);
+
+                return (offset + alignof(alloc_type) - 1) & ~(alignof(alloc_type) - 1);
+            }
+
+            static std::size_t numUnits(std::size_t size) _ut_noexcept
+            {
+                return (allocOffset(size) + sizeof(alloc_type) + sizeof(unit_type) - 1)
+                    / sizeof(unit_type);
+            }
+
+            static void* allocate(std::size_t size, const Alloc& alloc)
+            {
+                alloc_type frameAlloc(alloc);
+                char *frame = reinterpret_cast<char*>(
+                    alloc_traits::allocate(frameAlloc, numUnits(size)));
+
+#ifdef UT_NO_EXCEPTIONS
+                if (frame == nullptr)
+                    return nullptr;
+#endif
+
+                new (frame + frameDeallocatorOffset(size)) FrameDeallocator(&deallocate);
+                new (frame + allocOffset(size)) alloc_type(std::move(frameAlloc));
+
+                return frame;
+            }
+
+            static void deallocate(void *frame, std::size_t size) _ut_noexcept
+            {
+                auto& storedAlloc = *reinterpret_cast<alloc_type*>(
+                    static_cast<char*>(frame) + allocOffset(size));
+
+                alloc_type frameAlloc(std::move(storedAlloc));
+                storedAlloc.~alloc_type();
+
+                alloc_traits::deallocate(frameAlloc,
+                    static_cast<unit_type*>(frame), numUnits(size));
+            }
+        };
+
+        //
+        // Continuation hand-off
+        //
+        // A coroutine finishing at its final suspend point completes its Task. If that
+        // resumes another coroutine blocked on the same Task, the resumption is handed back
+        // to the final awaiter and done by symmetric transfer, so long chains of co_await
+        // don't grow the stack.
+        //
+
+        struct Handoff
+        {
+            const void *owner;
+            AwaitableBase *expectedResumer;
+            std::coroutine_handle<> next;
+        };
+
+        inline Handoff*& currentHandoff() _ut_noexcept
+        {
+            static _ut_thread_local Handoff *sHandoff = nullptr;
+            return sHandoff;
+        }
+
+        inline void resumeOrHandOff(std::coroutine_handle<> coro, AwaitableBase *resumer)
+        {
+            Handoff *handoff = currentHandoff();
+
+            if (handoff != nullptr && handoff->expectedResumer == resumer && !handoff->next)
+                handoff->next = coro;
+            else
+                coro.resume();
+        }
+
+        //
+        // TaskPromise
+        //
+
+        template <class R>
+        class TaskPromiseMixin;
+
+        template <class R>
+        class TaskPromise : public TaskPromiseMixin<R>
+        {
+        public:
+            using result_type = R;
+            using handle_type = std::coroutine_handle<TaskPromise>;
+
+            TaskPromise() _ut_noexcept { }
+
+            Task<R> get_return_object() _ut_noexcept
+            {
+                auto task = ut::makeTaskWithListener<Listener>(this);
+                mPromise = task.takePromise();
+
+                return task;
+            }
+
+            // Run eagerly, like startAsync().
+            std::suspend_never initial_suspend() const _ut_noexcept
+            {
+                return std::suspend_never();
+            }
+
+            auto final_suspend() const _ut_noexcept
+            {
+                struct FinalAwaiter
+                {
+                    bool await_ready() const _ut_noexcept
+                    {
+                        return false;
+                    }
+
+                    std::coroutine_handle<> await_suspend(handle_type coro) _ut_noexcept
+                    {
+                        Handoff handoff = { &coro.promise(), nullptr, nullptr };
+
+                        Handoff *outer = currentHandoff();
+                        currentHandoff() = &handoff;
+
+                        coro.promise().completeTask();
+
+                        currentHandoff() = outer;
+
+                        // Task is done and no longer refers to the frame.
+                        coro.destroy();
+
+                        if (handoff.next)
+                            return handoff.next;
+                        else
+                            return std::noop_coroutine();
+                    }
+
+                    void await_resume() const _ut_noexcept { }
+                };
+
+                return FinalAwaiter();
+            }
+
+            void unhandled_exception() _ut_noexcept
+            {
+#ifdef UT_NO_EXCEPTIONS
+                ut_assert(false);
+#else
+                mError = currentException();
+#endif
+            }
+
+            static void* operator new(std::size_t size) _ut_frame_operator_new_noexcept
+            {
+                return FrameAllocator<std::allocator<char>>::allocate(size, std::allocator<char>());
+            }
+
+            template <class Alloc, class ...Args>
+            _ut_frame_operator_new static void* operator new(std::size_t size,
+                std::allocator_arg_t, const Alloc& alloc, const Args&...)
+                _ut_frame_operator_new_noexcept
+            {
+                return FrameAllocator<Alloc>::allocate(size, alloc);
+            }
+
+            // Member coroutines pass the object first.
+            template <class T, class Alloc, class ...Args>
+            _ut_frame_operator_new static void* operator new(std::size_t size,
+                const T&, std::allocator_arg_t, const Alloc& alloc, const Args&...)
+                _ut_frame_operator_new_noexcept
+            {
+                return FrameAllocator<Alloc>::allocate(size, alloc);
+            }
+
+            static void operator delete(void *frame, std::size_t size) _ut_noexcept
+            {
+                auto deallocate = *reinterpret_cast<FrameDeallocator*>(
+                    static_cast<char*>(frame) + frameDeallocatorOffset(size));
+
+                deallocate(frame, size);
+            }
+
+#ifdef UT_NO_EXCEPTIONS
+            // Frame allocation failed, return an invalid Task.
+            static Task<R> get_return_object_on_allocation_failure() _ut_noexcept
+            {
+                Task<R> task;
+                task.takePromise();
+
+                return task;
+            }
+
+            // Destroy the frame, then store error in Task.
+            void interruptCoroutine(Error error) _ut_noexcept
+            {
+                Promise<R> promise(std::move(mPromise));
+                handle_type::from_promise(*this).destroy();
+
+                if (promise.isCompletable())
+                    promise.fail(std::move(error));
+            }
+#endif
+
+        private:
+            TaskPromise(const TaskPromise& other) = delete;
+            TaskPromise& operator=(const TaskPromise& other) = delete;
+
+            void completeTask() _ut_noexcept
+            {
+                if (!mPromise.isCompletable())
+                    return;
+
+#ifndef UT_NO_EXCEPTIONS
+                if (mError != nullptr) {
+                    mPromise.fail(std::move(mError));
+                    return;
+                }
+#endif
+                this->deliverResult(mPromise);
+            }
+
+            class Listener : public UniqueMixin<ITaskListener<R>, Listener>
+            {
+            public:
+                explicit Listener(TaskPromise<R> *taskPromise) _ut_noexcept
+                    : mTaskPromise(taskPromise) { }
+
+                Listener(Listener&& other) _ut_noexcept
+                    : mTaskPromise(movePtr(other.mTaskPromise)) { }
+
+                ~Listener() _ut_noexcept final
+                {
+                    if (mTaskPromise != nullptr) {
+                        // Interrupt coroutine.
+
+                        ut_dcheck(!mTaskPromise->mPromise.isCompletable() &&
+                            "Coroutine may not delete its own task while it is executing");
+
+                        handle_type::from_promise(*mTaskPromise).destroy();
+                    }
+                }
+
+                void onDetach() _ut_noexcept final
+                {
+                    mTaskPromise = nullptr;
+                }
+
+                void onDone(Task<R>& task) _ut_noexcept final
+                {
+                    Handoff *handoff = currentHandoff();
+                    if (handoff != nullptr && handoff->owner == mTaskPromise)
+                        handoff->expectedResumer = &task;
+
+                    mTaskPromise = nullptr;
+                }
+
+            private:
+                TaskPromise<R> *mTaskPromise;
+            };
+
+            Promise<R> mPromise;
+#ifndef UT_NO_EXCEPTIONS
+            Error mError;
+#endif
+        };
+
+        template <class R>
+        class TaskPromiseMixin
+        {
+        public:
+            template <class U>
+            void return_value(U&& value)
+            {
+                mResult = Optional<R>(R(std::forward<U>(value)));
+            }
+
+        protected:
+            void deliverResult(Promise<R>& promise) _ut_noexcept
+            {
+                ut_assert(mResult);
+
+                promise.complete(std::move(*mResult));
+            }
+
+        private:
+            Optional<R> mResult;
+        };
+
+        template <>
+        class TaskPromiseMixin<void>
+        {
+        public:
+            void return_void() _ut_noexcept { }
+
+        protected:
+            void deliverResult(Promise<void>& promise) _ut_noexcept
+            {
+                promise.complete();
+            }
+        };
+
+        //
+        // TaskAwaiter
+        //
+
+        template <class R, class T>
+        class TaskAwaiterBase
+        {
+        public:
+            template <class U>
+            explicit TaskAwaiterBase(U&& task)
+                : mTask(std::forward<U>(task)) { }
+
+            ~TaskAwaiterBase() _ut_noexcept
+            {
+                // Frame destroyed while suspended, i.e. the awaiting coroutine got canceled.
+                if (mTask.isValid() && !mTask.isReady() && mTask.awaiter() == &mAwaiter)
+                    mTask.setAwaiter(nullptr);
+            }
+
+            bool await_ready() const _ut_noexcept
+            {
+                ut_dcheck(mTask.isValid() &&
+                    "Can't await invalid objects");
+
+#ifdef UT_NO_EXCEPTIONS
+                // Suspend and destroy coroutine, then store error in Task.
+                return mTask.isReady() && !mTask.hasError();
+#else
+                // Suspend if result is not yet available.
+                return mTask.isReady();
+#endif
+            }
+
+            template <class CoroutineResult>
+            void await_suspend(std::coroutine_handle<TaskPromise<CoroutineResult>> coro) _ut_noexcept
+            {
+#ifdef UT_NO_EXCEPTIONS
+                if (mTask.hasError()) {
+                    coro.promise().interruptCoroutine(std::move(mTask.error()));
+                    return;
+                }
+
+                mAwaiter.interrupt = [](void *address, Error error) {
+                    auto coro = std::coroutine_handle<TaskPromise<CoroutineResult>>::from_address(address);
+                    coro.promise().interruptCoroutine(std::move(error));
+                };
+#endif
+                mAwaiter.coro = coro;
+                mTask.setAwaiter(&mAwaiter);
+            }
+
+        protected:
+            struct CoroutineAwaiter : ut::Awaiter
+            {
+                std::coroutine_handle<> coro;
+#ifdef UT_NO_EXCEPTIONS
+                void (*interrupt)(void *address, Error error);
+#endif
+
+                void resume(AwaitableBase *resumer) _ut_noexcept final
+                {
+#ifdef UT_NO_EXCEPTIONS
+                    if (resumer->hasError()) {
+                        interrupt(coro.address(), std::move(resumer->error()));
+                        return;
+                    }
+#endif
+                    resumeOrHandOff(coro, resumer);
+                }
+            };
+
+            TaskAwaiterBase(const TaskAwaiterBase& other) = delete;
+            TaskAwaiterBase& operator=(const TaskAwaiterBase& other) = delete;
+
+            T mTask;
+            CoroutineAwaiter mAwaiter;
+        };
+
+        // Awaits a Task owned by the caller. Result stays in the task.
+        template <class R>
+        class TaskRefAwaiter : public TaskAwaiterBase<R, Task<R>&>
+        {
+        public:
+            explicit TaskRefAwaiter(Task<R>& task) _ut_noexcept
+                : TaskAwaiterBase<R, Task<R>&>(task) { }
+
+            R& await_resume()
+            {
+                return this->mTask.get();
+            }
+        };
+
+        template <>
+        class TaskRefAwaiter<void> : public TaskAwaiterBase<void, Task<void>&>
+        {
+        public:
+            explicit TaskRefAwaiter(Task<void>& task) _ut_noexcept
+                : TaskAwaiterBase<void, Task<void>&>(task) { }
+
+            void await_resume()
+            {
+                this->mTask.get();
+            }
+        };
+
+        // Awaits a temporary Task, which is kept alive by the awaiter.
+        template <class R>
+        class TaskValueAwaiter : public TaskAwaiterBase<R, Task<R>>
+        {
+        public:
+            explicit TaskValueAwaiter(Task<R>&& task)
+                : TaskAwaiterBase<R, Task<R>>(std::move(task)) { }
+
+            R await_resume()
+            {
+                return std::move(this->mTask.get());
+            }
+        };
+
+        template <>
+        class TaskValueAwaiter<void> : public TaskAwaiterBase<void, Task<void>>
+        {
+        public:
+            explicit TaskValueAwaiter(Task<void>&& task)
+                : TaskAwaiterBase<void, Task<void>>(std::move(task)) { }
+
+            void await_resume()
+            {
+                this->mTask.get();
+            }
+        };
+    }
+}
+
+template <class R>
+detail::cpp20::TaskRefAwaiter<R> operator co_await(Task<R>& task) _ut_noexcept
+{
+    return detail::cpp20::TaskRefAwaiter<R>(task);
+}
+
+template <class R>
+detail::cpp20::TaskValueAwaiter<R> operator co_await(Task<R>&& task)
+{
+    return detail::cpp20::TaskValueAwaiter<R>(std::move(task));
+}
+
+}
+
+namespace std {
+
+template <class R, class ...Args>
+struct coroutine_traits<ut::Task<R>, Args...>
+{
+    using promise_type = ut::detail::cpp20::TaskPromise<R>;
+};
+
+}
+
+#endif // _ut_has_cpp20_coroutines
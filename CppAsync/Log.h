@@ -19,6 +19,7 @@
 #include "impl/Common.h"
 #include "impl/Assert.h"
 #include "util/StringUtil.h"
+#include <cstring>
 
 namespace ut {
 
@@ -19,8 +19,13 @@
 #include "impl/Common.h"
 #include "impl/Assert.h"
 #include "util/Meta.h"
-#include <functional>
+#include "util/ScopeGuard.h"
+#include "util/TypeTraits.h"
+#include "util/UniqueFunction.h"
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <thread>
 
 namespace ut {
 
@@ -28,160 +33,433 @@ namespace ut {
 template <class F>
 void schedule(F&& action);
 
-/**
- * Handle for a scheduled action. Destroying or resetting the
- * ticket will cancel the action
- */
-class SchedulerTicket;
-
-
 namespace detail
 {
-    struct ScheduledItem
+    class TicketPoolBase;
+
+    //
+    // Ticket slot
+    //
+
+    // Shared between a ticket and its scheduled action. Holds the functor, so
+    // the scheduler only carries the slot pointer and generation. Whichever side
+    // claims the slot first (by running or canceling the action) takes the
+    // functor and returns the slot to the pool. The generation is bumped on each
+    // claim, so stale references held by the other side fail to match.
+    //
+    // Generations wrap around after 2^31 claims of the same slot. A ticket kept
+    // alive for that long could mistake a recycled slot for its own.
+    //
+    struct TicketSlot
     {
-        SchedulerTicket *ticket;
+        using function_type = UniqueFunction<void ()>;
+
+        // (generation << 1) | isPending
+        std::atomic<uint32_t> state;
+        std::atomic<uint32_t> nextFree; // index of next slot in free list
+        uint32_t index;
+        TicketPoolBase *pool;
+        function_type function;
+
+        bool isPending(uint32_t generation) const _ut_noexcept
+        {
+            return state.load(std::memory_order_acquire) == ((generation << 1) | 1);
+        }
 
-        ScheduledItem() _ut_noexcept
-            : ticket(nullptr) { }
+        /** On success moves out the functor and recycles the slot */
+        bool tryClaim(uint32_t generation, function_type& f) _ut_noexcept;
+    };
+
+    inline int findLastSet(uint32_t word) _ut_noexcept // word must not be 0
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 31 - __builtin_clz(word);
+#else
+        int index = 31;
+        while ((word & 0x80000000u) == 0) {
+            word <<= 1;
+            index--;
+        }
+        return index;
+#endif
+    }
+
+    //
+    // Ticket pool base
+    //
+
+    // Free slots form a lock-free stack. Its head packs a slot index with a tag
+    // that changes on every push and pop, which defeats ABA when a slot gets
+    // popped and pushed back between another thread's load and CAS. Indices map
+    // to slots through chunks of doubling size, so the lookup is a bit scan and
+    // chunks never move.
+    //
+    class TicketPoolBase
+    {
+    public:
+        /** thread safe */
+        void release(TicketSlot *slot) _ut_noexcept
+        {
+            pushFree(slot, slot);
+        }
+
+    protected:
+        static const uint32_t NO_INDEX = UINT32_MAX;
+        static const int FIRST_CHUNK_LOG2 = 6;
+        static const int MAX_CHUNKS = 32 - FIRST_CHUNK_LOG2;
+
+        TicketPoolBase() _ut_noexcept
+            : mNumChunks(0)
+            , mFreeHead(NO_INDEX)
+        {
+            for (auto& chunk : mChunks)
+                chunk.store(nullptr, std::memory_order_relaxed);
+
+            mGrowLock.clear();
+        }
+
+        static uint32_t chunkStart(int chunk) _ut_noexcept
+        {
+            return (1u << (chunk + FIRST_CHUNK_LOG2)) - (1u << FIRST_CHUNK_LOG2);
+        }
+
+        static uint32_t chunkSize(int chunk) _ut_noexcept
+        {
+            return 1u << (chunk + FIRST_CHUNK_LOG2);
+        }
+
+        TicketSlot* slotAt(uint32_t index) const _ut_noexcept
+        {
+            uint32_t n = index + (1u << FIRST_CHUNK_LOG2);
+            int chunk = findLastSet(n) - FIRST_CHUNK_LOG2;
+
+            return mChunks[chunk].load(std::memory_order_acquire) + (index - chunkStart(chunk));
+        }
+
+        TicketSlot* tryPopFree() _ut_noexcept
+        {
+            uint64_t head = mFreeHead.load(std::memory_order_acquire);
+
+            while (true) {
+                uint32_t index = (uint32_t) head; // safe cast
+                if (index == NO_INDEX)
+                    return nullptr;
+
+                // May read a stale link if the slot got popped meanwhile. The
+                // tag makes the CAS fail in that case.
+                TicketSlot *slot = slotAt(index);
+                uint32_t next = slot->nextFree.load(std::memory_order_relaxed);
+
+                if (mFreeHead.compare_exchange_weak(head, retag(head, next),
+                        std::memory_order_acquire, std::memory_order_acquire))
+                    return slot;
+            }
+        }
+
+        // Pushes slots linked from first to last.
+        void pushFree(TicketSlot *first, TicketSlot *last) _ut_noexcept
+        {
+            uint64_t head = mFreeHead.load(std::memory_order_relaxed);
+
+            do {
+                last->nextFree.store((uint32_t) head, std::memory_order_relaxed); // safe cast
+            } while (!mFreeHead.compare_exchange_weak(head, retag(head, first->index),
+                std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void lockGrowth() _ut_noexcept
+        {
+            // Only taken when the free list runs dry.
+            while (mGrowLock.test_and_set(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+
+        void unlockGrowth() _ut_noexcept
+        {
+            mGrowLock.clear(std::memory_order_release);
+        }
+
+        std::atomic<TicketSlot*> mChunks[MAX_CHUNKS];
+        int mNumChunks; // guarded by growth lock
 
     private:
-        ScheduledItem(const ScheduledItem&) = delete;
-        ScheduledItem& operator=(const ScheduledItem&) = delete;
+        TicketPoolBase(const TicketPoolBase& other) = delete;
+        TicketPoolBase& operator=(const TicketPoolBase& other) = delete;
+
+        static uint64_t retag(uint64_t head, uint32_t index) _ut_noexcept
+        {
+            return (((head >> 32) + 1) << 32) | index;
+        }
+
+        // (tag << 32) | index
+        std::atomic<uint64_t> mFreeHead;
+        std::atomic_flag mGrowLock;
     };
+
+    inline bool TicketSlot::tryClaim(uint32_t generation, function_type& f) _ut_noexcept
+    {
+        uint32_t expected = (generation << 1) | 1;
+
+        if (!state.compare_exchange_strong(expected, (generation + 1) << 1,
+                std::memory_order_acq_rel, std::memory_order_relaxed))
+            return false;
+
+        f = std::move(function);
+        pool->release(this);
+        return true;
+    }
+}
+
+//
+// TicketPool
+//
+
+/**
+ * Thread safe pool of ticket slots. Slots are allocated from Alloc in chunks
+ * of doubling size and recycled through a lock-free free list, so scheduling
+ * with a ticket neither allocates nor locks once the pool has warmed up.
+ *
+ * The pool must outlive all tickets and actions scheduled from it.
+ */
+template <class Alloc = std::allocator<char>>
+class TicketPool : public detail::TicketPoolBase
+{
+public:
+    explicit TicketPool(const Alloc& alloc = Alloc())
+        : mAlloc(alloc) { }
+
+    ~TicketPool() _ut_noexcept
+    {
+        for (int chunk = 0; chunk < mNumChunks; chunk++) {
+            detail::TicketSlot *slots = mChunks[chunk].load(std::memory_order_relaxed);
+            uint32_t size = chunkSize(chunk);
+
+            for (uint32_t i = 0; i < size; i++)
+                slots[i].~TicketSlot();
+
+            mAlloc.deallocate(slots, size);
+        }
+    }
+
+    /**
+     * Returns nullptr if growing the pool failed to allocate (only if
+     * UT_NO_EXCEPTIONS is defined). thread safe
+     */
+    detail::TicketSlot* acquire()
+    {
+        detail::TicketSlot *slot = tryPopFree();
+
+        if (slot == nullptr) {
+            slot = grow();
+
+#ifdef UT_NO_EXCEPTIONS
+            if (slot == nullptr)
+                return nullptr;
+#endif
+        }
+
+        uint32_t generation = slot->state.load(std::memory_order_relaxed) >> 1;
+        slot->state.store((generation << 1) | 1, std::memory_order_relaxed);
+
+        return slot;
+    }
+
+private:
+    using slot_allocator_type = RebindAlloc<Alloc, detail::TicketSlot>;
+
+    detail::TicketSlot* grow()
+    {
+        lockGrowth();
+        ut_scope_guard_([this] { unlockGrowth(); });
+
+        // Another thread may have grown the pool meanwhile.
+        detail::TicketSlot *slot = tryPopFree();
+        if (slot != nullptr)
+            return slot;
+
+        int chunk = mNumChunks;
+        ut_check(chunk < MAX_CHUNKS && "Ticket pool exhausted");
+
+        uint32_t start = chunkStart(chunk);
+        uint32_t size = chunkSize(chunk);
+        detail::TicketSlot *slots = mAlloc.allocate(size);
+
+#ifdef UT_NO_EXCEPTIONS
+        if (slots == nullptr)
+            return nullptr;
+#endif
+
+        for (uint32_t i = 0; i < size; i++) {
+            detail::TicketSlot *p = new (&slots[i]) detail::TicketSlot();
+            p->state.store(0, std::memory_order_relaxed);
+            p->nextFree.store(start + i + 1, std::memory_order_relaxed);
+            p->index = start + i;
+            p->pool = this;
+        }
+
+        mChunks[chunk].store(slots, std::memory_order_release);
+        mNumChunks++;
+
+        // Keep the first slot, recycle the rest.
+        pushFree(&slots[1], &slots[size - 1]);
+
+        return &slots[0];
+    }
+
+    slot_allocator_type mAlloc;
+};
+
+namespace detail
+{
+    inline TicketPool<>& defaultTicketPool()
+    {
+        // Leaked on purpose, tickets may be destroyed during static deinitialization.
+        static TicketPool<> *sPool = new TicketPool<>();
+        return *sPool;
+    }
 }
 
+//
+// SchedulerTicket
+//
+
+/**
+ * Handle for a scheduled action. Destroying or resetting the
+ * ticket will cancel the action and release its functor.
+ *
+ * The action may run on a different thread than the one owning
+ * the ticket (e.g. if schedule() posts to a thread pool). Tickets
+ * are never touched by the action itself, so it is safe to move,
+ * reset or destroy them while the action is running.
+ *
+ * The functor is kept in the ticket slot, inline if it fits
+ * default_function_capacity. Canceling releases it right away,
+ * without waiting for the scheduler to discard the action.
+ */
 class SchedulerTicket
 {
 public:
-    SchedulerTicket() _ut_noexcept { }
+    SchedulerTicket() _ut_noexcept
+        : mSlot(nullptr)
+        , mGeneration(0) { }
 
     SchedulerTicket(SchedulerTicket&& other) _ut_noexcept
-        : mHandle(std::move(other.mHandle))
+        : mSlot(other.mSlot)
+        , mGeneration(other.mGeneration)
     {
-        if ((bool) mHandle)
-            mHandle->ticket = this;
+        other.mSlot = nullptr;
     }
 
     SchedulerTicket& operator=(SchedulerTicket&& other) _ut_noexcept
     {
         ut_assert(this != &other);
 
-        mHandle = std::move(other.mHandle);
+        reset();
 
-        if ((bool) mHandle)
-            mHandle->ticket = this;
+        mSlot = other.mSlot;
+        mGeneration = other.mGeneration;
+        other.mSlot = nullptr;
 
         return *this;
     }
 
+    ~SchedulerTicket() _ut_noexcept
+    {
+        reset();
+    }
+
+    /** Check if action is still pending */
     operator bool() const _ut_noexcept
     {
-        return (bool) mHandle;
+        return mSlot != nullptr && mSlot->isPending(mGeneration);
     }
 
     void reset() _ut_noexcept
     {
-        mHandle.reset();
+        if (mSlot != nullptr) {
+            // Functor is destroyed on return, after the ticket got detached.
+            detail::TicketSlot::function_type f;
+            mSlot->tryClaim(mGeneration, f);
+            mSlot = nullptr;
+        }
     }
 
 private:
     SchedulerTicket(const SchedulerTicket& other) = delete;
     SchedulerTicket& operator=(const SchedulerTicket& other) = delete;
 
-    explicit SchedulerTicket(std::shared_ptr<detail::ScheduledItem> handle) _ut_noexcept
-        : mHandle(std::move(handle))
-    {
-        mHandle->ticket = this;
-    }
+    SchedulerTicket(detail::TicketSlot *slot, uint32_t generation) _ut_noexcept
+        : mSlot(slot)
+        , mGeneration(generation) { }
 
-    std::shared_ptr<detail::ScheduledItem> mHandle;
+    detail::TicketSlot *mSlot;
+    uint32_t mGeneration;
 
-    template <class F>
-    friend SchedulerTicket scheduleWithTicket(F&& f);
+    template <class Alloc, class F>
+    friend SchedulerTicket scheduleWithTicket(TicketPool<Alloc>& pool, F&& action);
 };
 
 namespace detail
 {
-    template <class F>
-    struct ScheduledFunction : ScheduledItem
-    {
-        F f;
-
-        explicit ScheduledFunction(F&& f)
-            : f(std::move(f)) { }
-
-        explicit ScheduledFunction(const F& f)
-            : f(f) { }
-    };
-
-    template <typename F>
-    class WeakAction
+    class TicketedAction
     {
     public:
-        explicit WeakAction(std::weak_ptr<ScheduledFunction<F>> handle) _ut_noexcept
-            : mHandle(std::move(handle)) { }
-
-        WeakAction(const WeakAction& other) _ut_noexcept
-            : mHandle(other.mHandle) { }
-
-        WeakAction(WeakAction&& other) _ut_noexcept
-            : mHandle(std::move(other.mHandle)) { }
-
-        WeakAction& operator=(const WeakAction& other) _ut_noexcept
-        {
-            mHandle = other.mHandle;
-
-            return *this;
-        }
-
-        WeakAction& operator=(WeakAction&& other) _ut_noexcept
-        {
-            ut_assert(this != &other);
+        TicketedAction(TicketSlot *slot, uint32_t generation) _ut_noexcept
+            : mSlot(slot)
+            , mGeneration(generation) { }
 
-            mHandle = std::move(other.mHandle);
-
-            return *this;
-        }
-
-        void operator()() const
+        void operator()()
         {
-            auto handle = mHandle.lock();
-            mHandle.reset();
+            // Claim the action, unless canceled.
+            TicketSlot::function_type f;
 
-            if ((bool) handle) {
-                ut_assert(handle->ticket != nullptr);
-
-                // Reset ticket to prevent dangling of functor after call
-                handle->ticket->reset();
-                handle->f();
-            }
+            if (mSlot->tryClaim(mGeneration, f))
+                f();
         }
 
     private:
-        mutable std::weak_ptr<ScheduledFunction<F>> mHandle;
+        TicketSlot *mSlot;
+        uint32_t mGeneration;
     };
 }
 
-
 /**
-* Binds scheduled action to a ticket. If the ticket is destroyed
-* before the action has run, the action will be skipped.
-*/
-template <class F>
-SchedulerTicket scheduleWithTicket(F&& action)
+ * Binds scheduled action to a ticket. If the ticket is destroyed
+ * before the action has run, the action will be skipped.
+ *
+ * Ticket slots come from the given pool. If UT_NO_EXCEPTIONS is defined and
+ * the pool fails to grow, the action is not scheduled and an empty ticket is
+ * returned.
+ */
+template <class Alloc, class F>
+SchedulerTicket scheduleWithTicket(TicketPool<Alloc>& pool, F&& action)
 {
-    using f_type = Unqualified<F>;
-    using scheduled_type = detail::ScheduledFunction<f_type>;
+    detail::TicketSlot *slot = pool.acquire();
+
+#ifdef UT_NO_EXCEPTIONS
+    if (slot == nullptr)
+        return SchedulerTicket(); // Return empty ticket.
+#endif
 
-    auto handle = std::make_shared<scheduled_type>(std::forward<F>(action));
+    uint32_t generation = slot->state.load(std::memory_order_relaxed) >> 1;
 
-    SchedulerTicket ticket(handle);
+    // Cancels the action and recycles the slot if anything below throws.
+    SchedulerTicket ticket(slot, generation);
 
-    schedule(detail::WeakAction<f_type>(
-        std::weak_ptr<scheduled_type>(handle)));
+    slot->function = std::forward<F>(action);
+    schedule(detail::TicketedAction(slot, generation));
 
     return ticket;
+}
 
+/**
+ * Binds scheduled action to a ticket. If the ticket is destroyed
+ * before the action has run, the action will be skipped.
+ */
+template <class F>
+SchedulerTicket scheduleWithTicket(F&& action)
+{
+    return scheduleWithTicket(detail::defaultTicketPool(), std::forward<F>(action));
 }
 
 }
@@ -0,0 +1,536 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "impl/Common.h"
+
+// Stacks are only needed by stackful coroutines, which require exceptions.
+#ifndef UT_NO_EXCEPTIONS
+
+#include "impl/Assert.h"
+#include <boost/context/stack_context.hpp>
+#include <boost/context/stack_traits.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#if defined(BOOST_WINDOWS)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+# if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
+
+namespace ut {
+
+namespace stackful
+{
+    enum StackCommit
+    {
+        /** Commit and pre-fault the whole stack when it is mapped */
+        COMMIT_Eager,
+
+        /** Commit pages on first touch, give deep pages back on reuse */
+        COMMIT_Lazy
+    };
+
+    //
+    // StackPoolStats
+    //
+
+    struct StackPoolStats
+    {
+        /** Number of allocate() calls */
+        uint64_t numAllocations;
+
+        /** Allocations served from the free lists */
+        uint64_t numHits;
+
+        /** Stacks mapped from the OS */
+        uint64_t numCreated;
+
+        /** Stacks returned to the OS, either above high-water mark or by trim() */
+        uint64_t numReleased;
+
+        /** Stacks handed out and not yet deallocated */
+        std::size_t numInUse;
+        std::size_t peakInUse;
+
+        /** Stacks kept in the free lists */
+        std::size_t numCached;
+        std::size_t peakCached;
+
+        /** Lazy stacks inspected on deallocation */
+        uint64_t numSampled;
+
+        /** Pages found resident in sampled stacks */
+        uint64_t totalTouchedPages;
+        std::size_t peakTouchedPages;
+
+        /** Resident pages below the watermark, given back to the OS */
+        uint64_t numTrimmedPages;
+
+        double hitRate() const _ut_noexcept
+        {
+            return numAllocations == 0 ? 0.0 : (double) numHits / numAllocations;
+        }
+
+        double meanTouchedPages() const _ut_noexcept
+        {
+            return numSampled == 0 ? 0.0 : (double) totalTouchedPages / numSampled;
+        }
+    };
+
+    //
+    // StackPool
+    //
+
+    /**
+     * Per-thread cache of guard-paged stacks.
+     *
+     * COMMIT_Eager stacks are pre-faulted when created, so a coroutine running
+     * on a recycled stack doesn't take page faults.
+     *
+     * COMMIT_Lazy stacks only reserve address space. Pages get committed as the
+     * coroutine touches them, so large stacks cost little while fibers stay
+     * shallow. When a lazy stack returns to the pool, the pages below
+     * trimWatermark() bytes from the top are given back to the OS, keeping idle
+     * stacks small even after an occasional deep call. Resident pages are
+     * counted at that point (on POSIX systems), see StackPoolStats. Stacks no
+     * larger than the watermark are neither trimmed nor counted.
+     *
+     * Stacks are grouped by size and commit policy. Each group keeps at most
+     * highWaterMark() free stacks, any excess is returned to the OS right away.
+     * Note that each stack is a separate mapping, running a million fibers may
+     * require raising the system limit on mappings per process.
+     *
+     * Stacks should be deallocated on the thread that allocated them, which is
+     * the natural outcome since stackful coroutines are resumed from the thread
+     * that started them. All stacks must be released before the thread exits.
+     */
+    class StackPool
+    {
+    public:
+        static const std::size_t DEFAULT_HIGH_WATER_MARK = 64;
+        static const std::size_t DEFAULT_TRIM_WATERMARK = 16 * 1024;
+
+        /** Pool of the calling thread */
+        static StackPool& local() _ut_noexcept
+        {
+            _ut_thread_local_object(StackPool, sPool);
+            return sPool;
+        }
+
+        ~StackPool() _ut_noexcept
+        {
+            trim();
+        }
+
+        std::size_t highWaterMark() const _ut_noexcept
+        {
+            return mHighWaterMark;
+        }
+
+        /** Limit the number of free stacks kept per size. Excess stacks are released. */
+        void setHighWaterMark(std::size_t value) _ut_noexcept
+        {
+            mHighWaterMark = value;
+
+            for (auto& sizeClass : mSizeClasses) {
+                while (sizeClass.numFree > mHighWaterMark)
+                    unmapStack(sizeClass.pop(), sizeClass.size);
+            }
+        }
+
+        std::size_t trimWatermark() const _ut_noexcept
+        {
+            return mTrimWatermark;
+        }
+
+        /** Set how many bytes at the top of a free lazy stack are kept resident */
+        void setTrimWatermark(std::size_t value) _ut_noexcept
+        {
+            mTrimWatermark = value;
+        }
+
+        /** Create free stacks in advance, up to count stacks of given size */
+        void reserve(std::size_t size, std::size_t count,
+            StackCommit commit = COMMIT_Eager)
+        {
+            SizeClass& sizeClass = findOrAddSizeClass(usableSize(size), commit);
+
+            while (sizeClass.numFree < count)
+                sizeClass.push(mapStack(sizeClass.size, commit));
+
+            notifyCached();
+        }
+
+        /** Release all free stacks */
+        void trim() _ut_noexcept
+        {
+            for (auto& sizeClass : mSizeClasses) {
+                while (sizeClass.numFree > 0)
+                    unmapStack(sizeClass.pop(), sizeClass.size);
+            }
+        }
+
+        const StackPoolStats& stats() const _ut_noexcept
+        {
+            return mStats;
+        }
+
+        /** Reset counters. Current and peak usage restart from present values. */
+        void resetStats() _ut_noexcept
+        {
+            mStats.numAllocations = 0;
+            mStats.numHits = 0;
+            mStats.numCreated = 0;
+            mStats.numReleased = 0;
+            mStats.peakInUse = mStats.numInUse;
+            mStats.peakCached = mStats.numCached;
+            mStats.numSampled = 0;
+            mStats.totalTouchedPages = 0;
+            mStats.peakTouchedPages = 0;
+            mStats.numTrimmedPages = 0;
+        }
+
+        boost::context::stack_context allocate(std::size_t size,
+            StackCommit commit = COMMIT_Eager)
+        {
+            SizeClass& sizeClass = findOrAddSizeClass(usableSize(size), commit);
+
+            mStats.numAllocations++;
+
+            void *sp;
+            if (sizeClass.numFree > 0) {
+                sp = sizeClass.pop();
+                mStats.numHits++;
+                mStats.numCached--;
+            } else {
+                sp = mapStack(sizeClass.size, commit);
+            }
+
+            if (++mStats.numInUse > mStats.peakInUse)
+                mStats.peakInUse = mStats.numInUse;
+
+            boost::context::stack_context sctx;
+            sctx.sp = sp;
+            sctx.size = sizeClass.size;
+            return sctx;
+        }
+
+        void deallocate(boost::context::stack_context& sctx,
+            StackCommit commit = COMMIT_Eager) _ut_noexcept
+        {
+            ut_assert(sctx.sp != nullptr);
+
+            if (mStats.numInUse > 0)
+                mStats.numInUse--;
+
+            SizeClass *sizeClass = findSizeClass(sctx.size, commit);
+            bool isKept = (sizeClass != nullptr && sizeClass->numFree < mHighWaterMark);
+
+            if (commit == COMMIT_Lazy)
+                sampleAndTrim(sctx, isKept);
+
+            if (isKept) {
+                sizeClass->push(sctx.sp);
+                notifyCached();
+            } else {
+                unmapStack(sctx.sp, sctx.size);
+            }
+        }
+
+        /**
+         * Count resident pages of a stack allocated from the pool, guard page excluded.
+         * Returns 0 where residency can't be queried (Windows).
+         */
+        static std::size_t touchedPages(const boost::context::stack_context& sctx) _ut_noexcept
+        {
+            return scanResidency(sctx, nullptr);
+        }
+
+        /** Usable stack size for a requested size. The guard page comes on top. */
+        static std::size_t usableSize(std::size_t size) _ut_noexcept
+        {
+            std::size_t pageSize = boost::context::stack_traits::page_size();
+
+            if (size == 0)
+                size = 1;
+
+            return (size + pageSize - 1) / pageSize * pageSize;
+        }
+
+    private:
+        StackPool() _ut_noexcept
+            : mHighWaterMark(DEFAULT_HIGH_WATER_MARK)
+            , mTrimWatermark(DEFAULT_TRIM_WATERMARK)
+            , mStats() { }
+
+        StackPool(const StackPool& other) = delete;
+        StackPool& operator=(const StackPool& other) = delete;
+
+        // Free stacks are linked through a node at their top.
+        struct FreeNode
+        {
+            FreeNode *next;
+        };
+
+        struct SizeClass
+        {
+            std::size_t size;
+            StackCommit commit;
+            std::size_t numFree;
+            FreeNode *head;
+
+            void push(void *sp) _ut_noexcept
+            {
+                FreeNode *node = static_cast<FreeNode*>(sp) - 1; // safe cast
+                node->next = head;
+                head = node;
+                numFree++;
+            }
+
+            void* pop() _ut_noexcept
+            {
+                ut_assert(numFree > 0);
+
+                FreeNode *node = head;
+                head = node->next;
+                numFree--;
+
+                return node + 1;
+            }
+        };
+
+        SizeClass* findSizeClass(std::size_t size, StackCommit commit) _ut_noexcept
+        {
+            // Programs rarely use more than a few stack sizes.
+            for (auto& sizeClass : mSizeClasses) {
+                if (sizeClass.size == size && sizeClass.commit == commit)
+                    return &sizeClass;
+            }
+
+            return nullptr;
+        }
+
+        SizeClass& findOrAddSizeClass(std::size_t size, StackCommit commit)
+        {
+            if (SizeClass *sizeClass = findSizeClass(size, commit))
+                return *sizeClass;
+
+            SizeClass sizeClass = { size, commit, 0, nullptr };
+            mSizeClasses.push_back(sizeClass);
+
+            return mSizeClasses.back();
+        }
+
+        void notifyCached() _ut_noexcept
+        {
+            std::size_t numCached = 0;
+            for (auto& sizeClass : mSizeClasses)
+                numCached += sizeClass.numFree;
+
+            mStats.numCached = numCached;
+            if (numCached > mStats.peakCached)
+                mStats.peakCached = numCached;
+        }
+
+        // Map usable size plus one guard page, return the stack top.
+        void* mapStack(std::size_t size, StackCommit commit)
+        {
+            std::size_t pageSize = boost::context::stack_traits::page_size();
+            std::size_t mappedSize = size + pageSize;
+
+#if defined(BOOST_WINDOWS)
+            // Windows charges commit up front, but pages still materialize on first touch.
+            void *vp = ::VirtualAlloc(nullptr, mappedSize, MEM_COMMIT, PAGE_READWRITE);
+            if (vp == nullptr)
+                throw std::bad_alloc();
+
+            DWORD oldProtection;
+            ::VirtualProtect(vp, pageSize, PAGE_READWRITE | PAGE_GUARD, &oldProtection);
+#else
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+# if defined(MAP_NORESERVE)
+            if (commit == COMMIT_Lazy)
+                flags |= MAP_NORESERVE;
+# endif
+
+            void *vp = ::mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (vp == MAP_FAILED)
+                throw std::bad_alloc();
+
+            ::mprotect(vp, pageSize, PROT_NONE);
+#endif
+
+            char *sp = static_cast<char*>(vp) + mappedSize; // safe cast
+
+            // Pre-fault top-down, in the order a stack grows.
+            if (commit == COMMIT_Eager) {
+                for (char *p = sp - pageSize; p >= static_cast<char*>(vp) + pageSize; p -= pageSize)
+                    *static_cast<volatile char*>(p) = 0;
+            }
+
+            mStats.numCreated++;
+
+            return sp;
+        }
+
+        void unmapStack(void *sp, std::size_t size) _ut_noexcept
+        {
+            std::size_t mappedSize = size + boost::context::stack_traits::page_size();
+            void *vp = static_cast<char*>(sp) - mappedSize; // safe cast
+
+#if defined(BOOST_WINDOWS)
+            ::VirtualFree(vp, 0, MEM_RELEASE);
+#else
+            ::munmap(vp, mappedSize);
+#endif
+
+            mStats.numReleased++;
+            notifyCached();
+        }
+
+        // Count resident pages. Optionally report the lowest resident page offset from the top.
+        static std::size_t scanResidency(const boost::context::stack_context& sctx,
+            std::size_t *maxDepth) _ut_noexcept
+        {
+            if (maxDepth != nullptr)
+                *maxDepth = 0;
+
+#if defined(BOOST_WINDOWS)
+            (void) sctx;
+            return 0;
+#else
+# if defined(__APPLE__)
+            char vec[256];
+# else
+            unsigned char vec[256];
+# endif
+            std::size_t pageSize = boost::context::stack_traits::page_size();
+            char *base = static_cast<char*>(sctx.sp) - sctx.size; // safe cast
+            std::size_t numPages = sctx.size / pageSize;
+            std::size_t numTouched = 0;
+
+            for (std::size_t first = 0; first < numPages; first += sizeof(vec)) {
+                std::size_t count = std::min(numPages - first, sizeof(vec));
+
+                if (::mincore(base + first * pageSize, count * pageSize, vec) != 0)
+                    return numTouched;
+
+                for (std::size_t i = 0; i < count; i++) {
+                    if (vec[i] & 1) {
+                        if (maxDepth != nullptr && numTouched == 0)
+                            *maxDepth = (numPages - first - i) * pageSize;
+                        numTouched++;
+                    }
+                }
+            }
+
+            return numTouched;
+#endif
+        }
+
+        void sampleAndTrim(const boost::context::stack_context& sctx, bool isKept) _ut_noexcept
+        {
+            std::size_t pageSize = boost::context::stack_traits::page_size();
+            std::size_t keptSize = mTrimWatermark / pageSize * pageSize;
+
+            // Small stacks are never trimmed, don't pay for a syscall.
+            if (sctx.size <= keptSize)
+                return;
+
+            std::size_t maxDepth;
+            std::size_t numTouched = scanResidency(sctx, &maxDepth);
+
+#if defined(BOOST_WINDOWS)
+            // No residency info, always reset the deep end.
+            (void) numTouched;
+            maxDepth = sctx.size;
+#else
+            mStats.numSampled++;
+            mStats.totalTouchedPages += numTouched;
+            if (numTouched > mStats.peakTouchedPages)
+                mStats.peakTouchedPages = numTouched;
+#endif
+
+            // Stacks about to be unmapped need no trimming.
+            if (!isKept || maxDepth <= keptSize)
+                return;
+
+            std::size_t trimmedSize = sctx.size - keptSize;
+            char *base = static_cast<char*>(sctx.sp) - sctx.size; // safe cast
+
+#if defined(BOOST_WINDOWS)
+            ::VirtualAlloc(base, trimmedSize, MEM_RESET, PAGE_READWRITE);
+#else
+            // Count what is given back, the pages above the watermark stay.
+            boost::context::stack_context top;
+            top.sp = sctx.sp;
+            top.size = keptSize;
+
+            mStats.numTrimmedPages += numTouched - scanResidency(top, nullptr);
+
+            ::madvise(base, trimmedSize, MADV_DONTNEED);
+#endif
+        }
+
+        std::size_t mHighWaterMark;
+        std::size_t mTrimWatermark;
+        StackPoolStats mStats;
+        std::vector<SizeClass> mSizeClasses;
+    };
+}
+
+namespace detail
+{
+    namespace stackful
+    {
+        // Core of ut::stackful::PooledStack and LazyPooledStack. Only the stack size
+        // is copied into each coroutine, stacks come from the pool of the current thread.
+        template <ut::stackful::StackCommit commit>
+        class PooledStackCore
+        {
+        public:
+            using traits_type = boost::context::stack_traits;
+
+            PooledStackCore(std::size_t size = traits_type::default_size()) _ut_noexcept
+                : mSize(size) { }
+
+            boost::context::stack_context allocate()
+            {
+                return ut::stackful::StackPool::local().allocate(mSize, commit);
+            }
+
+            void deallocate(boost::context::stack_context& sctx) _ut_noexcept
+            {
+                ut::stackful::StackPool::local().deallocate(sctx, commit);
+            }
+
+        private:
+            std::size_t mSize;
+        };
+    }
+}
+
+}
+
+#endif // UT_NO_EXCEPTIONS
@@ -0,0 +1,330 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "impl/Common.h"
+
+// Stacks are only needed by stackful coroutines, which require exceptions.
+#ifndef UT_NO_EXCEPTIONS
+
+#include <boost/context/stack_traits.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+#include <typeinfo>
+# if defined(__GNUG__)
+# include <cxxabi.h>
+# include <cstdlib>
+# endif
+#endif
+
+namespace ut {
+
+namespace stackful
+{
+    //
+    // StackProfile
+    //
+
+    /**
+     * Stack usage of all coroutines sharing a function type. Samples are
+     * collected when coroutines get deallocated, only if UT_STACK_PROFILING
+     * is defined.
+     *
+     * Usage is bucketed by powers of two: bucket 0 counts coroutines that used
+     * under 1KB, bucket i those that used [2^(i-1), 2^i) KB.
+     */
+    class StackProfile
+    {
+    public:
+        static const int NUM_BUCKETS = 20;
+
+        explicit StackProfile(const char *name) _ut_noexcept
+            : mName(name)
+            , mNext(nullptr)
+            , mNumSamples(0)
+            , mMaxUsed(0)
+            , mStackSize(0)
+        {
+            for (auto& count : mBuckets)
+                count.store(0, std::memory_order_relaxed);
+
+            registerProfile();
+        }
+
+        const char* name() const _ut_noexcept
+        {
+            return mName;
+        }
+
+        uint64_t numSamples() const _ut_noexcept
+        {
+            return mNumSamples.load(std::memory_order_relaxed);
+        }
+
+        /** Deepest stack usage seen, in bytes */
+        std::size_t maxUsed() const _ut_noexcept
+        {
+            return mMaxUsed.load(std::memory_order_relaxed);
+        }
+
+        /** Largest usable stack size seen, in bytes */
+        std::size_t stackSize() const _ut_noexcept
+        {
+            return mStackSize.load(std::memory_order_relaxed);
+        }
+
+        uint64_t bucket(int index) const _ut_noexcept
+        {
+            return mBuckets[index].load(std::memory_order_relaxed);
+        }
+
+        /** Lower bound of a histogram bucket, in bytes */
+        static std::size_t bucketFloor(int index) _ut_noexcept
+        {
+            return index == 0 ? 0 : (std::size_t) 512 << index;
+        }
+
+        static int bucketOf(std::size_t used) _ut_noexcept
+        {
+            int index = 0;
+            for (std::size_t kb = used / 1024; kb > 0 && index < NUM_BUCKETS - 1; kb >>= 1)
+                index++;
+
+            return index;
+        }
+
+        /** thread safe */
+        void record(std::size_t used, std::size_t stackSize) _ut_noexcept
+        {
+            mNumSamples.fetch_add(1, std::memory_order_relaxed);
+            mBuckets[bucketOf(used)].fetch_add(1, std::memory_order_relaxed);
+
+            updateMax(mMaxUsed, used);
+            updateMax(mStackSize, stackSize);
+        }
+
+        void reset() _ut_noexcept
+        {
+            mNumSamples.store(0, std::memory_order_relaxed);
+            mMaxUsed.store(0, std::memory_order_relaxed);
+            mStackSize.store(0, std::memory_order_relaxed);
+
+            for (auto& count : mBuckets)
+                count.store(0, std::memory_order_relaxed);
+        }
+
+        /** First registered profile. Profiles are never unregistered. */
+        static StackProfile* first() _ut_noexcept
+        {
+            return head().load(std::memory_order_acquire);
+        }
+
+        StackProfile* next() const _ut_noexcept
+        {
+            return mNext;
+        }
+
+    private:
+        StackProfile(const StackProfile& other) = delete;
+        StackProfile& operator=(const StackProfile& other) = delete;
+
+        static std::atomic<StackProfile*>& head() _ut_noexcept
+        {
+            static std::atomic<StackProfile*> sHead(nullptr);
+            return sHead;
+        }
+
+        static void updateMax(std::atomic<std::size_t>& target, std::size_t value) _ut_noexcept
+        {
+            std::size_t current = target.load(std::memory_order_relaxed);
+
+            while (current < value
+                && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) { }
+        }
+
+        void registerProfile() _ut_noexcept
+        {
+            StackProfile *oldHead = head().load(std::memory_order_relaxed);
+
+            do {
+                mNext = oldHead;
+            } while (!head().compare_exchange_weak(oldHead, this,
+                std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        const char *mName;
+        StackProfile *mNext;
+        std::atomic<uint64_t> mNumSamples;
+        std::atomic<std::size_t> mMaxUsed;
+        std::atomic<std::size_t> mStackSize;
+        std::atomic<uint64_t> mBuckets[NUM_BUCKETS];
+    };
+
+    //
+    // StackProfiler
+    //
+
+    /**
+     * Stack usage histograms, one per coroutine function type. Define
+     * UT_STACK_PROFILING to collect them.
+     *
+     * Profiling paints the whole stack of each coroutine with a canary pattern
+     * when it's created, and checks how much of it was overwritten when the
+     * coroutine is deallocated. The bottom page is never painted, usage that
+     * reaches into it is reported as the full stack size. Painting commits
+     * every page, so lazily committed stacks lose their advantage while
+     * profiling.
+     */
+    class StackProfiler
+    {
+    public:
+        static bool isEnabled() _ut_noexcept
+        {
+#ifdef UT_STACK_PROFILING
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        template <class F>
+        static void forEach(F&& f)
+        {
+            for (StackProfile *profile = StackProfile::first(); profile != nullptr;
+                    profile = profile->next()) {
+                if (profile->numSamples() > 0)
+                    f(*profile);
+            }
+        }
+
+        static void reset() _ut_noexcept
+        {
+            for (StackProfile *profile = StackProfile::first(); profile != nullptr;
+                    profile = profile->next())
+                profile->reset();
+        }
+
+        static void dump(FILE *out = stdout)
+        {
+            if (!isEnabled()) {
+                fprintf(out, "stack profiling disabled, define UT_STACK_PROFILING\n");
+                return;
+            }
+
+            forEach([out](const StackProfile& profile) {
+                fprintf(out, "%s\n", profile.name());
+                fprintf(out, "    %llu coroutines, stack size %d KB, max used %.1f KB\n",
+                    (unsigned long long) profile.numSamples(), (int) (profile.stackSize() / 1024),
+                    profile.maxUsed() / 1024.0);
+
+                for (int i = 0; i < StackProfile::NUM_BUCKETS; i++) {
+                    uint64_t count = profile.bucket(i);
+                    if (count == 0)
+                        continue;
+
+                    fprintf(out, "    %6d KB+ %10llu  ", (int) (StackProfile::bucketFloor(i) / 1024),
+                        (unsigned long long) count);
+
+                    int width = (int) (40 * count / profile.numSamples()); // safe cast
+                    for (int j = 0; j < width; j++)
+                        fputc('#', out);
+                    fputc('\n', out);
+                }
+            });
+        }
+    };
+}
+
+namespace detail
+{
+    namespace stackful
+    {
+        namespace profiling
+        {
+            static const uint64_t CANARY = 0xCA9A6CA9A6CA9A6Cull;
+
+            inline uint64_t* alignUp(char *p) _ut_noexcept
+            {
+                uintptr_t address = reinterpret_cast<uintptr_t>(p);
+                address = (address + sizeof(uint64_t) - 1) & ~(uintptr_t) (sizeof(uint64_t) - 1);
+
+                return reinterpret_cast<uint64_t*>(address);
+            }
+
+            // Stack sizes reported by some allocators include a guard page at
+            // the bottom (e.g. Boost's protected_fixedsize_stack), leave it alone.
+            inline uint64_t* paintedBegin(char *limit, std::size_t size) _ut_noexcept
+            {
+                std::size_t pageSize = boost::context::stack_traits::page_size();
+
+                return alignUp(size > pageSize ? limit + pageSize : limit + size);
+            }
+
+            inline void paintStack(char *limit, std::size_t size) _ut_noexcept
+            {
+                uint64_t *end = reinterpret_cast<uint64_t*>(limit + size); // safe cast
+
+                for (uint64_t *p = paintedBegin(limit, size); p < end; p++)
+                    *p = CANARY;
+            }
+
+            // Stack grows down, the canary survives below the deepest frame.
+            inline std::size_t measureStack(char *limit, std::size_t size) _ut_noexcept
+            {
+                uint64_t *end = reinterpret_cast<uint64_t*>(limit + size); // safe cast
+
+                uint64_t *p = paintedBegin(limit, size);
+                while (p < end && *p == CANARY)
+                    p++;
+
+                return (limit + size) - reinterpret_cast<char*>(p);
+            }
+
+            template <class F>
+            const char* typeName() _ut_noexcept
+            {
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+                const char *name = typeid(F).name();
+# if defined(__GNUG__)
+                // Demangled once per type and kept for the lifetime of the program.
+                int status = 0;
+                if (char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status))
+                    return demangled;
+# endif
+                return name;
+#else
+                return "(coroutine function, no RTTI)";
+#endif
+            }
+
+            template <class F>
+            ut::stackful::StackProfile& profileOf() _ut_noexcept
+            {
+                static ut::stackful::StackProfile sProfile(typeName<F>());
+                return sProfile;
+            }
+        }
+    }
+}
+
+}
+
+#endif // UT_NO_EXCEPTIONS
@@ -23,6 +23,7 @@
 #ifndef UT_NO_EXCEPTIONS
 
 #include "Coroutine.h"
+#include "StackPool.h"
 #include <exception>
 
 //
@@ -209,6 +210,14 @@ namespace stackful
     using ProtectedFixedSizeStack = BasicStackAllocator<
         boost::context::protected_fixedsize_stack>;
 
+    // Guard-paged stacks recycled through the per-thread StackPool.
+    using PooledStack = BasicStackAllocator<
+        detail::stackful::PooledStackCore<COMMIT_Eager>>;
+
+    // Pooled stacks committed on demand and trimmed on reuse.
+    using LazyPooledStack = BasicStackAllocator<
+        detail::stackful::PooledStackCore<COMMIT_Lazy>>;
+
 #if defined(BOOST_USE_SEGMENTED_STACKS) && !defined(BOOST_WINDOWS)
     using SegmentedStack = BasicStackAllocator<
         boost::context::segmented_stack>;
@@ -257,13 +266,36 @@ namespace stackful
 
     inline void* yield_(void *value = nullptr)
     {
-        ut_dcheck(detail::stackful::context::callChainSize() > 1 &&
+        ut_dcheck(detail::stackful::context::isInsideCoroutine() &&
             "Only stackful coroutines may call ut::yield_(). "
             "Stackless coroutines should use macros ut_coro_yield_() / ut_await_() instead.");
 
         auto& currentCoroutine = *detail::stackful::context::currentCoroutine();
         return currentCoroutine.yield_(value); // suspend
     }
+
+    /**
+     * Switch from the current coroutine straight into target, passing it a value.
+     * Target replaces the current coroutine on the call chain, so it may later
+     * yield to the current coroutine's parent or transfer back. Returns the value
+     * passed when the current coroutine is resumed again.
+     *
+     * A yield after one or more transfers reaches the parent as if it came from
+     * the coroutine the parent resumed. Target must be suspended, or not started.
+     *
+     * If a transfer target finishes, control returns to the parent and its
+     * resume call reports false. The coroutines that transferred away stay
+     * suspended (isDone() is false) until resumed or deleted, deleting them
+     * unwinds their stacks as usual.
+     */
+    inline void* transferTo(StackfulCoroutine& target, void *value = nullptr)
+    {
+        ut_dcheck(detail::stackful::context::isInsideCoroutine() &&
+            "Only stackful coroutines may call ut::stackful::transferTo()");
+
+        auto& currentCoroutine = *detail::stackful::context::currentCoroutine();
+        return currentCoroutine.transferTo(target.raw(), value); // suspend
+    }
 }
 
 }
@@ -237,6 +237,51 @@ auto startAsyncOf()
     return startAsyncOf<CustomFrame>(std::allocator_arg, std::allocator<char>());
 }
 
+//
+// Frames in caller-provided arena
+//
+
+/**
+ * Arena space taken by startAsyncOf<CustomFrame>(arena, ...). Covers the frame
+ * together with its coroutine state and bookkeeping.
+ */
+template <class CustomFrame>
+struct AsyncFrameSize : std::integral_constant<std::size_t,
+    detail::stackless::ArenaFrameTraits<CustomFrame>::size> { };
+
+/** Arena for one CustomFrame at a time */
+template <class CustomFrame>
+using AsyncFrameArena = LinearStackArena<AsyncFrameSize<CustomFrame>::value>;
+
+/**
+ * Start an async coroutine inside a caller-provided arena, bypassing the heap.
+ * Intended for child frames that are awaited right away: the parent frame keeps
+ * an arena member, declared before the child task so that the child frame gets
+ * destroyed first. Frames started one after another may share the arena,
+ * provided each task is done or destroyed before the next one starts.
+ *
+ * The task must not be detached, the child frame would outlive its arena.
+ *
+ * Fails to compile if CustomFrame doesn't fit in an empty arena. If the arena
+ * is still occupied when a frame starts, the frame is allocated from the
+ * arena's upstream instead, when one is set with BufferArenaBase::setUpstream()
+ * (counted in stats().numFallbacks). Without upstream, starting the frame
+ * throws std::bad_alloc, or returns an invalid task if UT_NO_EXCEPTIONS is
+ * defined (counted in stats().numFailures).
+ */
+template <class CustomFrame, std::size_t N, class ...Args>
+auto startAsyncOf(LinearStackArena<N>& arena, Args&&... frameArgs)
+    -> Task<typename detail::stackless::AsyncFrameTraits<CustomFrame>::result_type>
+{
+    using traits_type = detail::stackless::ArenaFrameTraits<CustomFrame>;
+
+    static_assert(traits_type::size <= LinearStackArena<N>::buffer_capacity,
+        "Arena too small for frame, use ut::AsyncFrameArena<CustomFrame>");
+
+    return startAsyncOf<CustomFrame>(std::allocator_arg,
+        typename traits_type::alloc_type(arena), std::forward<Args>(frameArgs)...);
+}
+
 template <class Alloc = std::allocator<char>, class F,
     EnableIf<IsFunctor<Unqualified<F>>::value> = nullptr>
 auto startAsync(F&& f, const Alloc& alloc = Alloc())
@@ -63,6 +63,42 @@
 #define _ut_noexcept noexcept
 #endif
 
+//
+// Thread local storage emulation for MSVC
+//
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define _ut_thread_local __declspec(thread)
+#else
+#define _ut_thread_local thread_local
+#endif
+
+// Declares a thread local object of any type. Because __declspec(thread) only
+// supports plain data, MSVC 2013 gets a thread local pointer instead. The object
+// is created on first use and leaks when its thread exits.
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define _ut_thread_local_object(type, name) \
+    static __declspec(thread) type *_ut_concatenate(name, Ptr) = nullptr; \
+    if (_ut_concatenate(name, Ptr) == nullptr) \
+        _ut_concatenate(name, Ptr) = new type(); \
+    type& name = *_ut_concatenate(name, Ptr)
+#else
+#define _ut_thread_local_object(type, name) \
+    static thread_local type name
+#endif
+
+//
+// Standard C++20 coroutines
+//
+
+#if (__cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)) \
+    && defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define _ut_has_cpp20_coroutines 1
+#else
+#define _ut_has_cpp20_coroutines 0
+#endif
+
 //
 // Aliases to deal with exceptions ban
 //
@@ -158,7 +194,11 @@ namespace ut
         //          uncaught_exception() returns true after rethrow_exception().
         //          See https://gcc.gnu.org/bugzilla/show_bug.cgi?id=62258.
         //
+#if defined(__cpp_lib_uncaught_exceptions) && __cpp_lib_uncaught_exceptions >= 201411L
+        return std::uncaught_exceptions() > 0;
+#else
         return std::uncaught_exception();
+#endif
     }
 
     inline Error currentException() _ut_noexcept
@@ -327,7 +327,7 @@ namespace detail
         {
             inline void* currentStashPtr() _ut_noexcept
             {
-                ut_dcheck(callChainSize() > 1 &&
+                ut_dcheck(isInsideCoroutine() &&
                     "No coroutine active, can't access stash");
 
                 return currentCoroutine()->functionPtr();
@@ -341,7 +341,7 @@ namespace detail
 
         inline void checkAwaitConditions() _ut_noexcept
         {
-            ut_dcheck(context::callChainSize() > 1 &&
+            ut_dcheck(context::isInsideCoroutine() &&
                 "Only stackful coroutines may call ut::await_()."
                 "Stackless coroutines should use the ut_await_() macro instead.");
 
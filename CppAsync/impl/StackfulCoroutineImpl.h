@@ -22,10 +22,10 @@
 
 #include "Assert.h"
 #include "../util/Cast.h"
-#include "../util/StaticStack.h"
 #include "../util/FunctionTraits.h"
 #include "../util/Meta.h"
 #include "../util/SmartPtr.h"
+#include "../StackProfiler.h"
 #include <boost/context/detail/fcontext.hpp>
 #include <boost/context/fixedsize_stack.hpp>
 #include <boost/context/protected_fixedsize_stack.hpp>
@@ -44,49 +44,45 @@ namespace detail
         //
         // Coroutine call chain
         //
+        // Each thread keeps its own call chain, rooted in a per-thread main coroutine. Stackful
+        // coroutines may run concurrently on different threads, but a coroutine must always be
+        // resumed from the thread that started it.
+        //
+        // The chain is linked through the coroutines themselves: each running coroutine points
+        // to the one that resumed it, and only the innermost one is tracked per thread. Nesting
+        // depth is unbounded.
+        //
 
         namespace context
         {
             namespace impl
             {
-                using call_chain_type = StaticStack<CoroutineImplBase*, UT_MAX_COROUTINE_DEPTH>;
-
-                inline call_chain_type& callChain() _ut_noexcept
+                inline CoroutineImplBase*& current() _ut_noexcept
                 {
-                    static call_chain_type sCallChain;
-                    return sCallChain;
+                    static _ut_thread_local CoroutineImplBase *sCurrent = nullptr;
+                    return sCurrent;
                 }
             }
 
             inline void initialize();
 
-            inline std::size_t callChainSize() _ut_noexcept
+            inline CoroutineImplBase* currentCoroutine() _ut_noexcept
             {
-                return impl::callChain().size();
+                return impl::current();
             }
 
-            inline bool callChainContains(CoroutineImplBase *coroutine) _ut_noexcept
+            inline bool isInitialized() _ut_noexcept
             {
-                return impl::callChain().contains(coroutine);
+                return impl::current() != nullptr;
             }
 
-            inline CoroutineImplBase* currentCoroutine() _ut_noexcept
-            {
-                return impl::callChain().top();
-            }
+            inline bool isInsideCoroutine() _ut_noexcept;
 
-            inline void pushCoroutine(CoroutineImplBase *coroutine) _ut_noexcept
-            {
-                ut_check(!impl::callChain().isFull() &&
-                    "Call chain too deep. Consider increasing UT_MAX_COROUTINE_DEPTH");
+            inline void pushCoroutine(CoroutineImplBase *coroutine) _ut_noexcept;
 
-                impl::callChain().push(coroutine);
-            }
+            inline void popCoroutine() _ut_noexcept;
 
-            inline void popCoroutine() _ut_noexcept
-            {
-                impl::callChain().pop();
-            }
+            inline void replaceCoroutine(CoroutineImplBase *coroutine) _ut_noexcept;
         }
 
         //
@@ -136,17 +132,24 @@ namespace detail
             CoroutineImplBase() _ut_noexcept
                 : mState(ST_NotStarted)
                 , mValue(nullptr)
-                , mFContext(boost::context::detail::fcontext_t()) { }
+                , mFContext(boost::context::detail::fcontext_t())
+                , mParent(nullptr)
+                , mYieldedBy(nullptr) { }
 
             CoroutineImplBase(void *sp, std::size_t size) _ut_noexcept
                 : CoroutineImplBase()
             {
+#ifdef UT_STACK_PROFILING
+                mStackLimit = static_cast<char*>(sp) - size; // safe cast
+                mStackSize = size;
+                profiling::paintStack(mStackLimit, mStackSize);
+#endif
                 mFContext = boost::context::detail::make_fcontext(sp, size, &fcontextFunc);
             }
 
             virtual ~CoroutineImplBase() _ut_noexcept
             {
-                ut_dcheck((context::callChainSize() == 1 || !context::callChainContains(this)) &&
+                ut_dcheck(!isOnCallChain() &&
                     "Stackful coroutine may not delete itself while it is executing");
 
                 switch (mState)
@@ -200,9 +203,20 @@ namespace detail
                 return mFunction;
             }
 
+            /** Coroutine that resumed this one, null unless running or suspended inside a child */
+            CoroutineImplBase* parent() const _ut_noexcept
+            {
+                return mParent;
+            }
+
+            bool isOnCallChain() const _ut_noexcept
+            {
+                return mParent != nullptr;
+            }
+
             bool operator()(void *arg)
             {
-                if (context::callChainSize() == 0)
+                if (!context::isInitialized())
                     context::initialize();
 
                 auto& parent = *context::currentCoroutine();
@@ -213,7 +227,10 @@ namespace detail
                 mValue = nullptr;
                 mValue = jump(parent, *this, YieldData(&parent.mFContext, YK_Result, arg)); // Suspend.
 
-                return !isDone();
+                // After transfers, control may come back from a different coroutine. If that
+                // one has finished, the chain is over even though this coroutine is still
+                // parked in transferTo().
+                return !parent.mYieldedBy->isDone();
             }
 
             void* yield_(void *value)
@@ -226,6 +243,24 @@ namespace detail
                 return yield_(YieldData(&mFContext, YK_Exception, peptr)); // Suspend.
             }
 
+            void* transferTo(CoroutineImplBase& target, void *value)
+            {
+                ut_assert(context::isInsideCoroutine());
+                ut_assert(context::currentCoroutine() == this);
+
+                ut_dcheck(&target != this && !target.isOnCallChain() &&
+                    "May not transfer to a coroutine on the call chain");
+                ut_dcheck(!target.isDone() &&
+                    "May not transfer to a finished coroutine");
+                ut_dcheck(mState != ST_Interrupting &&
+                    "Coroutine may not absorb ForcedUnwind exception");
+
+                // Target takes the place of this coroutine on the call chain.
+                context::replaceCoroutine(&target);
+
+                return jump(*this, target, YieldData(&mFContext, YK_Result, value)); // Suspend.
+            }
+
         private:
             CoroutineImplBase(const CoroutineImplBase& other) = delete;
             CoroutineImplBase& operator=(const CoroutineImplBase& other) = delete;
@@ -345,7 +380,7 @@ namespace detail
 
             void* yield_(const YieldData& yData)
             {
-                ut_assert(context::callChainSize() > 1);
+                ut_assert(context::isInsideCoroutine());
                 ut_assert(context::currentCoroutine() == this);
 
                 ut_assert(mState != ST_NotStarted);
@@ -355,6 +390,7 @@ namespace detail
 
                 context::popCoroutine();
                 auto& parent = *context::currentCoroutine();
+                parent.mYieldedBy = this;
 
                 return jump(*this, parent, yData); // Suspend.
             }
@@ -383,6 +419,18 @@ namespace detail
             void *mValue;
             void *mFunction;
             boost::context::detail::fcontext_t mFContext;
+            CoroutineImplBase *mParent;
+            CoroutineImplBase *mYieldedBy; // last coroutine to yield to this one
+
+            friend void context::pushCoroutine(CoroutineImplBase *coroutine) _ut_noexcept;
+            friend void context::popCoroutine() _ut_noexcept;
+            friend void context::replaceCoroutine(CoroutineImplBase *coroutine) _ut_noexcept;
+
+#ifdef UT_STACK_PROFILING
+        protected:
+            char *mStackLimit;
+            std::size_t mStackSize;
+#endif
         };
 
         template <class F, class StackAllocator>
@@ -413,7 +461,19 @@ namespace detail
                 StackAllocator stackAllocator = std::move(mStackAllocator);
                 boost::context::stack_context stackContext = mStackContext;
 
+#ifdef UT_STACK_PROFILING
+                char *stackLimit = mStackLimit;
+                std::size_t stackSize = mStackSize;
+#endif
+
                 this->~CoroutineImpl();
+
+#ifdef UT_STACK_PROFILING
+                // Measure after destruction, forced unwinding runs on this stack too.
+                profiling::profileOf<F>().record(
+                    profiling::measureStack(stackLimit, stackSize), stackSize);
+#endif
+
                 stackAllocator.deallocate(stackContext);
             }
 
@@ -437,16 +497,52 @@ namespace detail
 
         namespace context
         {
+            inline bool isInsideCoroutine() _ut_noexcept
+            {
+                // Only the per-thread main coroutine has no parent.
+                return impl::current() != nullptr && impl::current()->parent() != nullptr;
+            }
+
+            inline void pushCoroutine(CoroutineImplBase *coroutine) _ut_noexcept
+            {
+                ut_assert(coroutine->mParent == nullptr);
+
+                coroutine->mParent = impl::current();
+                impl::current() = coroutine;
+            }
+
+            inline void popCoroutine() _ut_noexcept
+            {
+                CoroutineImplBase *coroutine = impl::current();
+                ut_assert(coroutine->mParent != nullptr);
+
+                impl::current() = coroutine->mParent;
+                coroutine->mParent = nullptr;
+            }
+
+            inline void replaceCoroutine(CoroutineImplBase *coroutine) _ut_noexcept
+            {
+                CoroutineImplBase *replaced = impl::current();
+                ut_assert(replaced->mParent != nullptr);
+                ut_assert(coroutine->mParent == nullptr);
+
+                coroutine->mParent = replaced->mParent;
+                replaced->mParent = nullptr;
+                impl::current() = coroutine;
+            }
+
             inline void initialize()
             {
-                // Must be called from main stack.
+                // Must be called from main stack, once per thread.
 
                 struct DummyCoroutineImpl : CoroutineImplBase
                 {
                     void deallocate() _ut_noexcept final { }
-                } static sMainCoroutine;
+                };
+
+                _ut_thread_local_object(DummyCoroutineImpl, sMainCoroutine);
 
-                pushCoroutine(&sMainCoroutine);
+                impl::current() = &sMainCoroutine;
 
                 // Initialize some eptrs in advance to avoid problems with
                 // currentException() during exception propagation
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "Common.h"
+#include "../util/Arena.h"
 #include "../util/Meta.h"
 #include "../StacklessCoroutine.h"
 #include "../Task.h"
@@ -312,6 +313,25 @@ namespace detail
             }
         };
 
+        //
+        // Task coroutine in caller-provided arena -- for ut::startAsyncOf<Frame>(arena)
+        //
+
+        template <class CustomFrame>
+        struct ArenaFrameTraits
+        {
+            using alloc_type = ArenaAlloc<char, LinearBufferArena>;
+            using awaiter_type = AsyncCoroutineAwaiter<CustomFrame, alloc_type>;
+            using data_type = ut::detail::AllocElementData<awaiter_type, alloc_type>;
+
+            static_assert(std::alignment_of<data_type>::value <= max_align_size,
+                "Over-aligned frames can't be allocated from arena");
+
+            // LinearBufferArena hands out chunks rounded up to max alignment.
+            static const std::size_t size = (sizeof(data_type) + max_align_size - 1)
+                / max_align_size * max_align_size;
+        };
+
         //
         // Helpers for await macros
         //
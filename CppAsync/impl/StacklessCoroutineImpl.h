@@ -33,9 +33,12 @@ namespace detail
 
         namespace context
         {
+            // Exception caught while resuming a coroutine, held until it gets rethrown from
+            // the matching ut_catch handler or propagated to the caller. It never outlives a
+            // single resume, so each thread needs just one slot.
             inline Error& loopbackException() _ut_noexcept
             {
-                static Error sEptr;
+                _ut_thread_local_object(Error, sEptr);
                 return sEptr;
             }
         }
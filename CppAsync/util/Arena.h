@@ -21,10 +21,32 @@
 #include "Cast.h"
 #include "TypeTraits.h"
 #include <cstdint>
+#include <functional>
 #include <new>
 
 namespace ut {
 
+namespace detail
+{
+    namespace arena
+    {
+        // Throws std::bad_alloc, or returns nullptr if UT_NO_EXCEPTIONS is defined.
+        inline void* allocationFailed()
+        {
+#ifdef UT_NO_EXCEPTIONS
+            return nullptr;
+#else
+            throw std::bad_alloc();
+#endif
+        }
+
+        inline std::size_t roundUp(std::size_t size, std::size_t unit) _ut_noexcept
+        {
+            return (size + unit - 1) / unit * unit;
+        }
+    }
+}
+
 //
 // ArenaAlloc
 //
@@ -112,10 +134,65 @@ ArenaAlloc<T, Arena> makeArenaAlloc(Arena& arena) _ut_noexcept
     return ArenaAlloc<T, Arena>(arena);
 }
 
+//
+// ArenaUpstream
+//
+
+/** Source of memory for allocations that don't fit in a buffer arena */
+class ArenaUpstream
+{
+public:
+    virtual ~ArenaUpstream() _ut_noexcept { }
+
+    /** Returns nullptr on failure, must not throw */
+    virtual void* allocate(std::size_t size) _ut_noexcept = 0;
+
+    virtual void deallocate(void *p, std::size_t size) _ut_noexcept = 0;
+};
+
+class HeapUpstream : public ArenaUpstream
+{
+public:
+    /** Shared instance, backed by operator new */
+    static HeapUpstream& instance() _ut_noexcept
+    {
+        static HeapUpstream sInstance;
+        return sInstance;
+    }
+
+    void* allocate(std::size_t size) _ut_noexcept final
+    {
+        return ::operator new(size, std::nothrow);
+    }
+
+    void deallocate(void *p, std::size_t /* size */) _ut_noexcept final
+    {
+        ::operator delete(p);
+    }
+};
+
 //
 // BufferArena
 //
 
+struct ArenaStats
+{
+    /** Number of allocate() calls */
+    uint64_t numAllocations;
+
+    /** Allocations that didn't fit in the buffer and were served by upstream */
+    uint64_t numFallbacks;
+
+    /** Allocations that failed, either without upstream or because upstream failed */
+    uint64_t numFailures;
+
+    /** Highest buffer usage, in bytes */
+    std::size_t peakUsed;
+
+    /** Bytes currently allocated from upstream */
+    std::size_t fallbackUsed;
+};
+
 class BufferArenaBase
 {
 public:
@@ -123,6 +200,8 @@ public:
         : mBuf(buf)
         , mPos(buf)
         , mCapacity(capacity)
+        , mUpstream(nullptr)
+        , mStats()
     {
         if (!(capacity > max_align_size && (capacity % max_align_size == 0))) {
             ut_dcheckf(false, "Capacity should be a multiple of max alignment (%d)",
@@ -132,6 +211,9 @@ public:
 
     ~BufferArenaBase()
     {
+        ut_dcheck(mStats.fallbackUsed == 0 &&
+            "Arena destroyed while upstream allocations are live");
+
         mPos = nullptr;
     }
 
@@ -145,6 +227,34 @@ public:
         return static_cast<std::size_t>(mPos - mBuf); // safe cast
     }
 
+    ArenaUpstream* upstream() const _ut_noexcept
+    {
+        return mUpstream;
+    }
+
+    /**
+     * Serve allocations that don't fit in the buffer from upstream, instead of
+     * failing. Pass nullptr to disable. Upstream must outlive the arena.
+     */
+    void setUpstream(ArenaUpstream *upstream) _ut_noexcept
+    {
+        mUpstream = upstream;
+    }
+
+    const ArenaStats& stats() const _ut_noexcept
+    {
+        return mStats;
+    }
+
+    /** Reset counters. Peak usage restarts from present value. */
+    void resetStats() _ut_noexcept
+    {
+        mStats.numAllocations = 0;
+        mStats.numFallbacks = 0;
+        mStats.numFailures = 0;
+        mStats.peakUsed = used();
+    }
+
 private:
     BufferArenaBase(const BufferArenaBase& other) = delete;
     BufferArenaBase& operator=(const BufferArenaBase& other) = delete;
@@ -160,8 +270,55 @@ protected:
         return mBuf <= pos && pos <= end();
     }
 
+    bool isInBuffer(const void *p) const _ut_noexcept
+    {
+        // std::less gives a total order, even for pointers outside the buffer.
+        std::less<const char*> less;
+        const char *pos = static_cast<const char*>(p); // safe cast
+
+        return !less(pos, mBuf) && less(pos, end());
+    }
+
+    // Call after carving a chunk from the buffer.
+    void notifyAllocated() _ut_noexcept
+    {
+        mStats.numAllocations++;
+
+        std::size_t usedSize = used();
+        if (usedSize > mStats.peakUsed)
+            mStats.peakUsed = usedSize;
+    }
+
+    // Call when a chunk doesn't fit in the buffer.
+    void* allocateFromUpstream(std::size_t size)
+    {
+        mStats.numAllocations++;
+
+        void *p = (mUpstream == nullptr) ? nullptr : mUpstream->allocate(size);
+
+        if (p == nullptr) {
+            mStats.numFailures++;
+            return detail::arena::allocationFailed();
+        }
+
+        mStats.numFallbacks++;
+        mStats.fallbackUsed += size;
+        return p;
+    }
+
+    void deallocateToUpstream(void *p, std::size_t size) _ut_noexcept
+    {
+        ut_assert(mUpstream != nullptr &&
+            "Pointer was not allocated from this arena");
+
+        mStats.fallbackUsed -= size;
+        mUpstream->deallocate(p, size);
+    }
+
     char *mBuf, *mPos;
     std::size_t mCapacity;
+    ArenaUpstream *mUpstream;
+    ArenaStats mStats;
 };
 
 class LinearBufferArena : public BufferArenaBase
@@ -188,18 +345,14 @@ private:
         ut_dcheck(isValidPos(mPos) &&
             "ArenaAlloc has outlived arena");
 
-        std::size_t chunkSize = (size + max_align_size - 1) / max_align_size * max_align_size;
+        std::size_t chunkSize = detail::arena::roundUp(size, max_align_size);
 
-        if (mPos + chunkSize > end()) {
-#ifdef UT_NO_EXCEPTIONS
-            return nullptr;
-#else
-            throw std::bad_alloc();
-#endif
-        }
+        if (chunkSize > static_cast<std::size_t>(end() - mPos)) // safe cast
+            return allocateFromUpstream(size);
 
         char *p = mPos;
         mPos += chunkSize;
+        notifyAllocated();
         return p;
     }
 
@@ -210,9 +363,14 @@ private:
 
         ut_dcheck(p != nullptr);
 
+        if (!isInBuffer(p)) {
+            deallocateToUpstream(p, size);
+            return;
+        }
+
         // Deallocate if this is the last chunk, otherwise do nothing.
 
-        std::size_t chunkSize = (size + max_align_size - 1) / max_align_size * max_align_size;
+        std::size_t chunkSize = detail::arena::roundUp(size, max_align_size);
 
         if (static_cast<char*>(p) + chunkSize == mPos) // safe cast
             mPos = static_cast<char*>(p); // safe cast
@@ -0,0 +1,272 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../impl/Common.h"
+#include "../impl/Assert.h"
+#include "Arena.h"
+#include "Cast.h"
+#include "TypeTraits.h"
+#include <new>
+
+namespace ut {
+
+//
+// ChainedBlockArena
+//
+
+/**
+ * Growable arena that bump-allocates from a chain of blocks. When the current
+ * block is full a new one is started, taken from the spare list or from
+ * operator new, so allocation only fails if operator new does. Requests that
+ * don't fit in a block get a dedicated block of their own.
+ *
+ * Each block counts its live chunks. Once they're all freed, the block gets
+ * reset and kept as a spare. Allocation and deallocation are O(1), apart from
+ * calls to operator new when the arena grows. Every chunk has a header of
+ * max_align_size bytes pointing to its block.
+ *
+ * All chunks must be freed before destroying the arena.
+ */
+class ChainedBlockArena
+{
+public:
+    static const std::size_t DEFAULT_BLOCK_SIZE = 4096;
+
+    explicit ChainedBlockArena(std::size_t blockSize = DEFAULT_BLOCK_SIZE) _ut_noexcept
+        : mBlockSize(detail::arena::roundUp(blockSize, max_align_size))
+        , mCurrent(nullptr)
+        , mBlocks(nullptr)
+        , mSpares(nullptr)
+        , mNumBlocks(0)
+        , mCapacity(0)
+        , mUsed(0)
+    {
+        ut_dcheck(mBlockSize > BLOCK_HEADER_SIZE + CHUNK_HEADER_SIZE &&
+            "Block size too small");
+    }
+
+    ~ChainedBlockArena() _ut_noexcept
+    {
+        ut_dcheck(mUsed == 0 &&
+            "Arena destroyed while chunks are still allocated");
+
+        while (mBlocks != nullptr) {
+            Block *block = mBlocks;
+            mBlocks = block->next;
+            ::operator delete(block);
+        }
+    }
+
+    std::size_t blockSize() const _ut_noexcept
+    {
+        return mBlockSize;
+    }
+
+    /** Blocks owned by the arena, including spares */
+    std::size_t numBlocks() const _ut_noexcept
+    {
+        return mNumBlocks;
+    }
+
+    /** Total size of owned blocks */
+    std::size_t capacity() const _ut_noexcept
+    {
+        return mCapacity;
+    }
+
+    /** Bytes taken by live chunks, including their headers */
+    std::size_t used() const _ut_noexcept
+    {
+        return mUsed;
+    }
+
+    /** Release spare blocks */
+    void trim() _ut_noexcept
+    {
+        while (mSpares != nullptr) {
+            Block *block = mSpares;
+            mSpares = block->nextSpare;
+            releaseBlock(block);
+        }
+    }
+
+    template <class T>
+    T* allocate(std::size_t n)
+    {
+        static_assert(std::alignment_of<T>::value <= max_align_size,
+            "Over-aligned types can't be allocated from arena");
+
+        return static_cast<T*>(allocateImpl(n * sizeof(T))); // safe cast
+    }
+
+    template <class T>
+    void deallocate(T* p, std::size_t n)
+    {
+        deallocateImpl(p, n * sizeof(T));
+    }
+
+private:
+    ChainedBlockArena(const ChainedBlockArena& other) = delete;
+    ChainedBlockArena& operator=(const ChainedBlockArena& other) = delete;
+
+    struct Block
+    {
+        Block *next;
+        Block *prev;
+        Block *nextSpare;
+        char *pos;
+        char *end;
+        std::size_t numLive;
+    };
+
+    struct ChunkHeader
+    {
+        Block *block;
+    };
+
+    static const std::size_t BLOCK_HEADER_SIZE = (sizeof(Block) + max_align_size - 1) /
+        max_align_size * max_align_size;
+    static const std::size_t CHUNK_HEADER_SIZE = max_align_size;
+
+    static char* firstChunk(Block *block) _ut_noexcept
+    {
+        return ptrCast<char*>(block) + BLOCK_HEADER_SIZE; // safe cast
+    }
+
+    static bool isDedicated(const Block *block, std::size_t blockSize) _ut_noexcept
+    {
+        return (std::size_t) (block->end - ptrCast<const char*>(block)) != blockSize; // safe cast
+    }
+
+    Block* newBlock(std::size_t size)
+    {
+#ifdef UT_NO_EXCEPTIONS
+        void *p = ::operator new(size, std::nothrow);
+        if (p == nullptr)
+            return nullptr;
+#else
+        void *p = ::operator new(size);
+#endif
+
+        Block *block = static_cast<Block*>(p); // safe cast
+        block->next = mBlocks;
+        block->prev = nullptr;
+        block->nextSpare = nullptr;
+        block->pos = firstChunk(block);
+        block->end = static_cast<char*>(p) + size; // safe cast
+        block->numLive = 0;
+
+        if (mBlocks != nullptr)
+            mBlocks->prev = block;
+        mBlocks = block;
+
+        mNumBlocks++;
+        mCapacity += size;
+        return block;
+    }
+
+    void releaseBlock(Block *block) _ut_noexcept
+    {
+        if (block->prev != nullptr)
+            block->prev->next = block->next;
+        else
+            mBlocks = block->next;
+
+        if (block->next != nullptr)
+            block->next->prev = block->prev;
+
+        mNumBlocks--;
+        mCapacity -= (std::size_t) (block->end - ptrCast<char*>(block)); // safe cast
+        ::operator delete(block);
+    }
+
+    void* allocateImpl(std::size_t size)
+    {
+        std::size_t chunkSize = CHUNK_HEADER_SIZE + detail::arena::roundUp(size, max_align_size);
+        Block *block = mCurrent;
+
+        if (block == nullptr || chunkSize > (std::size_t) (block->end - block->pos)) {
+            if (BLOCK_HEADER_SIZE + chunkSize > mBlockSize) {
+                block = newBlock(BLOCK_HEADER_SIZE + chunkSize);
+            } else if (mSpares != nullptr) {
+                block = mSpares;
+                mSpares = block->nextSpare;
+                block->nextSpare = nullptr;
+                mCurrent = block;
+            } else {
+                block = newBlock(mBlockSize);
+                if (block != nullptr)
+                    mCurrent = block;
+            }
+
+            if (block == nullptr)
+                return detail::arena::allocationFailed();
+        }
+
+        char *chunk = block->pos;
+        block->pos += chunkSize;
+        block->numLive++;
+        mUsed += chunkSize;
+
+        ptrCast<ChunkHeader*>(chunk)->block = block; // safe cast
+        return chunk + CHUNK_HEADER_SIZE;
+    }
+
+    void deallocateImpl(void *p, std::size_t size) _ut_noexcept
+    {
+        ut_dcheck(p != nullptr);
+
+        char *chunk = static_cast<char*>(p) - CHUNK_HEADER_SIZE; // safe cast
+        Block *block = ptrCast<ChunkHeader*>(chunk)->block; // safe cast
+
+        ut_dcheck(firstChunk(block) <= chunk && chunk < block->pos &&
+            "Pointer was not allocated from this arena");
+
+        std::size_t chunkSize = CHUNK_HEADER_SIZE + detail::arena::roundUp(size, max_align_size);
+        mUsed -= chunkSize;
+
+        // Reclaim the chunk right away if it's the last one.
+        if (chunk + chunkSize == block->pos)
+            block->pos = chunk;
+
+        ut_assert(block->numLive > 0);
+        if (--block->numLive > 0)
+            return;
+
+        block->pos = firstChunk(block);
+
+        if (block == mCurrent) {
+            // Keep bump-allocating from the start.
+        } else if (isDedicated(block, mBlockSize)) {
+            releaseBlock(block);
+        } else {
+            block->nextSpare = mSpares;
+            mSpares = block;
+        }
+    }
+
+    std::size_t mBlockSize;
+    Block *mCurrent;
+    Block *mBlocks;
+    Block *mSpares;
+    std::size_t mNumBlocks;
+    std::size_t mCapacity;
+    std::size_t mUsed;
+};
+
+}
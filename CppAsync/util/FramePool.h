@@ -0,0 +1,394 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../impl/Common.h"
+#include "../impl/Assert.h"
+#include "TypeTraits.h"
+#include <cstdint>
+#include <new>
+
+namespace ut {
+
+//
+// FramePoolStats
+//
+
+struct FramePoolStats
+{
+    /** Number of allocate() calls */
+    uint64_t numAllocations;
+
+    /** Allocations served from the free lists */
+    uint64_t numHits;
+
+    /** Allocations too large for pooling, forwarded to operator new */
+    uint64_t numOversized;
+
+    /** Pooled blocks handed out and not yet deallocated */
+    std::size_t numInUse;
+    std::size_t peakInUse;
+
+    /** Blocks kept in the free lists */
+    std::size_t numCached;
+    std::size_t peakCached;
+
+    /** Bytes kept in the free lists */
+    std::size_t bytesCached;
+
+    double hitRate() const _ut_noexcept
+    {
+        return numAllocations == 0 ? 0.0 : (double) numHits / numAllocations;
+    }
+};
+
+/** Occupancy of one size class */
+struct FrameSizeClassStats
+{
+    std::size_t blockSize;
+    std::size_t numInUse;
+    std::size_t numCached;
+};
+
+//
+// FramePool
+//
+
+/**
+ * Per-thread cache of memory blocks, segregated by size class. Meant for
+ * coroutine frames and other short-lived objects that get created over and
+ * over with the same few sizes. Once the pool has warmed up, allocation is
+ * a free list pop and doesn't depend on the global allocator.
+ *
+ * Block sizes go up in steps of 16 bytes until 128, then in four steps per
+ * power of two until MAX_POOLED_SIZE. Larger requests are forwarded to
+ * operator new. Each size class keeps at most highWaterMark() free blocks,
+ * any excess is returned to operator delete right away.
+ *
+ * Blocks come from operator new one by one, so they may be deallocated on
+ * another thread, ending up in that thread's pool. Blocks must be released
+ * before the pool of the deallocating thread is destroyed at thread exit.
+ */
+class FramePool
+{
+public:
+    static const std::size_t MAX_POOLED_SIZE = 4096;
+    static const std::size_t DEFAULT_HIGH_WATER_MARK = 1024;
+    static const int NUM_SIZE_CLASSES = 28;
+
+    /** Pool of the calling thread */
+    static FramePool& local() _ut_noexcept
+    {
+        _ut_thread_local_object(FramePool, sPool);
+        return sPool;
+    }
+
+    ~FramePool() _ut_noexcept
+    {
+        trim();
+    }
+
+    std::size_t highWaterMark() const _ut_noexcept
+    {
+        return mHighWaterMark;
+    }
+
+    /** Limit the number of free blocks kept per size class. Excess blocks are released. */
+    void setHighWaterMark(std::size_t value) _ut_noexcept
+    {
+        mHighWaterMark = value;
+
+        for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+            while (mSizeClasses[i].numFree > mHighWaterMark)
+                releaseBlock(i, mSizeClasses[i].pop());
+        }
+    }
+
+    /**
+     * Create free blocks in advance, up to count blocks of the class serving given
+     * size. Returns false if size is not pooled or if operator new failed.
+     */
+    bool reserve(std::size_t size, std::size_t count)
+    {
+        if (size > MAX_POOLED_SIZE)
+            return false;
+
+        int index = sizeClassIndex(size);
+        SizeClass& sizeClass = mSizeClasses[index];
+
+        while (sizeClass.numFree < count) {
+            void *p = newBlock(sizeClassSize(index));
+            if (p == nullptr)
+                return false;
+
+            cacheBlock(index, p);
+        }
+
+        return true;
+    }
+
+    /** Release all free blocks */
+    void trim() _ut_noexcept
+    {
+        for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+            while (mSizeClasses[i].numFree > 0)
+                releaseBlock(i, mSizeClasses[i].pop());
+        }
+    }
+
+    const FramePoolStats& stats() const _ut_noexcept
+    {
+        return mStats;
+    }
+
+    FrameSizeClassStats sizeClassStats(int index) const _ut_noexcept
+    {
+        ut_assert(0 <= index && index < NUM_SIZE_CLASSES);
+
+        FrameSizeClassStats result;
+        result.blockSize = sizeClassSize(index);
+        result.numInUse = mSizeClasses[index].numInUse;
+        result.numCached = mSizeClasses[index].numFree;
+        return result;
+    }
+
+    /** Reset counters. Current and peak usage restart from present values. */
+    void resetStats() _ut_noexcept
+    {
+        mStats.numAllocations = 0;
+        mStats.numHits = 0;
+        mStats.numOversized = 0;
+        mStats.peakInUse = mStats.numInUse;
+        mStats.peakCached = mStats.numCached;
+    }
+
+    /** Throws std::bad_alloc on failure, or returns nullptr if UT_NO_EXCEPTIONS is defined */
+    void* allocate(std::size_t size)
+    {
+        mStats.numAllocations++;
+
+        if (size > MAX_POOLED_SIZE) {
+            mStats.numOversized++;
+            return newBlock(size);
+        }
+
+        int index = sizeClassIndex(size);
+        SizeClass& sizeClass = mSizeClasses[index];
+
+        void *p;
+        if (sizeClass.numFree > 0) {
+            p = sizeClass.pop();
+            mStats.numHits++;
+            mStats.numCached--;
+            mStats.bytesCached -= sizeClassSize(index);
+        } else {
+            p = newBlock(sizeClassSize(index));
+            if (p == nullptr)
+                return nullptr;
+        }
+
+        sizeClass.numInUse++;
+        if (++mStats.numInUse > mStats.peakInUse)
+            mStats.peakInUse = mStats.numInUse;
+
+        return p;
+    }
+
+    /** Size must match the one passed to allocate() */
+    void deallocate(void *p, std::size_t size) _ut_noexcept
+    {
+        ut_assert(p != nullptr);
+
+        if (size > MAX_POOLED_SIZE) {
+            ::operator delete(p);
+            return;
+        }
+
+        int index = sizeClassIndex(size);
+        SizeClass& sizeClass = mSizeClasses[index];
+
+        // Counters may be off for blocks allocated on other threads.
+        if (sizeClass.numInUse > 0)
+            sizeClass.numInUse--;
+        if (mStats.numInUse > 0)
+            mStats.numInUse--;
+
+        if (sizeClass.numFree < mHighWaterMark)
+            cacheBlock(index, p);
+        else
+            ::operator delete(p);
+    }
+
+    /** Index of the size class serving given size, which must not exceed MAX_POOLED_SIZE */
+    static int sizeClassIndex(std::size_t size) _ut_noexcept
+    {
+        ut_assert(size <= MAX_POOLED_SIZE);
+
+        if (size <= 128)
+            return size == 0 ? 0 : (int) ((size - 1) / 16); // safe cast
+
+        // Four classes per power of two: (4..7) << (log2 - 2)
+        int log2 = 7;
+        while (((size - 1) >> (log2 + 1)) != 0)
+            log2++;
+
+        return 8 + (log2 - 7) * 4 + (int) ((size - 1) >> (log2 - 2)) - 4; // safe cast
+    }
+
+    /** Block size of a size class */
+    static std::size_t sizeClassSize(int index) _ut_noexcept
+    {
+        ut_assert(0 <= index && index < NUM_SIZE_CLASSES);
+
+        if (index < 8)
+            return (std::size_t) (index + 1) * 16;
+
+        int log2 = 7 + (index - 8) / 4;
+        return (std::size_t) (5 + (index - 8) % 4) << (log2 - 2);
+    }
+
+private:
+    FramePool() _ut_noexcept
+        : mHighWaterMark(DEFAULT_HIGH_WATER_MARK)
+        , mStats()
+        , mSizeClasses() { }
+
+    FramePool(const FramePool& other) = delete;
+    FramePool& operator=(const FramePool& other) = delete;
+
+    // Free blocks are linked through a node at their start.
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    struct SizeClass
+    {
+        FreeNode *head;
+        std::size_t numFree;
+        std::size_t numInUse;
+
+        void push(void *p) _ut_noexcept
+        {
+            FreeNode *node = static_cast<FreeNode*>(p); // safe cast
+            node->next = head;
+            head = node;
+            numFree++;
+        }
+
+        void* pop() _ut_noexcept
+        {
+            ut_assert(numFree > 0);
+
+            FreeNode *node = head;
+            head = node->next;
+            numFree--;
+
+            return node;
+        }
+    };
+
+    static void* newBlock(std::size_t size)
+    {
+#ifdef UT_NO_EXCEPTIONS
+        return ::operator new(size, std::nothrow);
+#else
+        return ::operator new(size);
+#endif
+    }
+
+    void cacheBlock(int index, void *p) _ut_noexcept
+    {
+        mSizeClasses[index].push(p);
+
+        mStats.bytesCached += sizeClassSize(index);
+        if (++mStats.numCached > mStats.peakCached)
+            mStats.peakCached = mStats.numCached;
+    }
+
+    void releaseBlock(int index, void *p) _ut_noexcept
+    {
+        mStats.numCached--;
+        mStats.bytesCached -= sizeClassSize(index);
+
+        ::operator delete(p);
+    }
+
+    std::size_t mHighWaterMark;
+    FramePoolStats mStats;
+    SizeClass mSizeClasses[NUM_SIZE_CLASSES];
+};
+
+//
+// FramePoolAlloc
+//
+
+/**
+ * Stateless allocator backed by FramePool::local(). Can be passed to
+ * startAsyncOf() and startAsync() to recycle coroutine frames.
+ */
+template <class T = char>
+class FramePoolAlloc
+{
+public:
+    using value_type = T;
+
+    FramePoolAlloc() = default;
+
+    template <class U>
+    FramePoolAlloc(const FramePoolAlloc<U>& /* other */) _ut_noexcept { }
+
+    T* allocate(std::size_t n)
+    {
+        static_assert(std::alignment_of<T>::value <= max_align_size,
+            "Over-aligned types can't be allocated from FramePool");
+
+        return static_cast<T*>(FramePool::local().allocate(n * sizeof(T))); // safe cast
+    }
+
+    void deallocate(T *p, std::size_t n) _ut_noexcept
+    {
+        FramePool::local().deallocate(p, n * sizeof(T));
+    }
+
+    using pointer = value_type*; // MSVC 12.0/14.0 workaround for shared_ptr
+
+    template <class U> // MSVC 12.0 workaround for shared_ptr
+    struct rebind
+    {
+        using other = FramePoolAlloc<U>;
+    };
+
+    void destroy(T *p) _ut_noexcept // MSVC 12.0 workaround for shared_ptr
+    {
+        p->~T();
+    }
+};
+
+template <class T, class U>
+bool operator==(const FramePoolAlloc<T>& /* a */, const FramePoolAlloc<U>& /* b */) _ut_noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const FramePoolAlloc<T>& /* a */, const FramePoolAlloc<U>& /* b */) _ut_noexcept
+{
+    return false;
+}
+
+}
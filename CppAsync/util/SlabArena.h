@@ -0,0 +1,176 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../impl/Common.h"
+#include "../impl/Assert.h"
+#include "Arena.h"
+#include "Cast.h"
+#include "TypeTraits.h"
+
+namespace ut {
+
+//
+// SlabBufferArena
+//
+
+/**
+ * Arena of equally sized blocks carved from a buffer. Allocation and
+ * deallocation are O(1) and any block can be freed in any order, making it a
+ * good fit for objects of a single type, such as coroutine frames of one kind.
+ * Requests larger than blockSize() fail.
+ *
+ * Blocks are carved on demand, so constructing the arena doesn't touch the
+ * buffer.
+ */
+class SlabBufferArena
+{
+public:
+    SlabBufferArena(char *buf, std::size_t capacity, std::size_t blockSize) _ut_noexcept
+        : mBuf(buf)
+        , mBlockSize(detail::arena::roundUp(
+            blockSize < sizeof(FreeNode) ? sizeof(FreeNode) : blockSize, max_align_size))
+        , mNumBlocks(capacity / mBlockSize)
+        , mNumCarved(0)
+        , mNumUsed(0)
+        , mFreeList(nullptr)
+    {
+        ut_dcheck(reinterpret_cast<uintptr_t>(buf) % max_align_size == 0 &&
+            "Buffer should have max alignment");
+
+        ut_dcheck(mNumBlocks > 0 &&
+            "Capacity should fit at least one block");
+    }
+
+    std::size_t blockSize() const _ut_noexcept
+    {
+        return mBlockSize;
+    }
+
+    std::size_t numBlocks() const _ut_noexcept
+    {
+        return mNumBlocks;
+    }
+
+    std::size_t numUsed() const _ut_noexcept
+    {
+        return mNumUsed;
+    }
+
+    std::size_t capacity() const _ut_noexcept
+    {
+        return mNumBlocks * mBlockSize;
+    }
+
+    std::size_t used() const _ut_noexcept
+    {
+        return mNumUsed * mBlockSize;
+    }
+
+    template <class T>
+    T* allocate(std::size_t n)
+    {
+        static_assert(std::alignment_of<T>::value <= max_align_size,
+            "Over-aligned types can't be allocated from arena");
+
+        return static_cast<T*>(allocateImpl(n * sizeof(T))); // safe cast
+    }
+
+    template <class T>
+    void deallocate(T* p, std::size_t n)
+    {
+        deallocateImpl(p, n * sizeof(T));
+    }
+
+private:
+    SlabBufferArena(const SlabBufferArena& other) = delete;
+    SlabBufferArena& operator=(const SlabBufferArena& other) = delete;
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    void* allocateImpl(std::size_t size)
+    {
+        if (size > mBlockSize)
+            return detail::arena::allocationFailed();
+
+        void *p;
+        if (mFreeList != nullptr) {
+            p = mFreeList;
+            mFreeList = mFreeList->next;
+        } else if (mNumCarved < mNumBlocks) {
+            p = mBuf + mNumCarved * mBlockSize;
+            mNumCarved++;
+        } else {
+            return detail::arena::allocationFailed();
+        }
+
+        mNumUsed++;
+        return p;
+    }
+
+    void deallocateImpl(void *p, std::size_t size) _ut_noexcept
+    {
+        ut_dcheck(p != nullptr);
+
+        char *block = static_cast<char*>(p); // safe cast
+
+        ut_dcheck(mBuf <= block && block < mBuf + mNumCarved * mBlockSize
+            && (std::size_t) (block - mBuf) % mBlockSize == 0 &&
+            "Pointer was not allocated from this arena");
+
+        ut_dcheck(size <= mBlockSize);
+        (void) size;
+
+        FreeNode *node = ptrCast<FreeNode*>(block); // safe cast
+        node->next = mFreeList;
+        mFreeList = node;
+
+        mNumUsed--;
+    }
+
+    char *mBuf;
+    std::size_t mBlockSize;
+    std::size_t mNumBlocks;
+    std::size_t mNumCarved;
+    std::size_t mNumUsed;
+    FreeNode *mFreeList;
+};
+
+//
+// SlabStackArena
+//
+
+template <std::size_t BlockSize, std::size_t NumBlocks>
+class SlabStackArena : public SlabBufferArena
+{
+public:
+    static const std::size_t block_size = (BlockSize + max_align_size - 1) /
+        max_align_size * max_align_size; // round up
+
+    SlabStackArena() _ut_noexcept
+        : SlabBufferArena(
+            ptrCast<char*>(&mStorage), // safe cast
+            block_size * NumBlocks, block_size) { }
+
+private:
+    MaxAlignedStorage<block_size * NumBlocks> mStorage;
+};
+
+}
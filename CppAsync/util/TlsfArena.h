@@ -0,0 +1,417 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../impl/Common.h"
+#include "../impl/Assert.h"
+#include "Arena.h"
+#include "Cast.h"
+#include "TypeTraits.h"
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace ut {
+
+namespace detail
+{
+    namespace arena
+    {
+        template <std::size_t N>
+        struct Log2
+        {
+            static const int value = 1 + Log2<N / 2>::value;
+        };
+
+        template <>
+        struct Log2<1>
+        {
+            static const int value = 0;
+        };
+
+        // Index of lowest set bit, word must not be 0
+        inline int findFirstSet(uint32_t word) _ut_noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_ctz(word);
+#elif defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, word);
+            return (int) index;
+#else
+            int index = 0;
+            while ((word & 1) == 0) {
+                word >>= 1;
+                index++;
+            }
+            return index;
+#endif
+        }
+
+        // Index of highest set bit, word must not be 0
+        inline int findLastSet(uint32_t word) _ut_noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return 31 - __builtin_clz(word);
+#elif defined(_MSC_VER)
+            unsigned long index;
+            _BitScanReverse(&index, word);
+            return (int) index;
+#else
+            int index = 31;
+            while ((word & 0x80000000u) == 0) {
+                word <<= 1;
+                index--;
+            }
+            return index;
+#endif
+        }
+    }
+}
+
+//
+// TlsfBufferArena
+//
+
+/**
+ * General purpose arena based on Two-Level Segregated Fit (TLSF). Allocation
+ * and deallocation take O(1) time for any size and order. Freed blocks are
+ * merged with free neighbors, so interleaved allocations don't leak space.
+ *
+ * Free blocks are kept in lists indexed by size class: the first level splits
+ * sizes by powers of two, the second level splits each power of two into 16
+ * ranges. A good fit is found with two bitmap scans. Each block carries a
+ * header of two words, rounded up to max alignment. Capacity is limited to 2GB.
+ */
+class TlsfBufferArena
+{
+public:
+    TlsfBufferArena(char *buf, std::size_t capacity) _ut_noexcept
+        : mBuf(buf)
+        , mCapacity(capacity)
+        , mUsed(0)
+        , mFlBitmap(0)
+    {
+        ut_dcheck(reinterpret_cast<uintptr_t>(buf) % max_align_size == 0 &&
+            "Buffer should have max alignment");
+
+        if (!(capacity % max_align_size == 0 &&
+                capacity >= MIN_CAPACITY &&
+                capacity - HEADER_SIZE < MAX_PAYLOAD_SIZE)) {
+            ut_dcheckf(false, "Capacity should be a multiple of max alignment, "
+                "between %d bytes and 2GB", static_cast<int>(MIN_CAPACITY)); // safe cast
+        }
+
+        for (int i = 0; i < FL_COUNT; i++) {
+            mSlBitmaps[i] = 0;
+
+            for (int j = 0; j < SL_COUNT; j++)
+                mFreeHeads[i][j] = nullptr;
+        }
+
+        // One free block spanning the buffer, followed by a used sentinel that
+        // stops merging at the end.
+        Block *block = ptrCast<Block*>(buf); // safe cast
+        block->prevPhys = nullptr;
+        block->sizeAndFlags = (capacity - 2 * HEADER_SIZE) | FREE_BIT;
+
+        Block *sentinel = nextPhys(block);
+        sentinel->prevPhys = block;
+        sentinel->sizeAndFlags = PREV_FREE_BIT;
+
+        insertFree(block);
+    }
+
+    std::size_t capacity() const _ut_noexcept
+    {
+        return mCapacity;
+    }
+
+    /** Bytes taken by allocated blocks, including their headers */
+    std::size_t used() const _ut_noexcept
+    {
+        return mUsed;
+    }
+
+    template <class T>
+    T* allocate(std::size_t n)
+    {
+        static_assert(std::alignment_of<T>::value <= max_align_size,
+            "Over-aligned types can't be allocated from arena");
+
+        return static_cast<T*>(allocateImpl(n * sizeof(T))); // safe cast
+    }
+
+    template <class T>
+    void deallocate(T* p, std::size_t n)
+    {
+        deallocateImpl(p, n * sizeof(T));
+    }
+
+private:
+    TlsfBufferArena(const TlsfBufferArena& other) = delete;
+    TlsfBufferArena& operator=(const TlsfBufferArena& other) = delete;
+
+    struct Block
+    {
+        // Physical neighbor at lower address, valid if PREV_FREE_BIT is set
+        Block *prevPhys;
+
+        // Payload size, a multiple of max alignment, combined with flags
+        std::size_t sizeAndFlags;
+
+        // Free list links, overlapping the payload of free blocks
+        Block *nextFree;
+        Block *prevFree;
+    };
+
+    static const std::size_t FREE_BIT = 1;
+    static const std::size_t PREV_FREE_BIT = 2;
+    static const std::size_t FLAG_MASK = FREE_BIT | PREV_FREE_BIT;
+
+    static const std::size_t HEADER_SIZE = (2 * ptr_size + max_align_size - 1) /
+        max_align_size * max_align_size;
+    static const std::size_t MIN_PAYLOAD_SIZE = HEADER_SIZE;
+
+    static const int SL_SHIFT = 4;
+    static const int SL_COUNT = 1 << SL_SHIFT;
+    static const int FL_INDEX_SHIFT = SL_SHIFT + detail::arena::Log2<max_align_size>::value;
+    static const int FL_INDEX_MAX = 31;
+    static const int FL_COUNT = FL_INDEX_MAX - FL_INDEX_SHIFT + 2;
+
+    // Sizes below are binned linearly into first level 0.
+    static const std::size_t SMALL_BLOCK_SIZE = (std::size_t) 1 << FL_INDEX_SHIFT;
+    static const std::size_t MAX_PAYLOAD_SIZE = (std::size_t) 1 << FL_INDEX_MAX;
+
+    // One free block and the sentinel header that ends the buffer.
+    static const std::size_t MIN_CAPACITY = 2 * HEADER_SIZE + MIN_PAYLOAD_SIZE;
+
+    static_assert(max_align_size >= 4,
+        "Flags are kept in the low bits of block sizes");
+
+    static std::size_t sizeOf(const Block *block) _ut_noexcept
+    {
+        return block->sizeAndFlags & ~FLAG_MASK;
+    }
+
+    static char* payloadOf(Block *block) _ut_noexcept
+    {
+        return ptrCast<char*>(block) + HEADER_SIZE; // safe cast
+    }
+
+    static Block* blockOf(void *payload) _ut_noexcept
+    {
+        return ptrCast<Block*>(static_cast<char*>(payload) - HEADER_SIZE); // safe cast
+    }
+
+    static Block* nextPhys(Block *block) _ut_noexcept
+    {
+        return ptrCast<Block*>(payloadOf(block) + sizeOf(block)); // safe cast
+    }
+
+    static void mapping(std::size_t size, int& fl, int& sl) _ut_noexcept
+    {
+        if (size < SMALL_BLOCK_SIZE) {
+            fl = 0;
+            sl = (int) (size / (SMALL_BLOCK_SIZE / SL_COUNT)); // safe cast
+        } else {
+            int log2 = detail::arena::findLastSet((uint32_t) size); // safe cast, size < 2GB
+            sl = (int) (size >> (log2 - SL_SHIFT)) ^ SL_COUNT; // safe cast
+            fl = log2 - FL_INDEX_SHIFT + 1;
+        }
+    }
+
+    // Round size up to the next list boundary, so that any block found in
+    // the mapped list is large enough.
+    static void mappingSearch(std::size_t size, int& fl, int& sl) _ut_noexcept
+    {
+        if (size >= SMALL_BLOCK_SIZE) {
+            int log2 = detail::arena::findLastSet((uint32_t) size); // safe cast, size < 2GB
+            size += ((std::size_t) 1 << (log2 - SL_SHIFT)) - 1;
+        }
+
+        mapping(size, fl, sl);
+    }
+
+    Block* findSuitable(int& fl, int& sl) _ut_noexcept
+    {
+        uint32_t slMap = mSlBitmaps[fl] & (~0u << sl);
+
+        if (slMap == 0) {
+            uint32_t flMap = (fl + 1 < 32) ? mFlBitmap & (~0u << (fl + 1)) : 0;
+            if (flMap == 0)
+                return nullptr;
+
+            fl = detail::arena::findFirstSet(flMap);
+            slMap = mSlBitmaps[fl];
+        }
+
+        sl = detail::arena::findFirstSet(slMap);
+        return mFreeHeads[fl][sl];
+    }
+
+    void insertFree(Block *block) _ut_noexcept
+    {
+        int fl, sl;
+        mapping(sizeOf(block), fl, sl);
+
+        Block *head = mFreeHeads[fl][sl];
+        block->nextFree = head;
+        block->prevFree = nullptr;
+        if (head != nullptr)
+            head->prevFree = block;
+
+        mFreeHeads[fl][sl] = block;
+        mFlBitmap |= 1u << fl;
+        mSlBitmaps[fl] |= 1u << sl;
+    }
+
+    void removeFree(Block *block) _ut_noexcept
+    {
+        int fl, sl;
+        mapping(sizeOf(block), fl, sl);
+
+        removeFree(block, fl, sl);
+    }
+
+    void removeFree(Block *block, int fl, int sl) _ut_noexcept
+    {
+        if (block->prevFree != nullptr)
+            block->prevFree->nextFree = block->nextFree;
+        else
+            mFreeHeads[fl][sl] = block->nextFree;
+
+        if (block->nextFree != nullptr)
+            block->nextFree->prevFree = block->prevFree;
+
+        if (mFreeHeads[fl][sl] == nullptr) {
+            mSlBitmaps[fl] &= ~(1u << sl);
+            if (mSlBitmaps[fl] == 0)
+                mFlBitmap &= ~(1u << fl);
+        }
+    }
+
+    void* allocateImpl(std::size_t size)
+    {
+        if (size >= MAX_PAYLOAD_SIZE)
+            return detail::arena::allocationFailed();
+
+        std::size_t payloadSize = detail::arena::roundUp(size, max_align_size);
+        if (payloadSize < MIN_PAYLOAD_SIZE)
+            payloadSize = MIN_PAYLOAD_SIZE;
+
+        int fl, sl;
+        mappingSearch(payloadSize, fl, sl);
+
+        Block *block = (fl < FL_COUNT) ? findSuitable(fl, sl) : nullptr;
+        if (block == nullptr)
+            return detail::arena::allocationFailed();
+
+        removeFree(block, fl, sl);
+
+        std::size_t blockSize = sizeOf(block);
+        Block *next = nextPhys(block);
+
+        if (blockSize >= payloadSize + HEADER_SIZE + MIN_PAYLOAD_SIZE) {
+            // Split off the tail as a new free block.
+            block->sizeAndFlags = payloadSize | (block->sizeAndFlags & PREV_FREE_BIT);
+
+            Block *rest = nextPhys(block);
+            rest->prevPhys = block;
+            rest->sizeAndFlags = (blockSize - payloadSize - HEADER_SIZE) | FREE_BIT;
+            next->prevPhys = rest;
+
+            insertFree(rest);
+        } else {
+            block->sizeAndFlags &= ~FREE_BIT;
+            next->sizeAndFlags &= ~PREV_FREE_BIT;
+        }
+
+        mUsed += HEADER_SIZE + sizeOf(block);
+        return payloadOf(block);
+    }
+
+    void deallocateImpl(void *p, std::size_t size) _ut_noexcept
+    {
+        ut_dcheck(p != nullptr);
+
+        Block *block = blockOf(p);
+
+        ut_dcheck(mBuf <= ptrCast<char*>(block) // safe cast
+            && ptrCast<char*>(block) < mBuf + mCapacity - HEADER_SIZE && // safe cast
+            "Pointer was not allocated from this arena");
+
+        ut_dcheck((block->sizeAndFlags & FREE_BIT) == 0 &&
+            "Block already deallocated");
+
+        ut_dcheck(size <= sizeOf(block));
+        (void) size;
+
+        mUsed -= HEADER_SIZE + sizeOf(block);
+
+        if (block->sizeAndFlags & PREV_FREE_BIT) {
+            Block *prev = block->prevPhys;
+            removeFree(prev);
+            prev->sizeAndFlags += HEADER_SIZE + sizeOf(block);
+            block = prev;
+        }
+
+        Block *next = nextPhys(block);
+        if (next->sizeAndFlags & FREE_BIT) {
+            removeFree(next);
+            block->sizeAndFlags += HEADER_SIZE + sizeOf(next);
+            next = nextPhys(block);
+        }
+
+        block->sizeAndFlags |= FREE_BIT;
+        next->prevPhys = block;
+        next->sizeAndFlags |= PREV_FREE_BIT;
+
+        insertFree(block);
+    }
+
+    char *mBuf;
+    std::size_t mCapacity;
+    std::size_t mUsed;
+    uint32_t mFlBitmap;
+    uint32_t mSlBitmaps[FL_COUNT];
+    Block *mFreeHeads[FL_COUNT][SL_COUNT];
+};
+
+//
+// TlsfStackArena
+//
+
+template <std::size_t N>
+class TlsfStackArena : public TlsfBufferArena
+{
+public:
+    static const std::size_t buffer_capacity = (N + max_align_size - 1) /
+        max_align_size * max_align_size; // round up
+
+    TlsfStackArena() _ut_noexcept
+        : TlsfBufferArena(
+            ptrCast<char*>(&mStorage), // safe cast
+            buffer_capacity) { }
+
+private:
+    MaxAlignedStorage<buffer_capacity> mStorage;
+};
+
+}
@@ -0,0 +1,368 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../impl/Common.h"
+#include "../impl/Assert.h"
+#include "TypeTraits.h"
+#include <functional>
+#include <new>
+
+namespace ut {
+
+namespace detail
+{
+    namespace function
+    {
+        // Dispatch table shared by all functions wrapping the same closure type.
+        // Plain function pointers instead of a vtable, so there is no virtual
+        // header taking up buffer space and nothing depends on RTTI.
+        template <class R, class ...Args>
+        struct Ops
+        {
+            R (*invoke)(void *data, Args&&... args);
+            void (*relocate)(void *from, void *to) _ut_noexcept;
+            void (*destroy)(void *data) _ut_noexcept;
+        };
+
+        // Closures are kept inline only if they can be relocated without throwing,
+        // otherwise moving the function itself could throw.
+        template <class F, std::size_t Capacity>
+        struct IsStoredInline : BoolConstant<
+            sizeof(F) <= Capacity
+            && std::alignment_of<F>::value <= align_of_ptr
+            && std::is_nothrow_move_constructible<F>::value> { };
+
+        // Checks if an lvalue of F can be called with Args, and if the result
+        // converts to R. Any result is accepted when R is void.
+        template <class F, class R, class ...Args>
+        class IsCallable
+        {
+            template <class U> static auto test(std::nullptr_t)
+                -> BoolConstant<IsVoid<R>::value || std::is_convertible<
+                    decltype(std::declval<U&>()(std::declval<Args>()...)), R>::value>;
+            template <class U> static std::false_type test(...);
+
+        public:
+            using type = decltype(test<F>(nullptr));
+            static const bool value = type::value;
+        };
+
+        // Wrapping an empty nullable callable makes an empty function.
+        template <class F>
+        bool isEmpty(const F& /* f */) _ut_noexcept
+        {
+            return false;
+        }
+
+        template <class Signature>
+        bool isEmpty(const std::function<Signature>& f) _ut_noexcept
+        {
+            return !f;
+        }
+
+        template <class R, class ...Args>
+        bool isEmpty(R (*f)(Args...)) _ut_noexcept
+        {
+            return f == nullptr;
+        }
+
+        template <class F, class R, class ...Args>
+        struct InlineOps
+        {
+            static F& get(void *data) _ut_noexcept
+            {
+                return *static_cast<F*>(data); // safe cast
+            }
+
+            template <class U = R, EnableIfVoid<U> = nullptr>
+            static void invoke(void *data, Args&&... args)
+            {
+                get(data)(std::forward<Args>(args)...);
+            }
+
+            template <class U = R, DisableIfVoid<U> = nullptr>
+            static R invoke(void *data, Args&&... args)
+            {
+                return get(data)(std::forward<Args>(args)...);
+            }
+
+            static void relocate(void *from, void *to) _ut_noexcept
+            {
+                new (to) F(std::move(get(from)));
+                get(from).~F();
+            }
+
+            static void destroy(void *data) _ut_noexcept
+            {
+                get(data).~F();
+            }
+
+            static const Ops<R, Args...> table;
+        };
+
+        template <class F, class R, class ...Args>
+        const Ops<R, Args...> InlineOps<F, R, Args...>::table = {
+            &InlineOps::invoke, &InlineOps::relocate, &InlineOps::destroy
+        };
+
+        template <class F, class R, class ...Args>
+        struct HeapOps
+        {
+            static F*& get(void *data) _ut_noexcept
+            {
+                return *static_cast<F**>(data); // safe cast
+            }
+
+            template <class U = R, EnableIfVoid<U> = nullptr>
+            static void invoke(void *data, Args&&... args)
+            {
+                (*get(data))(std::forward<Args>(args)...);
+            }
+
+            template <class U = R, DisableIfVoid<U> = nullptr>
+            static R invoke(void *data, Args&&... args)
+            {
+                return (*get(data))(std::forward<Args>(args)...);
+            }
+
+            static void relocate(void *from, void *to) _ut_noexcept
+            {
+                new (to) F*(get(from));
+            }
+
+            static void destroy(void *data) _ut_noexcept
+            {
+                delete get(data);
+            }
+
+            static const Ops<R, Args...> table;
+        };
+
+        template <class F, class R, class ...Args>
+        const Ops<R, Args...> HeapOps<F, R, Args...>::table = {
+            &HeapOps::invoke, &HeapOps::relocate, &HeapOps::destroy
+        };
+    }
+}
+
+//
+// UniqueFunction
+//
+
+/** Default inline capacity. Together with the dispatch pointer it fills a 64 byte cache line */
+static const std::size_t default_function_capacity = 7 * ptr_size;
+
+template <class Signature, std::size_t Capacity = default_function_capacity>
+class UniqueFunction;
+
+/**
+ * Move-only type-erased callable with small object optimization.
+ *
+ * Closures up to Capacity bytes that are nothrow move constructible and at most
+ * pointer aligned are stored inline, others are moved to the heap. Unlike
+ * std::function, the wrapped closure doesn't need to be copyable, so it may
+ * capture promises, tasks and other move-only types.
+ *
+ * Only closures callable with Args, returning something convertible to R,
+ * take part in overload resolution. Functions are stored as function pointers,
+ * so their signature may differ from the wrapper's, as with std::function.
+ *
+ * Doesn't depend on RTTI. Calling an empty function is undefined behavior.
+ */
+template <class R, class ...Args, std::size_t Capacity>
+class UniqueFunction<R (Args...), Capacity>
+{
+public:
+    static const std::size_t capacity = Capacity;
+
+    static_assert(Capacity >= sizeof(void *),
+        "Capacity must fit at least a pointer");
+
+    /** Check if closure type F gets stored without allocating */
+    template <class F>
+    struct IsInline : detail::function::IsStoredInline<
+        typename std::decay<F>::type, Capacity> { };
+
+    UniqueFunction() _ut_noexcept
+        : mOps(nullptr) { }
+
+    UniqueFunction(std::nullptr_t) _ut_noexcept
+        : mOps(nullptr) { }
+
+    UniqueFunction(R (*f)(Args...)) _ut_noexcept
+        : mOps(nullptr)
+    {
+        // Null function pointers make an empty function, as with std::function.
+        if (f != nullptr)
+            emplace(f);
+    }
+
+    template <class F, EnableIf<
+        !std::is_same<Unqualified<F>, UniqueFunction>::value
+        && detail::function::IsCallable<typename std::decay<F>::type, R, Args...>::value> = nullptr>
+    UniqueFunction(F&& f)
+        : mOps(nullptr)
+    {
+        // Empty std::function objects make an empty function too.
+        if (!detail::function::isEmpty(f))
+            emplace(std::forward<F>(f));
+    }
+
+    UniqueFunction(UniqueFunction&& other) _ut_noexcept
+        : mOps(other.mOps)
+    {
+        if (mOps != nullptr) {
+            mOps->relocate(&other.mData, &mData);
+            other.mOps = nullptr;
+        }
+    }
+
+    UniqueFunction& operator=(UniqueFunction&& other) _ut_noexcept
+    {
+        ut_assert(this != &other);
+
+        reset();
+
+        if (other.mOps != nullptr) {
+            other.mOps->relocate(&other.mData, &mData);
+            mOps = other.mOps;
+            other.mOps = nullptr;
+        }
+
+        return *this;
+    }
+
+    UniqueFunction& operator=(std::nullptr_t) _ut_noexcept
+    {
+        reset();
+
+        return *this;
+    }
+
+    template <class F, EnableIf<
+        !std::is_same<Unqualified<F>, UniqueFunction>::value
+        && detail::function::IsCallable<typename std::decay<F>::type, R, Args...>::value> = nullptr>
+    UniqueFunction& operator=(F&& f)
+    {
+        // Construct first, in case the closure owns this function.
+        UniqueFunction tmp(std::forward<F>(f));
+        *this = std::move(tmp);
+
+        return *this;
+    }
+
+    ~UniqueFunction() _ut_noexcept
+    {
+        reset();
+    }
+
+    void reset() _ut_noexcept
+    {
+        if (mOps != nullptr) {
+            const ops_type *ops = mOps;
+            mOps = nullptr;
+
+            ops->destroy(&mData);
+        }
+    }
+
+    void swap(UniqueFunction& other) _ut_noexcept
+    {
+        if (this == &other)
+            return;
+
+        UniqueFunction tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    explicit operator bool() const _ut_noexcept
+    {
+        return mOps != nullptr;
+    }
+
+    R operator()(Args... args)
+    {
+        ut_dcheck(mOps != nullptr &&
+            "Trying to call a nil function");
+
+        return mOps->invoke(&mData, std::forward<Args>(args)...);
+    }
+
+private:
+    UniqueFunction(const UniqueFunction& other) = delete;
+    UniqueFunction& operator=(const UniqueFunction& other) = delete;
+
+    using ops_type = detail::function::Ops<R, Args...>;
+
+    template <class F, EnableIf<
+        detail::function::IsStoredInline<typename std::decay<F>::type, Capacity>::value> = nullptr>
+    void emplace(F&& f)
+    {
+        using f_type = typename std::decay<F>::type;
+
+        new (&mData) f_type(std::forward<F>(f));
+        mOps = &detail::function::InlineOps<f_type, R, Args...>::table;
+    }
+
+    template <class F, EnableIf<
+        !detail::function::IsStoredInline<typename std::decay<F>::type, Capacity>::value> = nullptr>
+    void emplace(F&& f)
+    {
+        using f_type = typename std::decay<F>::type;
+
+        new (&mData) f_type*(new f_type(std::forward<F>(f)));
+        mOps = &detail::function::HeapOps<f_type, R, Args...>::table;
+    }
+
+    const ops_type *mOps;
+    AlignedStorage<Capacity, align_of_ptr> mData;
+};
+
+template <class Signature, std::size_t Capacity>
+void swap(UniqueFunction<Signature, Capacity>& a,
+    UniqueFunction<Signature, Capacity>& b) _ut_noexcept
+{
+    a.swap(b);
+}
+
+template <class Signature, std::size_t Capacity>
+bool operator==(const UniqueFunction<Signature, Capacity>& a, std::nullptr_t) _ut_noexcept
+{
+    return !a;
+}
+
+template <class Signature, std::size_t Capacity>
+bool operator!=(const UniqueFunction<Signature, Capacity>& a, std::nullptr_t) _ut_noexcept
+{
+    return (bool) a;
+}
+
+template <class Signature, std::size_t Capacity>
+bool operator==(std::nullptr_t, const UniqueFunction<Signature, Capacity>& a) _ut_noexcept
+{
+    return !a;
+}
+
+template <class Signature, std::size_t Capacity>
+bool operator!=(std::nullptr_t, const UniqueFunction<Signature, Capacity>& a) _ut_noexcept
+{
+    return (bool) a;
+}
+
+}
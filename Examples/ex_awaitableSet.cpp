@@ -0,0 +1,83 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include <CppAsync/AwaitableSet.h>
+#include <CppAsync/StacklessAsync.h>
+#include <vector>
+
+//
+// Wait for tasks in completion order with an AwaitableSet, removing one before
+// it completes. See Benchmark/bench_awaitableSet.cpp for a comparison with
+// whenAny().
+//
+
+namespace {
+
+static const int NUM_TASKS = 4;
+
+struct DrainFrame : ut::AsyncFrame<void>
+{
+    DrainFrame(ut::AwaitableSet<ut::Task<int>>& tasks)
+        : tasks(tasks) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (!tasks.isEmpty()) {
+            takeTask = tasks.asyncTake();
+            ut_await_(takeTask);
+
+            printf("took task %d\n", takeTask.get().get());
+        }
+
+        ut_end();
+    }
+
+private:
+    ut::AwaitableSet<ut::Task<int>>& tasks;
+    ut::Task<ut::Task<int>> takeTask;
+};
+
+}
+
+void ex_awaitableSet()
+{
+    ut::AwaitableSet<ut::Task<int>> tasks;
+    std::vector<ut::AwaitableSet<ut::Task<int>>::Handle> handles;
+    std::vector<ut::Promise<int>> promises;
+
+    for (int i = 0; i < NUM_TASKS; i++) {
+        ut::Task<int> task;
+        promises.push_back(task.takePromise());
+        handles.push_back(tasks.add(std::move(task)));
+    }
+
+    ut::Task<void> drainTask = ut::startAsyncOf<DrainFrame>(tasks);
+
+    // Each completion resumes the frame right away, out of insertion order.
+    promises[2].complete(2);
+    promises[0].complete(0);
+
+    // Removed members are never taken.
+    tasks.remove(handles[1]);
+    printf("removed task 1, %d left\n", (int) tasks.size());
+
+    promises[3].complete(3);
+
+    assert(drainTask.isReady());
+}
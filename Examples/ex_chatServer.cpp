@@ -20,12 +20,11 @@
 
 #include "Common.h"
 #include "ex_chatServer.h"
-#include <CppAsync/Combinators.h>
+#include <CppAsync/AwaitableSet.h>
 #include <CppAsync/StacklessAsync.h>
 #include <CppAsync/Boost/Asio.h>
+#include <CppAsync/Boost/AsioWriteQueue.h>
 #include <cstdio>
-#include <deque>
-#include <list>
 
 namespace {
 
@@ -44,7 +43,8 @@ class ClientSession : public Guest
 public:
     ClientSession(ChatRoom& room)
         : mRoom(room)
-        , mCtx(ut::makeContext<Context>()) { }
+        , mCtx(ut::makeContext<Context>())
+        , mWriteQueue(mCtx.ptr(), mCtx->socket) { }
 
     // Deleting the session will cancel its Task and force unwinding of coroutines.
     ~ClientSession() { }
@@ -56,10 +56,8 @@ public:
 
     void push(const Msg& msg) final
     {
-        mMsgQueue.push_back(msg);
-
-        // Notify writer.
-        mEvtMsgQueued();
+        // Payload is shared with the other guests, not copied.
+        mWriteQueue.push(msg);
     }
 
     tcp::socket& socket()
@@ -96,9 +94,11 @@ private:
     struct Context
     {
         tcp::socket socket;
-        Msg msg;
         asio::streambuf buf;
 
+        // Recycled handler storage for reads.
+        asio::HandlerMemory<> readMemory;
+
         Context() : socket(sIo) { }
     };
 
@@ -111,7 +111,7 @@ private:
 
         // Session begins with client introducing himself.
         mReadTask = asio::async_read_until(mCtx->socket, mCtx->buf, std::string("\n"),
-            asio::asTask[mCtx]);
+            asio::withMemory(asio::asTask[mCtx], mCtx->readMemory));
         ut_await_(mReadTask);
         std::getline(std::istream(&mCtx->buf), mNickname);
 
@@ -119,9 +119,10 @@ private:
         mRoom.add(this);
 
         // Start reader & writer coroutines. Library generates a proxy Frame
-        // that will invoke the given method of target object.
+        // that will invoke the given method of target object. The writer
+        // coalesces queued messages into gather writes.
         mReaderTask = ut::startAsync(this, &ClientSession::asyncReader);
-        mWriterTask = ut::startAsync(this, &ClientSession::asyncWriter);
+        mWriterTask = mWriteQueue.asyncRun();
 
         ut_try {
             // Suspend until /leave or exception.
@@ -144,7 +145,7 @@ private:
         do {
             // Suspend until a message has been read.
             mReadTask = asio::async_read_until(mCtx->socket, mCtx->buf, std::string("\n"),
-                asio::asTask[mCtx]);
+                asio::withMemory(asio::asTask[mCtx], mCtx->readMemory));
             ut_await_(mReadTask);
 
             std::getline(std::istream(&mCtx->buf), line);
@@ -158,31 +159,6 @@ private:
         ut_end();
     }
 
-    void asyncWriter(ut::AsyncCoroState<void>& coroState)
-    {
-        ut_begin_function(coroState);
-
-        do {
-            if (mMsgQueue.empty()) {
-                mEvtTask = ut::Task<void>();
-                mEvtMsgQueued = mEvtTask.takePromise();
-
-                // Suspend while the outbound queue is empty.
-                ut_await_(mEvtTask);
-            } else {
-                mCtx->msg = std::move(mMsgQueue.front());
-                mMsgQueue.pop_front();
-
-                // Suspend until message has been sent.
-                mWriteTask = asio::async_write(mCtx->socket, asio::buffer(mCtx->msg),
-                    asio::asTask[mCtx]);
-                ut_await_(mWriteTask);
-            }
-        } while (true);
-
-        ut_end();
-    }
-
     void close()
     {
         try {
@@ -195,16 +171,13 @@ private:
 
     ChatRoom& mRoom;
     std::string mNickname;
-    std::deque<Msg> mMsgQueue;
-    ut::Promise<void> mEvtMsgQueued;
     ut::ContextRef<Context> mCtx;
+    asio::WriteQueue<tcp::socket> mWriteQueue;
 
     ut::Task<void> mMainTask;
     ut::Task<void> mReaderTask;
     ut::Task<void> mWriterTask;
-    ut::Task<void> mEvtTask;
     ut::Task<std::size_t> mReadTask;
-    ut::Task<std::size_t> mWriteTask;
 };
 
 // Specialization allows awaiting the termination of a ClientSession.
@@ -240,14 +213,16 @@ static ut::Task<void> asyncChatServer(uint16_t port)
                     acceptTask = ctx->acceptor.async_accept(session->socket(), asio::asTask[ctx]);
                 }
 
-                sessionEndedTask = ut::whenAny(ctx->sessions);
+                // Sessions stay attached to the set, only the next ended one is taken.
+                // Adding a session may complete the take right away, so re-arm only
+                // once its result has been handled.
+                if (!sessionEndedTask.isRunning() && !sessionEndedTask.isReady())
+                    sessionEndedTask = ctx->sessions.asyncTake();
 
                 // Suspend until a connection has been accepted or terminated.
                 ut_await_any_(doneTask, acceptTask, sessionEndedTask);
 
                 if (doneTask == &acceptTask) {
-                    sessionEndedTask.cancel();
-
                     if (acceptTask.hasError()) {
                         printf("failed to accept client\n");
                     } else {
@@ -255,21 +230,20 @@ static ut::Task<void> asyncChatServer(uint16_t port)
 
                         // Start client session.
                         session->start();
-                        ctx->sessions.push_back(std::move(session));
+                        ctx->sessions.add(std::move(session));
                     }
 
                     session = nullptr;
                 } else {
-                    // Remove terminated session.
-                    auto pos = sessionEndedTask.get();
-                    ClientSession& endedSession = **pos;
+                    // Terminated session has been removed from the set.
+                    std::unique_ptr<ClientSession> endedSession(
+                        std::move(sessionEndedTask.get()));
+                    sessionEndedTask = ut::Task<std::unique_ptr<ClientSession>>();
 
-                    if (endedSession.task().hasError())
-                        printf("client '%s' has disconnected\n", endedSession.nickname());
+                    if (endedSession->task().hasError())
+                        printf("client '%s' has disconnected\n", endedSession->nickname());
                     else
-                        printf("client '%s' has left\n", endedSession.nickname());
-
-                    ctx->sessions.erase(pos);
+                        printf("client '%s' has left\n", endedSession->nickname());
                 }
             } while (true);
 
@@ -277,13 +251,13 @@ static ut::Task<void> asyncChatServer(uint16_t port)
         }
 
     private:
-        using session_list_type = std::list<std::unique_ptr<ClientSession>>;
+        using session_set_type = ut::AwaitableSet<std::unique_ptr<ClientSession>>;
 
         struct Context
         {
             tcp::acceptor acceptor;
             std::unique_ptr<ClientSession> session;
-            session_list_type sessions;
+            session_set_type sessions;
 
             Context() : acceptor(sIo, tcp::v4()) { }
         };
@@ -293,7 +267,7 @@ static ut::Task<void> asyncChatServer(uint16_t port)
         ut::ContextRef<Context> ctx;
 
         ut::Task<void> acceptTask;
-        ut::Task<typename session_list_type::iterator> sessionEndedTask;
+        ut::Task<std::unique_ptr<ClientSession>> sessionEndedTask;
     };
 
     return ut::startAsyncOf<Frame>(port);
@@ -22,13 +22,14 @@
 #include <CppAsync/util/StringUtil.h>
 #include <cstdio>
 #include <deque>
+#include <memory>
 #include <set>
 
 namespace {
 
-// Single line message
+// Single line message, shared by all recipients
 //
-using Msg = std::string;
+using Msg = std::shared_ptr<const std::string>;
 
 // Chat guest interface
 //
@@ -79,7 +80,8 @@ public:
 
     void broadcast(const std::string& sender, const std::string& line)
     {
-        Msg msg = ut::string_printf("%s: %s\n", sender.c_str(), line.c_str());
+        Msg msg = std::make_shared<const std::string>(
+            ut::string_printf("%s: %s\n", sender.c_str(), line.c_str()));
 
         for (auto *guest : mGuests) {
             guest->push(msg);
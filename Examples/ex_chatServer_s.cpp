@@ -20,13 +20,12 @@
 
 #include "Common.h"
 #include "ex_chatServer.h"
-#include <CppAsync/Combinators.h>
+#include <CppAsync/AwaitableSet.h>
 #include <CppAsync/StackfulAsync.h>
 #include <CppAsync/Boost/Asio.h>
+#include <CppAsync/Boost/AsioWriteQueue.h>
 #include <CppAsync/util/ScopeGuard.h>
 #include <cstdio>
-#include <deque>
-#include <list>
 
 namespace {
 
@@ -45,7 +44,8 @@ class ClientSession : public Guest
 public:
     ClientSession(ChatRoom& room)
         : mRoom(room)
-        , mCtx(ut::makeContext<Context>()) { }
+        , mCtx(ut::makeContext<Context>())
+        , mWriteQueue(mCtx.ptr(), mCtx->socket) { }
 
     // Deleting the session will cancel its Task and force unwinding of coroutines.
     ~ClientSession() { }
@@ -57,10 +57,8 @@ public:
 
     void push(const Msg& msg) final
     {
-        mMsgQueue.push_back(msg);
-
-        // Notify writer.
-        mEvtMsgQueued();
+        // Payload is shared with the other guests, not copied.
+        mWriteQueue.push(msg);
     }
 
     tcp::socket& socket()
@@ -84,9 +82,11 @@ private:
     struct Context
     {
         tcp::socket socket;
-        Msg msg;
         asio::streambuf buf;
 
+        // Recycled handler storage for reads.
+        asio::HandlerMemory<> readMemory;
+
         Context() : socket(sIo) { }
     };
 
@@ -100,7 +100,7 @@ private:
         // Session begins with client introducing himself.
         ut::stackful::await_(
             asio::async_read_until(mCtx->socket, mCtx->buf, std::string("\n"),
-                asio::asTask[mCtx]));
+                asio::withMemory(asio::asTask[mCtx], mCtx->readMemory)));
         std::getline(std::istream(&mCtx->buf), mNickname);
 
         // Join room and notify everybody.
@@ -109,7 +109,7 @@ private:
 
         // Start reader & writer coroutines.
         auto readerTask = ut::stackful::startAsync(this, &ClientSession::asyncReader);
-        auto writerTask = ut::stackful::startAsync(this, &ClientSession::asyncWriter);
+        auto writerTask = mWriteQueue.asyncRun();
 
         // Suspend until /leave or exception.
         ut::stackful::awaitAny_(readerTask, writerTask);
@@ -122,7 +122,7 @@ private:
             // Suspend until a message has been read.
             ut::stackful::await_(
                 asio::async_read_until(mCtx->socket, mCtx->buf, std::string("\n"),
-                    asio::asTask[mCtx]));
+                    asio::withMemory(asio::asTask[mCtx], mCtx->readMemory)));
 
             std::string line;
             std::getline(std::istream(&mCtx->buf), line);
@@ -134,27 +134,6 @@ private:
         } while (!quit);
     }
 
-    void asyncWriter()
-    {
-        do {
-            if (mMsgQueue.empty()) {
-                ut::Task<void> evtTask;
-                mEvtMsgQueued = evtTask.takePromise();
-
-                // Suspend while the outbound queue is empty.
-                ut::stackful::await_(evtTask);
-            } else {
-                mCtx->msg = std::move(mMsgQueue.front());
-                mMsgQueue.pop_front();
-
-                // Suspend until the message has been sent.
-                ut::stackful::await_(
-                    asio::async_write(mCtx->socket, asio::buffer(mCtx->msg),
-                        asio::asTask[mCtx]));
-            }
-        } while (true);
-    }
-
     void close()
     {
         try {
@@ -167,9 +146,8 @@ private:
 
     ChatRoom& mRoom;
     std::string mNickname;
-    std::deque<Msg> mMsgQueue;
-    ut::Promise<void> mEvtMsgQueued;
     ut::ContextRef<Context> mCtx;
+    asio::WriteQueue<tcp::socket> mWriteQueue;
 
     ut::Task<void> mMainTask;
 };
@@ -187,7 +165,7 @@ static ut::Task<void> asyncChatServer(uint16_t port)
         struct Context
         {
             tcp::acceptor acceptor;
-            std::list<std::unique_ptr<ClientSession>> sessions;
+            ut::AwaitableSet<std::unique_ptr<ClientSession>> sessions;
 
             Context() : acceptor(sIo, tcp::v4()) { }
         };
@@ -196,6 +174,7 @@ static ut::Task<void> asyncChatServer(uint16_t port)
         ChatRoom room;
         std::unique_ptr<ClientSession> session;
         ut::Task<void> acceptTask;
+        ut::Task<std::unique_ptr<ClientSession>> sessionEndedTask;
 
         ctx->acceptor.bind(tcp::endpoint(tcp::v4(), port));
         ctx->acceptor.listen();
@@ -209,14 +188,16 @@ static ut::Task<void> asyncChatServer(uint16_t port)
                 acceptTask = ctx->acceptor.async_accept(session->socket(), asio::asTask[ctx]);
             }
 
-            auto sessionEndedTask = ut::whenAny(ctx->sessions);
+            // Sessions stay attached to the set, only the next ended one is taken.
+            // Adding a session may complete the take right away, so re-arm only
+            // once its result has been handled.
+            if (!sessionEndedTask.isRunning() && !sessionEndedTask.isReady())
+                sessionEndedTask = ctx->sessions.asyncTake();
 
             // Suspend until a connection has been accepted or terminated.
             auto *doneTask = ut::stackful::awaitAny_(acceptTask, sessionEndedTask);
 
             if (doneTask == &acceptTask) {
-                sessionEndedTask.cancel();
-
                 if (acceptTask.hasError()) {
                     printf("failed to accept client\n");
                 } else {
@@ -224,21 +205,20 @@ static ut::Task<void> asyncChatServer(uint16_t port)
 
                     // Start client session.
                     session->start();
-                    ctx->sessions.push_back(std::move(session));
+                    ctx->sessions.add(std::move(session));
                 }
 
                 session = nullptr;
             } else {
-                // Remove terminated session.
-                auto pos = sessionEndedTask.get();
-                ClientSession& endedSession = **pos;
+                // Terminated session has been removed from the set.
+                std::unique_ptr<ClientSession> endedSession(
+                    std::move(sessionEndedTask.get()));
+                sessionEndedTask = ut::Task<std::unique_ptr<ClientSession>>();
 
-                if (endedSession.task().hasError())
-                    printf("client '%s' has disconnected\n", endedSession.nickname());
+                if (endedSession->task().hasError())
+                    printf("client '%s' has disconnected\n", endedSession->nickname());
                 else
-                    printf("client '%s' has left\n", endedSession.nickname());
-
-                ctx->sessions.erase(pos);
+                    printf("client '%s' has left\n", endedSession->nickname());
             }
         } while (true);
     });
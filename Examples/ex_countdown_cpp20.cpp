@@ -0,0 +1,96 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include "util/Looper.h"
+#include <CppAsync/Cpp20Async.h>
+
+// Requires a compiler with C++20 coroutines, see HAVE_CPP20_COROUTINES in CMakeLists.txt.
+#if _ut_has_cpp20_coroutines
+
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+// Custom run loop
+static util::Looper sLooper;
+
+static void ping()
+{
+    printf(".");
+    sLooper.schedule(&ping, 100);
+}
+
+static ut::Task<void> asyncDelay(long milliseconds)
+{
+    ut::Task<void> task;
+
+    // Finish task after delay.
+    sLooper.schedule(task.takePromise(), milliseconds);
+
+    return task;
+}
+
+// Frames of coroutines taking std::allocator_arg are allocated through the given allocator.
+template <class Alloc>
+static ut::Task<int> asyncTick(std::allocator_arg_t, const Alloc& /* alloc */, int i)
+{
+    printf("%d\n", i);
+
+    // Suspend for 1 second.
+    co_await asyncDelay(1000);
+
+    co_return i - 1;
+}
+
+static ut::Task<void> asyncCountdown(int n)
+{
+    std::allocator<char> alloc;
+
+    // When a tick finishes, its final suspend point transfers control straight back
+    // to this coroutine.
+    for (int i = n; i > 0; )
+        i = co_await asyncTick(std::allocator_arg, alloc, i);
+
+    printf("liftoff!\n");
+
+    // Stop pinging when done.
+    sLooper.cancelAll();
+}
+
+}
+
+void ex_countdown_cpp20()
+{
+    // 5 second countdown
+    const int n = 5;
+
+    // Create an async task on top of standard C++20 coroutines. The coroutine starts
+    // eagerly and runs until its first suspension point.
+    ut::Task<void> task = asyncCountdown(n);
+
+    // Print every 100ms to show the even loop is not blocked.
+    ping();
+
+    // Here a custom Looper runs until there are no more scheduled operations.
+    sLooper.run();
+
+    assert(task.isReady());
+    task.get();
+}
+
+#endif
@@ -0,0 +1,342 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef __linux__
+
+#include "Common.h"
+#include "util/Chrono.h"
+#include "util/EpollLoop.h"
+#include "util/Schedule.h"
+#include "util/Thread.h"
+#include <CppAsync/StacklessAsync.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//
+// Echo over a socket pair on an epoll loop, a read with timeout, a writability
+// wait and actions posted from another thread. See Benchmark/bench_epollLoop.cpp
+// for timings.
+//
+
+namespace {
+
+static const char *const MESSAGES[] = { "hello", "epoll", "loop" };
+static const long READ_TIMEOUT = 100; // ms
+static const long DRAIN_DELAY = 20; // ms
+static const int NUM_REMOTE_POSTS = 1000;
+static const long REMOTE_DEADLINE = 5000; // ms
+
+static util::EpollLoop *sLoop;
+
+// Echoes bytes back until the peer hangs up.
+//
+struct EchoFrame : ut::AsyncFrame<void>
+{
+    EchoFrame(int fd)
+        : fd(fd) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (true) {
+            n = read(fd, buf, sizeof(buf));
+
+            if (n > 0) {
+                // Only a few bytes are in flight, the socket buffer never fills up.
+                if (write(fd, buf, n) != n)
+                    break;
+            } else if (n < 0 && errno == EAGAIN) {
+                readable = sLoop->asyncReadable(fd);
+                ut_await_(readable);
+            } else {
+                break; // peer hung up
+            }
+        }
+
+        ut_end();
+    }
+
+private:
+    int fd;
+    ssize_t n;
+    char buf[64];
+    ut::Task<void> readable;
+};
+
+// Sends a few messages and prints what comes back.
+//
+struct PingFrame : ut::AsyncFrame<void>
+{
+    PingFrame(int fd)
+        : fd(fd) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (i = 0; i < (int) (sizeof(MESSAGES) / sizeof(MESSAGES[0])); i++) {
+            size = (int) strlen(MESSAGES[i]);
+            if (write(fd, MESSAGES[i], size) != size)
+                break;
+
+            // Echo may arrive in pieces.
+            for (numReceived = 0; numReceived < size; ) {
+                n = read(fd, reply + numReceived, size - numReceived);
+
+                if (n > 0) {
+                    numReceived += (int) n;
+                } else if (n < 0 && errno == EAGAIN) {
+                    readable = sLoop->asyncReadable(fd);
+                    ut_await_(readable);
+                } else {
+                    break; // peer hung up
+                }
+            }
+
+            printf("echo: %.*s\n", numReceived, reply);
+        }
+
+        // Hang up, so the echo task finishes.
+        shutdown(fd, SHUT_WR);
+
+        ut_end();
+    }
+
+private:
+    int fd;
+    int i;
+    int size;
+    int numReceived;
+    ssize_t n;
+    char reply[64];
+    ut::Task<void> readable;
+};
+
+// Waits for data that never comes. Once the deadline wins, the read wait gets
+// canceled and the loop is free to exit.
+//
+struct TimeoutFrame : ut::AsyncFrame<void>
+{
+    TimeoutFrame(int fd)
+        : fd(fd) { }
+
+    void operator()()
+    {
+        ut::AwaitableBase *doneTask;
+        ut_begin();
+
+        start = util::monotonicMicroseconds();
+
+        readable = sLoop->asyncReadable(fd);
+        timeout = sLoop->asyncDelay(READ_TIMEOUT);
+        ut_await_any_(doneTask, readable, timeout);
+
+        printf("%s after %.1f ms (deadline %d ms)\n",
+            doneTask == &timeout ? "timed out" : "readable",
+            (util::monotonicMicroseconds() - start) / 1000.0, (int) READ_TIMEOUT);
+
+        ut_end();
+    }
+
+private:
+    int fd;
+    int64_t start;
+    ut::Task<void> readable;
+    ut::Task<void> timeout;
+};
+
+// Fills the socket buffer, then waits for the peer to drain it.
+//
+struct WritableFrame : ut::AsyncFrame<void>
+{
+    WritableFrame(int fd, int peerFd)
+        : fd(fd)
+        , peerFd(peerFd)
+        , numBuffered(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        while (true) {
+            n = write(fd, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            numBuffered += n;
+        }
+
+        start = util::monotonicMicroseconds();
+
+        drainTask = ut::startAsyncOf<DrainFrame>(peerFd);
+
+        writable = sLoop->asyncWritable(fd);
+        ut_await_(writable);
+
+        printf("writable after %.1f ms, %d KB were buffered (drain delay %d ms)\n",
+            (util::monotonicMicroseconds() - start) / 1000.0, (int) (numBuffered / 1024),
+            (int) DRAIN_DELAY);
+
+        ut_await_(drainTask);
+
+        ut_end();
+    }
+
+private:
+    // Reads everything buffered after a delay.
+    struct DrainFrame : ut::AsyncFrame<void>
+    {
+        DrainFrame(int fd)
+            : fd(fd) { }
+
+        void operator()()
+        {
+            ut_begin();
+
+            delay = sLoop->asyncDelay(DRAIN_DELAY);
+            ut_await_(delay);
+
+            while (read(fd, buf, sizeof(buf)) > 0) { }
+
+            ut_end();
+        }
+
+    private:
+        int fd;
+        char buf[16384];
+        ut::Task<void> delay;
+    };
+
+    int fd;
+    int peerFd;
+    ssize_t n;
+    long numBuffered;
+    int64_t start;
+    char buf[16384];
+    ut::Task<void> drainTask;
+    ut::Task<void> writable;
+};
+
+// Counts actions posted by another thread through ut::schedule(), the last one
+// completes a task. A deadline keeps the loop alive in the meantime.
+//
+struct RemotePostsFrame : ut::AsyncFrame<void>
+{
+    RemotePostsFrame()
+        : counter(std::make_shared<Counter>())
+        , ranTicketed(false) { }
+
+    void operator()()
+    {
+        ut::AwaitableBase *doneTask;
+        ut_begin();
+
+        // Ticketed actions, the second ticket is dropped right away.
+        ticket = ut::scheduleWithTicket([this] { ranTicketed = true; });
+        ut::scheduleWithTicket([] { assert(false && "canceled action ran"); });
+
+        allReceived = ut::Task<void>();
+        counter->promise = allReceived.takePromise();
+
+        // Actions share the counter, late ones may still run if the deadline wins.
+        worker = util::threading::thread([this] {
+            std::shared_ptr<Counter> counter = this->counter;
+
+            for (int i = 0; i < NUM_REMOTE_POSTS; i++) {
+                ut::schedule([counter] {
+                    if (++counter->numReceived == NUM_REMOTE_POSTS)
+                        counter->promise();
+                });
+            }
+        });
+
+        deadline = sLoop->asyncWaitUntil(util::monotonicTime()
+            + util::chrono::milliseconds(REMOTE_DEADLINE));
+        ut_await_any_(doneTask, allReceived, deadline);
+
+        worker.join();
+
+        printf("%d of %d remote posts received, ticketed action %s\n",
+            counter->numReceived, NUM_REMOTE_POSTS,
+            ranTicketed ? "ran" : "skipped");
+
+        ut_end();
+    }
+
+private:
+    struct Counter
+    {
+        int numReceived;
+        ut::Promise<void> promise;
+
+        Counter()
+            : numReceived(0) { }
+    };
+
+    std::shared_ptr<Counter> counter;
+    bool ranTicketed;
+    util::threading::thread worker;
+    ut::SchedulerTicket ticket;
+    ut::Task<void> allReceived;
+    ut::Task<void> deadline;
+};
+
+}
+
+void ex_epollLoop()
+{
+    int fds[2], silentFds[2], fullFds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) != 0
+            || socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, silentFds) != 0
+            || socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fullFds) != 0) {
+        perror("socketpair");
+        return;
+    }
+
+    util::EpollLoop loop;
+    sLoop = &loop;
+
+    // Actions scheduled by CppAsync run on the loop, posting is thread safe.
+    util::ScheduleGuard scheduleGuard(loop);
+
+    ut::Task<void> echoTask = ut::startAsyncOf<EchoFrame>(fds[1]);
+    ut::Task<void> pingTask = ut::startAsyncOf<PingFrame>(fds[0]);
+    ut::Task<void> timeoutTask = ut::startAsyncOf<TimeoutFrame>(silentFds[0]);
+
+    // Loop until there are no more pending operations.
+    loop.run();
+
+    assert(echoTask.isReady() && pingTask.isReady() && timeoutTask.isReady());
+
+    // Writability and remote posts, run as a second round.
+    ut::Task<void> writableTask = ut::startAsyncOf<WritableFrame>(fullFds[0], fullFds[1]);
+    ut::Task<void> remoteTask = ut::startAsyncOf<RemotePostsFrame>();
+
+    loop.run();
+
+    assert(writableTask.isReady() && remoteTask.isReady());
+
+    for (int fd : { fds[0], fds[1], silentFds[0], silentFds[1], fullFds[0], fullFds[1] })
+        close(fd);
+
+    sLoop = nullptr;
+}
+
+#endif // __linux__
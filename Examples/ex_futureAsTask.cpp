@@ -54,15 +54,15 @@ static boost::future<int> startTick(int k)
 static ut::Task<std::string> asyncReadLine()
 {
     ut::Task<std::string> task;
-    auto promise = task.takePromise().share();
+    auto mvPromise = ut::makeMoveOnCopy(
+        util::makeRemotePromise(context::looper(), task.takePromise()));
 
     // Read input on a separate thread.
-    std::thread([promise]() {
+    std::thread([mvPromise]() {
         std::string line = util::readLine();
 
         // Finish the task on the main thread.
-        std::function<void ()> f = [promise, line]() { promise(line); };
-        context::looper().schedule(std::move(f));
+        mvPromise->complete(std::move(line));
     }).detach();
 
     return task;
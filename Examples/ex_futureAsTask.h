@@ -20,6 +20,7 @@
 
 #include "Common.h"
 #include "util/Looper.h"
+#include "util/RemotePromise.h"
 #include <CppAsync/Task.h>
 #include <CppAsync/util/MoveOnCopy.h>
 #include <boost/thread/future.hpp>
@@ -37,8 +38,8 @@ namespace context
 
 namespace detail
 {
-    template <class R>
-    void complete(ut::Promise<R>&& promise, boost::future<R>& future) _ut_noexcept
+    template <class P, class R>
+    void complete(P&& promise, boost::future<R>& future) _ut_noexcept
     {
         std::exception_ptr eptr;
         try {
@@ -51,7 +52,8 @@ namespace detail
         promise.fail(eptr);
     }
 
-    inline void complete(ut::Promise<void>&& promise, boost::future<void>& future) _ut_noexcept
+    template <class P>
+    void complete(P&& promise, boost::future<void>& future) _ut_noexcept
     {
         std::exception_ptr eptr;
         try {
@@ -73,24 +75,18 @@ inline ut::Task<R> futureAsTask(boost::future<R> future)
     if (future.is_ready()) {
         detail::complete(task.takePromise(), future);
     } else {
-        auto promise = task.takePromise().share();
+        // Completion gets handed over to the main thread, which drains all
+        // pending completions on its next loop iteration.
+        auto mvPromise = ut::makeMoveOnCopy(
+            util::makeRemotePromise(context::looper(), task.takePromise()));
 
         // Complete Task after continuation.
         // (warning: future.then() leaks, see https://svn.boost.org/trac/boost/ticket/12220)
         future.then(boost::launch::async,
-                [promise](boost::future<R> previous) {
+                [mvPromise](boost::future<R> previous) {
             assert(previous.is_ready());
 
-            // Workaround for lack of move-capture in MSVC 12.0
-            auto mvPrevious = ut::makeMoveOnCopy(std::move(previous));
-
-            // Make sure completion happens on main thread.
-            std::function<void ()> f = [mvPrevious, promise]() {
-                // Nothing to do if Task got canceled in the meantime.
-                if (promise.isCompletable())
-                    detail::complete(std::move(promise.promise()), *mvPrevious);
-            };
-            context::looper().post(std::move(f));
+            detail::complete(std::move(*mvPromise), previous);
         });
     }
 
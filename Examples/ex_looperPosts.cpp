@@ -0,0 +1,98 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include "util/Looper.h"
+#include "util/RemotePromise.h"
+#include "util/Thread.h"
+#include <CppAsync/Combinators.h>
+#include <CppAsync/StacklessAsync.h>
+#include <vector>
+
+//
+// Post to a Looper from several threads, and complete promises owned by the loop
+// thread from worker threads. See Benchmark/bench_looperPosts.cpp for timings.
+//
+
+namespace {
+
+static const int NUM_WORKERS = 4;
+static const int NUM_POSTS_PER_WORKER = 1000;
+
+static util::Looper sLooper;
+
+struct CollectFrame : ut::AsyncFrame<void>
+{
+    CollectFrame()
+        : numPosted(0)
+        , tasks(NUM_WORKERS) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        // Promises are taken on the loop thread, then handed over to the workers.
+        for (i = 0; i < NUM_WORKERS; i++) {
+            workers.emplace_back([this](util::RemotePromise<int> promise) {
+                for (int j = 0; j < NUM_POSTS_PER_WORKER; j++)
+                    sLooper.post([this] { numPosted++; });
+
+                // Completes the task on the loop thread.
+                promise.complete(NUM_POSTS_PER_WORKER);
+            }, util::makeRemotePromise(sLooper, tasks[i].takePromise()));
+        }
+
+        allTask = ut::whenAll(tasks);
+        ut_await_(allTask);
+
+        for (auto& worker : workers)
+            worker.join();
+
+        // Stop keep-alive.
+        sLooper.cancelAll();
+
+        // Posts from each worker arrive before its completion.
+        printf("%d workers done, %d posts received -- %s\n", NUM_WORKERS, numPosted,
+            numPosted == NUM_WORKERS * NUM_POSTS_PER_WORKER ? "OK" : "FAILED");
+
+        ut_end();
+    }
+
+private:
+    int i;
+    int numPosted;
+    std::vector<ut::Task<int>> tasks;
+    std::vector<util::threading::thread> workers;
+    ut::Task<std::vector<ut::Task<int>>::iterator> allTask;
+};
+
+static void keepAlive()
+{
+    // Looper must not quit while workers are running.
+    sLooper.schedule(&keepAlive, 10);
+}
+
+}
+
+void ex_looperPosts()
+{
+    ut::Task<void> task = ut::startAsyncOf<CollectFrame>();
+
+    keepAlive();
+    sLooper.run();
+
+    assert(task.isReady());
+}
@@ -0,0 +1,57 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include "util/Chrono.h"
+#include "util/Looper.h"
+
+//
+// Schedule Looper timers, cancel one of them from inside the loop. See
+// Benchmark/bench_looperTimers.cpp for timings.
+//
+
+namespace {
+
+static util::Looper sLooper;
+static int64_t sStart;
+
+static void report(const char *name)
+{
+    printf("%-6s fired after %3d ms\n", name,
+        (int) ((util::monotonicMicroseconds() - sStart) / 1000));
+}
+
+}
+
+void ex_looperTimers()
+{
+    sStart = util::monotonicMicroseconds();
+
+    // Timers fire by deadline, not in scheduling order.
+    sLooper.schedule([] { report("third"); }, 300);
+    sLooper.schedule([] { report("first"); }, 100);
+    util::Ticket canceled = sLooper.schedule([] { report("never"); }, 200);
+
+    sLooper.schedule([canceled] {
+        report("second");
+
+        // Cancel may only be called from inside the loop.
+        bool isCanceled = sLooper.cancel(canceled);
+        printf("canceled timer at 200 ms -- %s\n", isCanceled ? "OK" : "FAILED");
+    }, 150);
+
+    sLooper.run();
+}
@@ -0,0 +1,72 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_BOOST_CONTEXT
+
+#include "Common.h"
+#include <CppAsync/StackfulAsync.h>
+#include <CppAsync/StackProfiler.h>
+#include <cstring>
+#include <random>
+
+namespace {
+
+static const int NUM_COROUTINES = 1000;
+static const int STACK_SIZE = 64 * 1024;
+
+static int recurse(int depth)
+{
+    volatile char frame[512];
+    memset(const_cast<char*>(frame), depth, sizeof(frame));
+
+    return depth == 0 ? frame[0] : recurse(depth - 1) + frame[1];
+}
+
+struct Shallow
+{
+    int operator()() const
+    {
+        return 1;
+    }
+};
+
+struct Parser
+{
+    int depth;
+
+    int operator()() const
+    {
+        return recurse(depth);
+    }
+};
+
+}
+
+void ex_stackProfile_s()
+{
+    // Stack usage is recorded per coroutine function type.
+    std::minstd_rand random;
+    std::uniform_int_distribution<int> depths(0, 60);
+
+    for (int i = 0; i < NUM_COROUTINES; i++) {
+        ut::stackful::startAsync(Shallow(), STACK_SIZE);
+        ut::stackful::startAsync(Parser { depths(random) }, STACK_SIZE);
+    }
+
+    ut::stackful::StackProfiler::dump();
+}
+
+#endif // HAVE_BOOST_CONTEXT
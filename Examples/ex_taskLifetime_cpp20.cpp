@@ -0,0 +1,201 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include <CppAsync/Cpp20Async.h>
+
+// Requires a compiler with C++20 coroutines, see HAVE_CPP20_COROUTINES in CMakeLists.txt.
+#if _ut_has_cpp20_coroutines
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+//
+// C++20 coroutine frames: custom allocator, cancellation and exceptions
+//
+
+namespace {
+
+// Counts the frames it currently holds.
+template <class T>
+struct CountingAlloc
+{
+    using value_type = T;
+
+    int *numFrames;
+
+    explicit CountingAlloc(int *numFrames) _ut_noexcept
+        : numFrames(numFrames) { }
+
+    template <class U>
+    CountingAlloc(const CountingAlloc<U>& other) _ut_noexcept
+        : numFrames(other.numFrames) { }
+
+    T* allocate(std::size_t n)
+    {
+        T *p = std::allocator<T>().allocate(n);
+        ++*numFrames;
+
+        return p;
+    }
+
+    void deallocate(T *p, std::size_t n) _ut_noexcept
+    {
+        --*numFrames;
+        std::allocator<T>().deallocate(p, n);
+    }
+};
+
+template <class T, class U>
+bool operator==(const CountingAlloc<T>& a, const CountingAlloc<U>& b) _ut_noexcept
+{
+    return a.numFrames == b.numFrames;
+}
+
+template <class T, class U>
+bool operator!=(const CountingAlloc<T>& a, const CountingAlloc<U>& b) _ut_noexcept
+{
+    return !(a == b);
+}
+
+using Alloc = CountingAlloc<char>;
+
+static ut::Task<void> asyncWait(std::allocator_arg_t, const Alloc& /* alloc */,
+    ut::Task<void>& event)
+{
+    co_await event;
+}
+
+// Suspends inside a nested coroutine.
+static ut::Task<void> asyncWaitNested(std::allocator_arg_t, const Alloc& alloc,
+    ut::Task<void>& event)
+{
+    co_await asyncWait(std::allocator_arg, alloc, event);
+}
+
+static ut::Task<int> asyncParse(std::allocator_arg_t, const Alloc& /* alloc */,
+    ut::Task<std::string>& input)
+{
+    std::string text = co_await input;
+
+    if (text.empty())
+        throw std::invalid_argument("empty input");
+
+    co_return std::stoi(text);
+}
+
+// Exceptions thrown by an awaited coroutine are rethrown by co_await.
+static ut::Task<std::string> asyncDescribe(std::allocator_arg_t, const Alloc& alloc,
+    ut::Task<std::string>& input)
+{
+    try {
+        int value = co_await asyncParse(std::allocator_arg, alloc, input);
+        co_return "value " + std::to_string(value);
+    } catch (const std::invalid_argument& e) {
+        co_return std::string("invalid input: ") + e.what();
+    }
+}
+
+// Frames of member coroutines are allocated through the allocator following the object.
+struct Accumulator
+{
+    int total = 0;
+
+    ut::Task<int> asyncAdd(std::allocator_arg_t, const Alloc& /* alloc */,
+        ut::Task<int>& amount)
+    {
+        total += co_await amount;
+        co_return total;
+    }
+};
+
+static std::string describe(const Alloc& alloc, const char *text)
+{
+    ut::Task<std::string> input;
+    ut::Promise<std::string> promise = input.takePromise();
+
+    ut::Task<std::string> task = asyncDescribe(std::allocator_arg, alloc, input);
+    assert(*alloc.numFrames == 2);
+
+    promise.complete(std::string(text));
+    assert(task.isReady() && *alloc.numFrames == 0);
+
+    return task.get();
+}
+
+}
+
+void ex_taskLifetime_cpp20()
+{
+    int numFrames = 0;
+    Alloc alloc(&numFrames);
+
+    // Destroying a pending Task destroys its frame. Local variables are destroyed
+    // too, including the Task of a nested coroutine, so the whole chain is freed.
+    {
+        ut::Task<void> event;
+        ut::Promise<void> eventPromise = event.takePromise();
+
+        ut::Task<void> task = asyncWaitNested(std::allocator_arg, alloc, event);
+        printf("pending: %d frames\n", numFrames);
+        assert(numFrames == 2 && !task.isReady());
+
+        task = ut::Task<void>();
+        printf("canceled: %d frames\n", numFrames);
+        assert(numFrames == 0 && event.awaiter() == nullptr);
+
+        // Nothing left to resume.
+        eventPromise.complete();
+    }
+
+    // Exceptions propagate through co_await.
+    printf("%s\n", describe(alloc, "42").c_str());
+    printf("%s\n", describe(alloc, "").c_str());
+
+    // Uncaught exceptions fail the Task, get() rethrows them.
+    {
+        ut::Task<std::string> input;
+        ut::Promise<std::string> promise = input.takePromise();
+
+        ut::Task<int> task = asyncParse(std::allocator_arg, alloc, input);
+        promise.complete(std::string());
+        assert(task.isReady() && task.hasError());
+
+        try {
+            task.get();
+            assert(false && "should have thrown");
+        } catch (const std::invalid_argument& e) {
+            printf("rethrown by get(): %s\n", e.what());
+        }
+    }
+
+    {
+        Accumulator accumulator;
+        ut::Task<int> amount;
+        ut::Promise<int> promise = amount.takePromise();
+
+        ut::Task<int> task = accumulator.asyncAdd(std::allocator_arg, alloc, amount);
+        assert(numFrames == 1);
+
+        promise.complete(5);
+        printf("member coroutine: %d\n", task.get());
+    }
+
+    printf("all frames freed: %s\n", numFrames == 0 ? "OK" : "FAILED");
+}
+
+#endif
@@ -0,0 +1,159 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include "util/Looper.h"
+#include <CppAsync/StacklessAsync.h>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+static const int NUM_TASKS_PER_THREAD = 2000;
+static const int NUM_STEPS_PER_TASK = 10;
+
+static ut::Task<void> asyncYield(util::Looper& looper)
+{
+    ut::Task<void> task;
+
+    // Finish task on next loop iteration.
+    looper.post(task.takePromise());
+
+    return task;
+}
+
+// Every third step fails, exercising the loopback exception path.
+//
+struct StepFrame : ut::AsyncFrame<int>
+{
+    StepFrame(util::Looper& looper, int step)
+        : looper(looper)
+        , step(step) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        subtask = asyncYield(looper);
+        ut_await_(subtask);
+
+        if (step % 3 == 0)
+            throw std::runtime_error("step failed");
+
+        ut_return(step);
+        ut_end();
+    }
+
+private:
+    util::Looper& looper;
+    int step;
+    ut::Task<void> subtask;
+};
+
+struct WorkerFrame : ut::AsyncFrame<int>
+{
+    WorkerFrame(util::Looper& looper)
+        : looper(looper)
+        , sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (step = 1; step <= NUM_STEPS_PER_TASK; step++) {
+            ut_try {
+                subtask = ut::startAsyncOf<StepFrame>(looper, step);
+                ut_await_(subtask);
+
+                sum += subtask.get();
+            } ut_catch (const std::runtime_error&) {
+                // Failed steps don't count.
+            }
+        }
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    util::Looper& looper;
+    int step;
+    int sum;
+    ut::Task<int> subtask;
+};
+
+static long expectedSumPerTask()
+{
+    long sum = 0;
+    for (int step = 1; step <= NUM_STEPS_PER_TASK; step++) {
+        if (step % 3 != 0)
+            sum += step;
+    }
+    return sum;
+}
+
+static void runWorker(int id, std::atomic<long>& total)
+{
+    // Each thread runs its own loop. Exceptions thrown from stackless coroutines
+    // are looped back through a per-thread slot, so frames may be resumed from
+    // several threads at once.
+    util::Looper looper;
+    std::vector<ut::Task<int>> tasks;
+    tasks.reserve(NUM_TASKS_PER_THREAD);
+
+    for (int i = 0; i < NUM_TASKS_PER_THREAD; i++)
+        tasks.push_back(ut::startAsyncOf<WorkerFrame>(looper));
+
+    // Loop until all tasks have finished.
+    looper.run();
+
+    long sum = 0;
+    for (auto& task : tasks) {
+        assert(task.isReady());
+        sum += task.get();
+    }
+
+    printf("thread %d: %d tasks done\n", id, (int) tasks.size());
+    total += sum;
+}
+
+}
+
+void ex_threadedTasks()
+{
+    int numThreads = (int) std::thread::hardware_concurrency();
+    if (numThreads < 2)
+        numThreads = 2;
+
+    printf("running %d stackless tasks on each of %d threads...\n",
+        NUM_TASKS_PER_THREAD, numThreads);
+
+    std::atomic<long> total(0);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < numThreads; i++)
+        threads.emplace_back(&runWorker, i, std::ref(total));
+
+    for (auto& thread : threads)
+        thread.join();
+
+    const long expected = (long) numThreads * NUM_TASKS_PER_THREAD * expectedSumPerTask();
+
+    printf("total: %ld (expected %ld) -- %s\n", total.load(), expected,
+        total.load() == expected ? "OK" : "FAILED");
+}
@@ -0,0 +1,111 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_BOOST_CONTEXT
+
+#include "Common.h"
+#include "util/Looper.h"
+#include <CppAsync/StackfulAsync.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+static const int NUM_TASKS_PER_THREAD = 2000;
+static const int NUM_STEPS_PER_TASK = 10;
+static const int STACK_SIZE = 32 * 1024;
+
+static ut::Task<void> asyncYield(util::Looper& looper)
+{
+    ut::Task<void> task;
+
+    // Finish task on next loop iteration.
+    looper.post(task.takePromise());
+
+    return task;
+}
+
+static ut::Task<int> asyncStep(util::Looper& looper, int step)
+{
+    // Nested coroutine, so that each thread has a call chain deeper than one.
+    return ut::stackful::startAsync([&looper, step]() -> int {
+        ut::stackful::await_(asyncYield(looper));
+
+        return step;
+    }, STACK_SIZE);
+}
+
+static void runWorker(int id, std::atomic<long>& total)
+{
+    // Each thread runs its own loop. Stackful coroutines started from this thread
+    // use a separate call chain, and are always resumed from this thread.
+    util::Looper looper;
+    std::vector<ut::Task<int>> tasks;
+    tasks.reserve(NUM_TASKS_PER_THREAD);
+
+    for (int i = 0; i < NUM_TASKS_PER_THREAD; i++) {
+        tasks.push_back(ut::stackful::startAsync([&looper]() -> int {
+            int sum = 0;
+
+            for (int step = 1; step <= NUM_STEPS_PER_TASK; step++)
+                sum += ut::stackful::await_(asyncStep(looper, step));
+
+            return sum;
+        }, STACK_SIZE));
+    }
+
+    // Loop until all tasks have finished.
+    looper.run();
+
+    long sum = 0;
+    for (auto& task : tasks) {
+        assert(task.isReady());
+        sum += task.get();
+    }
+
+    printf("thread %d: %d tasks done\n", id, (int) tasks.size());
+    total += sum;
+}
+
+}
+
+void ex_threadedTasks_s()
+{
+    int numThreads = (int) std::thread::hardware_concurrency();
+    if (numThreads < 2)
+        numThreads = 2;
+
+    printf("running %d stackful tasks on each of %d threads...\n",
+        NUM_TASKS_PER_THREAD, numThreads);
+
+    std::atomic<long> total(0);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < numThreads; i++)
+        threads.emplace_back(&runWorker, i, std::ref(total));
+
+    for (auto& thread : threads)
+        thread.join();
+
+    const long expected = (long) numThreads * NUM_TASKS_PER_THREAD
+        * (NUM_STEPS_PER_TASK * (NUM_STEPS_PER_TASK + 1) / 2);
+
+    printf("total: %ld (expected %ld) -- %s\n", total.load(), expected,
+        total.load() == expected ? "OK" : "FAILED");
+}
+
+#endif // HAVE_BOOST_CONTEXT
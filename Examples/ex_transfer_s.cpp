@@ -0,0 +1,146 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_BOOST_CONTEXT
+
+#include "Common.h"
+#include <CppAsync/StackfulCoroutine.h>
+#include <cassert>
+#include <cstdio>
+
+namespace {
+
+using ut::stackful::StackfulCoroutine;
+using ut::stackful::FixedSizeStack;
+
+// Values travel both ways with each transfer.
+static void pingPong()
+{
+    StackfulCoroutine *pPing = nullptr;
+    int numRounds = 0;
+
+    StackfulCoroutine pong([&pPing, &numRounds](void *arg) {
+        while (true) {
+            int ball = *static_cast<int*>(arg);
+            numRounds++;
+
+            int reply = ball + 1;
+            arg = ut::stackful::transferTo(*pPing, &reply);
+        }
+    }, FixedSizeStack());
+
+    StackfulCoroutine ping([&pong]() {
+        int ball = 0;
+
+        for (int i = 0; i < 5; i++) {
+            void *reply = ut::stackful::transferTo(pong, &ball);
+            assert(*static_cast<int*>(reply) == ball + 1);
+            ball = *static_cast<int*>(reply) + 1;
+        }
+
+        assert(ball == 10);
+    }, FixedSizeStack());
+
+    pPing = &ping;
+
+    bool isRunning = ping();
+    assert(!isRunning && ping.isDone());
+
+    // Pong is left suspended, deleting it unwinds its stack.
+    assert(!pong.isDone());
+
+    printf("ping-pong: %d rounds, ping %s, pong %s\n", numRounds,
+        isRunning ? "running" : "done", pong.isDone() ? "done" : "suspended");
+}
+
+// A yield after a transfer reaches the parent as if it came from the
+// coroutine the parent resumed. Resuming that coroutine again returns
+// from its transferTo(), the target stays suspended.
+static void yieldToParent()
+{
+    StackfulCoroutine target([](void *arg) {
+        int value = *static_cast<int*>(arg) * 2;
+        ut::stackful::yield_(&value);
+        assert(false); // never resumed
+    }, FixedSizeStack());
+
+    int resumeValue = 0;
+
+    StackfulCoroutine source([&target, &resumeValue]() {
+        int value = 21;
+        void *arg = ut::stackful::transferTo(target, &value);
+        resumeValue = *static_cast<int*>(arg);
+    }, FixedSizeStack());
+
+    bool isRunning = source();
+    assert(isRunning && !source.isDone());
+    assert(source.valueAs<int>() == 42);
+
+    int value = source.valueAs<int>();
+
+    int arg = 7;
+    isRunning = source(&arg);
+    assert(!isRunning && source.isDone());
+    assert(resumeValue == 7 && !target.isDone());
+
+    printf("yield to parent: got %d, source resumed with %d, source %s\n",
+        value, resumeValue, isRunning ? "running" : "done");
+}
+
+// If a transfer target finishes, the parent's resume call reports false while
+// the source stays suspended until deleted.
+static void targetFinishes()
+{
+    bool isSourceUnwound = false;
+    int received = 0;
+
+    StackfulCoroutine target([&received](void *arg) {
+        received = *static_cast<int*>(arg);
+    }, FixedSizeStack());
+
+    StackfulCoroutine *source = new StackfulCoroutine([&target, &isSourceUnwound]() {
+        struct Guard
+        {
+            bool& flag;
+            ~Guard() { flag = true; }
+        } guard { isSourceUnwound };
+
+        int value = 1;
+        ut::stackful::transferTo(target, &value);
+        assert(false); // never resumed
+    }, FixedSizeStack());
+
+    bool isRunning = (*source)();
+    assert(!isRunning && target.isDone() && !source->isDone());
+    assert(received == 1);
+
+    delete source;
+    assert(isSourceUnwound);
+
+    printf("target finishes: got %d, resume returned %s, source unwound on delete: %s\n",
+        received, isRunning ? "true" : "false", isSourceUnwound ? "yes" : "no");
+}
+
+}
+
+void ex_transfer_s()
+{
+    pingPong();
+    yieldToParent();
+    targetFinishes();
+}
+
+#endif // HAVE_BOOST_CONTEXT
@@ -0,0 +1,239 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifdef HAVE_IO_URING
+
+#include "Common.h"
+#include "util/Chrono.h"
+#include "util/EpollLoop.h"
+#include "util/UringService.h"
+#include <CppAsync/StacklessAsync.h>
+#include <cstring>
+#include <system_error>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//
+// Echo over loopback TCP with io_uring accept, connect, read and write. Then
+// cancel a burst of pending reads, larger than the completion queue.
+//
+
+namespace {
+
+static const int NUM_ROUNDTRIPS = 10000;
+static const unsigned RING_SIZE = 8; // completion queue holds 16
+static const int NUM_CANCELED_READS = 100;
+
+static util::UringService *sService;
+
+static int errorCode(ut::Task<std::size_t>& task)
+{
+    try {
+        task.get();
+    } catch (const std::system_error& e) {
+        return e.code().value();
+    }
+
+    return 0;
+}
+
+// Echoes bytes back until the client hangs up.
+//
+struct ServerFrame : ut::AsyncFrame<void>
+{
+    ServerFrame(int listenFd)
+        : listenFd(listenFd)
+        , fd(-1) { }
+
+    ~ServerFrame()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    void operator()()
+    {
+        ut_begin();
+
+        accepted = sService->asyncAccept(listenFd);
+        ut_await_(accepted);
+        fd = accepted.get();
+
+        while (true) {
+            io = sService->asyncRead(fd, buf, sizeof(buf));
+            ut_await_(io);
+
+            if (io.get() == 0)
+                break;
+
+            io = sService->asyncWrite(fd, buf, io.get());
+            ut_await_(io);
+        }
+
+        ut_end();
+    }
+
+private:
+    int listenFd;
+    int fd;
+    char buf[64];
+    ut::Task<int> accepted;
+    ut::Task<std::size_t> io;
+};
+
+// Sends messages and checks the echo. Finally starts reads the server never
+// answers, cancels them and counts how many failed with ECANCELED.
+//
+struct ClientFrame : ut::AsyncFrame<void>
+{
+    ClientFrame(const sockaddr_in *addr, int *numCanceled)
+        : addr(addr)
+        , numCanceled(numCanceled)
+        , fd(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))
+        , reads(NUM_CANCELED_READS) { }
+
+    ~ClientFrame()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    void operator()()
+    {
+        ut_begin();
+
+        connected = sService->asyncConnect(fd,
+            reinterpret_cast<const sockaddr*>(addr), sizeof(sockaddr_in));
+        ut_await_(connected);
+
+        for (i = 0; i < NUM_ROUNDTRIPS; i++) {
+            snprintf(msg, sizeof(msg), "ping %d", i);
+
+            io = sService->asyncWrite(fd, msg, strlen(msg));
+            ut_await_(io);
+
+            for (received = 0; received < strlen(msg); received += io.get()) {
+                io = sService->asyncRead(fd, echo + received, sizeof(echo) - received);
+                ut_await_(io);
+
+                if (io.get() == 0)
+                    break;
+            }
+
+            if (received != strlen(msg) || memcmp(msg, echo, received) != 0) {
+                printf("echo mismatch at %d\n", i);
+                break;
+            }
+        }
+
+        for (auto& read : reads)
+            read = sService->asyncRead(fd, echo, sizeof(echo));
+
+        // Some reads are still queued in user space, the rest wait in the kernel.
+        sService->cancel(fd);
+
+        for (i = 0; i < NUM_CANCELED_READS; i++) {
+            ut_await_no_throw_(reads[i]);
+
+            if (errorCode(reads[i]) == ECANCELED)
+                (*numCanceled)++;
+        }
+
+        ut_end();
+    }
+
+private:
+    const sockaddr_in *addr;
+    int *numCanceled;
+    int fd;
+    int i;
+    char msg[32];
+    char echo[32];
+    std::size_t received;
+    ut::Task<void> connected;
+    ut::Task<std::size_t> io;
+    std::vector<ut::Task<std::size_t>> reads;
+};
+
+static int listenLoopback(sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    memset(addr, 0, sizeof(sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(sockaddr_in);
+
+    if (fd < 0
+        || bind(fd, reinterpret_cast<sockaddr*>(addr), addrLen) != 0
+        || listen(fd, 1) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr*>(addr), &addrLen) != 0) {
+        perror("listening on loopback");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+}
+
+void ex_uringEcho()
+{
+    sockaddr_in addr;
+    int listenFd = listenLoopback(&addr);
+    if (listenFd < 0)
+        return;
+
+    try {
+        util::EpollLoop loop;
+        util::UringService service(loop, RING_SIZE);
+        sService = &service;
+
+        int numCanceled = 0;
+        int64_t start = util::monotonicMicroseconds();
+
+        ut::Task<void> server = ut::startAsyncOf<ServerFrame>(listenFd);
+        ut::Task<void> client = ut::startAsyncOf<ClientFrame>(&addr, &numCanceled);
+
+        // The client frame closes its socket when done, then the server sees
+        // end of stream.
+        loop.run();
+
+        int64_t elapsed = util::monotonicMicroseconds() - start;
+        bool isOk = client.isReady() && !client.hasError()
+            && server.isReady() && !server.hasError();
+
+        printf("%d roundtrips in %.1f ms -- %s\n", NUM_ROUNDTRIPS, elapsed / 1000.0,
+            isOk ? "OK" : "FAILED");
+        printf("%d / %d pending reads canceled -- %s\n", numCanceled, NUM_CANCELED_READS,
+            numCanceled == NUM_CANCELED_READS ? "OK" : "FAILED");
+
+        sService = nullptr;
+    } catch (const std::system_error& e) {
+        // E.g. io_uring_setup blocked by a seccomp filter
+        printf("io_uring unavailable: %s\n", e.what());
+        sService = nullptr;
+    }
+
+    close(listenFd);
+}
+
+#endif // HAVE_IO_URING
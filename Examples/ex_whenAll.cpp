@@ -0,0 +1,91 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include <CppAsync/Combinators.h>
+#include <stdexcept>
+#include <vector>
+
+//
+// Await groups of child tasks through whenAll() and whenSome(). See
+// Benchmark/bench_combinators.cpp for timings with up to 100k children.
+//
+
+namespace {
+
+static const int NUM_CHILDREN = 4;
+
+struct Children
+{
+    std::vector<ut::Task<int>> tasks;
+    std::vector<ut::Promise<int>> promises;
+
+    Children()
+        : tasks(NUM_CHILDREN)
+    {
+        for (auto& task : tasks)
+            promises.push_back(task.takePromise());
+    }
+
+    int indexOf(std::vector<ut::Task<int>>::iterator it) const
+    {
+        return (int) (it - tasks.begin()); // safe cast
+    }
+};
+
+}
+
+void ex_whenAll()
+{
+    {
+        Children children;
+        auto all = ut::whenAll(children.tasks);
+
+        // Completion order doesn't matter.
+        for (int i : { 3, 1, 0, 2 }) {
+            children.promises[i].complete(i * 10);
+            printf("whenAll: completed child %d, all ready: %s\n", i,
+                all.isReady() ? "yes" : "no");
+        }
+
+        assert(all.get() == children.tasks.end());
+    }
+
+    {
+        Children children;
+        auto some = ut::whenSome(2, children.tasks);
+
+        children.promises[2].complete(20);
+        children.promises[0].complete(0);
+
+        // Remaining children are detached, but keep running.
+        printf("whenSome(2): ready after children 2 and 0: %s\n",
+            some.isReady() ? "yes" : "no");
+        assert(some.isReady() && some.get() == children.tasks.end());
+    }
+
+    {
+        Children children;
+        auto all = ut::whenAll(children.tasks);
+
+        children.promises[0].complete(0);
+        children.promises[1].fail(ut::makeExceptionPtr(std::runtime_error("child failed")));
+
+        // The first failure completes whenAll() and points to the failed child.
+        printf("whenAll: failed child %d\n", children.indexOf(all.get()));
+        assert(children.indexOf(all.get()) == 1);
+    }
+}
@@ -0,0 +1,125 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include "util/Looper.h"
+#include "util/RemotePromise.h"
+#include "util/Schedule.h"
+#include "util/WorkStealingPool.h"
+#include <CppAsync/Combinators.h>
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/util/MoveOnCopy.h>
+#include <vector>
+
+//
+// Offload CPU-bound subtasks to a WorkStealingPool and await them from a Looper.
+// See Benchmark/bench_workStealingPool.cpp for timings.
+//
+
+namespace {
+
+static const int NUM_SUBTASKS = 8;
+static const int FIBO_N = 25;
+
+static util::Looper *sLooper;
+
+static long serialFibo(int n)
+{
+    return n < 2 ? n : serialFibo(n - 1) + serialFibo(n - 2);
+}
+
+static ut::Task<long> asyncFibo(int n)
+{
+    ut::Task<long> task;
+
+    // Promises are not thread safe. Compute on a pool worker, but complete
+    // the task from the Looper thread which owns it.
+    auto mvPromise = ut::makeMoveOnCopy(util::makeRemotePromise(*sLooper, task.takePromise()));
+
+    ut::schedule([n, mvPromise] {
+        mvPromise->complete(serialFibo(n));
+    });
+
+    return task;
+}
+
+struct FanOutFrame : ut::AsyncFrame<long>
+{
+    FanOutFrame()
+        : sum(0) { }
+
+    void operator()()
+    {
+        ut_begin();
+
+        for (i = 0; i < NUM_SUBTASKS; i++)
+            subtasks.push_back(asyncFibo(FIBO_N + i));
+
+        allTask = ut::whenAll(subtasks);
+        ut_await_(allTask);
+
+        for (i = 0; i < NUM_SUBTASKS; i++) {
+            printf("fibo(%d) = %ld\n", FIBO_N + i, subtasks[i].get());
+            sum += subtasks[i].get();
+        }
+
+        // Stop keep-alive.
+        sLooper->cancelAll();
+
+        ut_return(sum);
+        ut_end();
+    }
+
+private:
+    int i;
+    long sum;
+    std::vector<ut::Task<long>> subtasks;
+    ut::Task<std::vector<ut::Task<long>>::iterator> allTask;
+};
+
+static void keepAlive()
+{
+    // Looper must not quit while subtasks are running on the pool.
+    sLooper->schedule(&keepAlive, 10);
+}
+
+}
+
+void ex_workStealingPool()
+{
+    util::Looper looper;
+    util::WorkStealingPool pool;
+    sLooper = &looper;
+
+    printf("work-stealing pool with %d workers\n\n",
+        util::WorkStealingPool::defaultConcurrency());
+
+    // ut::schedule() posts to the pool, RemotePromise completes on the Looper.
+    util::ScheduleGuard scheduleGuard(pool);
+
+    ut::Task<long> task = ut::startAsyncOf<FanOutFrame>();
+
+    keepAlive();
+    looper.run();
+
+    long expected = 0;
+    for (int i = 0; i < NUM_SUBTASKS; i++)
+        expected += serialFibo(FIBO_N + i);
+
+    printf("\nsum = %ld -- %s\n", task.get(), task.get() == expected ? "OK" : "FAILED");
+
+    sLooper = nullptr;
+}
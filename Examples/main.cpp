@@ -20,6 +20,18 @@
 void ex_fibo();
 void ex_countdown();
 void ex_abortableCountdown();
+void ex_threadedTasks();
+void ex_workStealingPool();
+void ex_looperTimers();
+void ex_looperPosts();
+void ex_awaitableSet();
+void ex_whenAll();
+#ifdef __linux__
+void ex_epollLoop();
+#endif
+#ifdef HAVE_IO_URING
+void ex_uringEcho();
+#endif
 #ifdef HAVE_BOOST
 void ex_http();
 #ifdef HAVE_OPENSSL
@@ -33,6 +45,7 @@ void ex_customAwaitable();
 
 #ifdef HAVE_BOOST_CONTEXT
 void ex_fibo_s();
+void ex_transfer_s();
 void ex_countdown_s();
 void ex_abortableCountdown_s();
 void ex_http_s();
@@ -43,8 +56,15 @@ void ex_chatServer_s();
 void ex_chatClient_s();
 void ex_futureAsTask_s();
 void ex_customAwaitable_s();
+void ex_threadedTasks_s();
+void ex_stackProfile_s();
 #endif // HAVE_BOOST_CONTEXT
 
+#ifdef HAVE_CPP20_COROUTINES
+void ex_countdown_cpp20();
+void ex_taskLifetime_cpp20();
+#endif
+
 #if defined(_MSC_VER) && _MSC_FULL_VER >= 190024120
 void ex_fibo_n4402();
 void ex_countdown_n4402();
@@ -61,6 +81,18 @@ static const Example EXAMPLES[] =
     { &ex_fibo,                 "coro  - Fibonacci generator" },
     { &ex_countdown,            "async - countdown" },
     { &ex_abortableCountdown,   "async - abortable countdown" },
+    { &ex_threadedTasks,        "async - tasks on multiple threads" },
+    { &ex_workStealingPool,     "async - offload subtasks to a work-stealing pool" },
+    { &ex_looperTimers,         "async - schedule & cancel looper timers" },
+    { &ex_looperPosts,          "async - cross-thread looper posts & completions" },
+    { &ex_awaitableSet,         "async - awaitable set, take tasks as they complete" },
+    { &ex_whenAll,              "async - whenAll / whenSome over child tasks" },
+#ifdef __linux__
+    { &ex_epollLoop,            "async - epoll loop echo, timeout & remote posts" },
+#endif
+#ifdef HAVE_IO_URING
+    { &ex_uringEcho,            "async - io_uring loopback echo & cancel" },
+#endif
 #ifdef HAVE_BOOST
     { &ex_http,                 "async - HTTP download" },
     { &ex_chatServer,           "async - chat server" },
@@ -74,6 +106,7 @@ static const Example EXAMPLES[] =
 
 #ifdef HAVE_BOOST_CONTEXT
     { &ex_fibo_s,               "coro  (stackful) - Fibonacci generator" },
+    { &ex_transfer_s,           "coro  (stackful) - symmetric transfer" },
     { &ex_countdown_s,          "async (stackful) - countdown" },
     { &ex_abortableCountdown_s, "async (stackful) - abortable countdown" },
     { &ex_http_s,               "async (stackful) - HTTP download" },
@@ -84,8 +117,15 @@ static const Example EXAMPLES[] =
 #endif
     { &ex_futureAsTask_s,       "async (stackful) - boost::future as task" },
     { &ex_customAwaitable_s,    "async (stackful) - custom awaitable" },
+    { &ex_threadedTasks_s,      "async (stackful) - tasks on multiple threads" },
+    { &ex_stackProfile_s,       "async (stackful) - stack usage profile" },
 #endif // HAVE_BOOST_CONTEXT
 
+#ifdef HAVE_CPP20_COROUTINES
+    { &ex_countdown_cpp20,      "async (C++20 coroutines) - countdown" },
+    { &ex_taskLifetime_cpp20,   "async (C++20 coroutines) - frame lifetime & exceptions" },
+#endif
+
 #if defined(_MSC_VER) && _MSC_FULL_VER >= 190024120
     { &ex_fibo_n4402,           "coro  (C++17 resumable functions) - Fibonacci "
                                 "generator" },
@@ -152,7 +152,9 @@ namespace detail
                 ip::tcp::resolver::query(host, "http"), ctx);
             ut_await_(connectTask);
 
-            downloadTask = asyncHttpGet(ctx->socket, outBuf, host, path, false, ctx);
+            // Child frame goes into frameArena instead of the heap.
+            downloadTask = ut::startAsyncOf<get_frame_type>(frameArena,
+                ctx->socket, outBuf, host, path, false, true, ctx);
             ut_await_(downloadTask);
 
             ut_return(downloadTask.get());
@@ -160,6 +162,8 @@ namespace detail
         }
 
     private:
+        using get_frame_type = HttpGetFrame<ip::tcp::socket>;
+
         struct Context
         {
             ip::tcp::socket socket;
@@ -173,6 +177,9 @@ namespace detail
         const std::string path;
         ut::ContextRef<Context> ctx;
 
+        // Must outlive downloadTask.
+        ut::AsyncFrameArena<get_frame_type> frameArena;
+
         ut::Task<ip::tcp::endpoint> connectTask;
         ut::Task<std::size_t> downloadTask;
     };
@@ -247,7 +254,9 @@ namespace detail
             connectTask = asyncHttpsClientConnect(ctx->socket, host, ctx);
             ut_await_(connectTask);
 
-            downloadTask = asyncHttpGet(ctx->socket, outBuf, host, path, false, ctx);
+            // Child frame goes into frameArena instead of the heap.
+            downloadTask = ut::startAsyncOf<get_frame_type>(frameArena,
+                ctx->socket, outBuf, host, path, false, true, ctx);
             ut_await_(downloadTask);
 
             ut_return(downloadTask.get());
@@ -256,6 +265,7 @@ namespace detail
 
     private:
         using socket_type = ssl::stream<ip::tcp::socket>;
+        using get_frame_type = HttpGetFrame<socket_type>;
 
         struct Context
         {
@@ -272,6 +282,9 @@ namespace detail
         const std::string path;
         ut::ContextRef<Context> ctx;
 
+        // Must outlive downloadTask.
+        ut::AsyncFrameArena<get_frame_type> frameArena;
+
         ut::Task<ip::tcp::endpoint> connectTask;
         ut::Task<std::size_t> downloadTask;
     };
@@ -0,0 +1,573 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+
+#ifdef __linux__
+
+#include <CppAsync/Task.h>
+#include <CppAsync/util/UniqueFunction.h>
+#include "Chrono.h"
+#include "Thread.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace util {
+
+namespace detail
+{
+    namespace epoll
+    {
+        inline ut::Error makeSystemError(int code) _ut_noexcept
+        {
+#ifdef UT_NO_EXCEPTIONS
+            return ut::Error(code);
+#else
+            return ut::makeExceptionPtr(std::system_error(code, std::system_category()));
+#endif
+        }
+
+        inline int checkSyscall(int result, const char *what)
+        {
+            if (result < 0) {
+#ifdef UT_NO_EXCEPTIONS
+                perror(what);
+                std::abort();
+#else
+                throw std::system_error(errno, std::system_category(), what);
+#endif
+            }
+
+            return result;
+        }
+    }
+}
+
+//
+// EpollLoop
+//
+
+/**
+ * Single-threaded run loop for Linux, built on epoll. Awaits file descriptor
+ * readiness and deadlines without depending on Boost.Asio.
+ *
+ * Deadlines are kept in a min-heap and share a single timerfd, which is armed
+ * for the earliest one. Actions posted from other threads are queued under a
+ * lock and signaled through an eventfd.
+ *
+ * Readiness is level-triggered and may be reported spuriously, retry the
+ * I/O operation until it fails with EAGAIN before awaiting again. Interest in
+ * a descriptor is kept after waking its awaiter, so a task that awaits the
+ * same descriptor again costs no epoll_ctl() call. Interest that is no longer
+ * needed is dropped on the next event, or when the loop runs out of work.
+ *
+ * Plug it into CppAsync with util::ScheduleGuard (see util/Schedule.h and
+ * ex_epollLoop.cpp).
+ */
+class EpollLoop
+{
+public:
+    using Action = ut::UniqueFunction<void ()>;
+
+    EpollLoop()
+        : mEpollFd(-1)
+        , mWakeupFd(-1)
+        , mTimerFd(-1)
+        , mTimerCounter(0)
+        , mArmedDeadline(Timepoint::max())
+        , mHasRemotePosted(false)
+        , mGeneration(0)
+        , mQuit(false)
+    {
+        using detail::epoll::checkSyscall;
+
+        mEpollFd = checkSyscall(epoll_create1(EPOLL_CLOEXEC), "epoll_create1");
+        mWakeupFd = checkSyscall(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+        mTimerFd = checkSyscall(timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC), "timerfd_create");
+
+        for (int fd : { mWakeupFd, mTimerFd }) {
+            epoll_event event = epoll_event();
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+
+            checkSyscall(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event), "epoll_ctl");
+        }
+    }
+
+    ~EpollLoop() _ut_noexcept
+    {
+        releaseAll();
+
+        close(mTimerFd);
+        close(mWakeupFd);
+        close(mEpollFd);
+    }
+
+    /** Loop running on this thread, if any */
+    static EpollLoop* current() _ut_noexcept
+    {
+        return currentLoop();
+    }
+
+    /** Runs until quit() gets called or there is nothing left to do */
+    void run()
+    {
+        EpollLoop*& current = currentLoop();
+        EpollLoop *outer = current;
+        current = this;
+
+        mQuit = false;
+        while (!mQuit) {
+            runPosted();
+            if (mQuit)
+                break;
+
+            expireTimers(monotonicTime());
+            if (mQuit || !hasWork())
+                break;
+
+            wait();
+        }
+
+        current = outer;
+    }
+
+    /** Cancels everything pending and stops the loop */
+    void quit()
+    {
+        assert(currentLoop() == this &&
+            "quit() called from outside the loop!");
+
+        cancelAll();
+        mQuit = true;
+    }
+
+    /** Drops posted actions, deadlines and descriptor waits, canceling their tasks */
+    void cancelAll()
+    {
+        assert(currentLoop() == this &&
+            "cancelAll() called from outside the loop!");
+
+        releaseAll();
+    }
+
+    /** thread safe */
+    template <class F>
+    void post(F&& f)
+    {
+        if (currentLoop() == this) {
+            mPosted.emplace_back(std::forward<F>(f));
+            return;
+        }
+
+        bool isFirst;
+        {
+            LockGuard _(mRemoteMutex);
+            isFirst = mRemotePosted.empty();
+            mRemotePosted.emplace_back(std::forward<F>(f));
+            mHasRemotePosted.store(true, std::memory_order_release);
+        }
+
+        // The loop drains the whole queue when woken, only the first post signals.
+        if (isFirst) {
+            uint64_t one = 1;
+            ssize_t result = write(mWakeupFd, &one, sizeof(one));
+            (void) result;
+        }
+    }
+
+    /** Task completes once the deadline has passed */
+    ut::Task<void> asyncWaitUntil(Timepoint deadline)
+    {
+        ut::Task<void> task;
+
+        mTimers.push_back(TimerEntry { deadline, ++mTimerCounter, task.takePromise() });
+        std::push_heap(mTimers.begin(), mTimers.end(), LaterFirst());
+
+        return task;
+    }
+
+    /** Task completes after delay in milliseconds */
+    ut::Task<void> asyncDelay(long milliseconds)
+    {
+        return asyncWaitUntil(monotonicTime() + util::chrono::milliseconds(milliseconds));
+    }
+
+    /** Task completes when fd is readable, hung up or has an error. One reader per fd. */
+    ut::Task<void> asyncReadable(int fd)
+    {
+        return awaitDescriptor(fd, &FdWatch::reader);
+    }
+
+    /** Task completes when fd is writable, hung up or has an error. One writer per fd. */
+    ut::Task<void> asyncWritable(int fd)
+    {
+        return awaitDescriptor(fd, &FdWatch::writer);
+    }
+
+private:
+    EpollLoop(const EpollLoop& other) = delete;
+    EpollLoop& operator=(const EpollLoop& other) = delete;
+
+    using Mutex = util::threading::mutex;
+    using LockGuard = util::threading::lock_guard<Mutex>;
+
+    static const int MAX_EVENTS = 64;
+
+    struct TimerEntry
+    {
+        Timepoint deadline;
+        uint64_t sequence;
+        ut::Promise<void> promise;
+    };
+
+    struct LaterFirst
+    {
+        bool operator()(const TimerEntry& a, const TimerEntry& b) const _ut_noexcept
+        {
+            return b.deadline < a.deadline
+                || (b.deadline == a.deadline && b.sequence < a.sequence);
+        }
+    };
+
+    struct FdWatch
+    {
+        ut::Promise<void> reader;
+        ut::Promise<void> writer;
+        uint32_t events; // registered interest, 0 if not registered
+        bool isListed;   // in mWaitedFds
+
+        FdWatch() _ut_noexcept
+            : events(0)
+            , isListed(false) { }
+    };
+
+    static EpollLoop*& currentLoop() _ut_noexcept
+    {
+        static _ut_thread_local EpollLoop *sCurrent = nullptr;
+        return sCurrent;
+    }
+
+    ut::Task<void> awaitDescriptor(int fd, ut::Promise<void> FdWatch::*which)
+    {
+        assert(fd >= 0);
+
+        if ((std::size_t) fd >= mWatches.size()) // safe cast
+            mWatches.resize(fd + 1);
+
+        FdWatch& watch = mWatches[fd];
+        ut::Promise<void>& promise = watch.*which;
+
+        assert(!promise.isCompletable() && "Descriptor already awaited in this direction");
+
+        ut::Task<void> task;
+        promise = task.takePromise();
+
+        int error = updateInterest(fd, watch);
+        if (error != 0) {
+            promise.fail(detail::epoll::makeSystemError(error));
+        } else if (!watch.isListed) {
+            watch.isListed = true;
+            mWaitedFds.push_back(fd);
+        }
+
+        return task;
+    }
+
+    // Registers interest in whatever events are still awaited. Returns errno on failure.
+    int updateInterest(int fd, FdWatch& watch) _ut_noexcept
+    {
+        uint32_t events = (watch.reader.isCompletable() ? (uint32_t) (EPOLLIN | EPOLLRDHUP) : 0)
+            | (watch.writer.isCompletable() ? (uint32_t) EPOLLOUT : 0);
+
+        if (events == watch.events)
+            return 0;
+
+        epoll_event event = epoll_event();
+        event.events = events;
+        event.data.fd = fd;
+
+        if (events == 0) {
+            // May fail if fd has been closed in the meantime, which unregisters it anyway.
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, &event);
+
+            watch.events = 0;
+            return 0;
+        }
+
+        int result;
+        if (watch.events == 0) {
+            result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event);
+        } else {
+            result = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &event);
+
+            // Descriptor was closed while registered, and its number got reused.
+            if (result < 0 && errno == ENOENT)
+                result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+
+        if (result < 0)
+            return errno;
+
+        watch.events = events;
+
+        return 0;
+    }
+
+    void runPosted()
+    {
+        // Actions may post more actions while running, those wait for the next round.
+        mRunning.swap(mPosted);
+
+        // Indexed loop, cancelAll() may clear the batch.
+        for (std::size_t i = 0; i < mRunning.size(); i++) {
+            Action action(std::move(mRunning[i]));
+
+#ifdef UT_NO_EXCEPTIONS
+            action();
+#else
+            try {
+                action();
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Uncaught exception while running loop action: %s\n",
+                    e.what());
+                assert (false);
+            }
+#endif
+            if (mQuit)
+                break;
+        }
+
+        mRunning.clear();
+    }
+
+    void expireTimers(Timepoint now)
+    {
+        // Also drop canceled timers, so they don't keep the loop alive.
+        while (!mTimers.empty() && (mTimers.front().deadline <= now
+                || !mTimers.front().promise.isCompletable())) {
+            std::pop_heap(mTimers.begin(), mTimers.end(), LaterFirst());
+
+            ut::Promise<void> promise(std::move(mTimers.back().promise));
+            mTimers.pop_back();
+
+            if (promise.isCompletable())
+                promise.complete();
+
+            if (mQuit)
+                return;
+        }
+    }
+
+    bool hasWork()
+    {
+        if (!mPosted.empty() || !mTimers.empty() || hasDescriptorWaiter())
+            return true;
+
+        return mHasRemotePosted.load(std::memory_order_acquire);
+    }
+
+    // Descriptor waits may have been completed or canceled since they were listed.
+    // Unlists those from the back until a live one is found, dropping their interest.
+    // Each fd is listed once per wait, so this is amortized O(1).
+    bool hasDescriptorWaiter() _ut_noexcept
+    {
+        while (!mWaitedFds.empty()) {
+            int fd = mWaitedFds.back();
+            FdWatch& watch = mWatches[fd];
+
+            if (watch.reader.isCompletable() || watch.writer.isCompletable())
+                return true;
+
+            mWaitedFds.pop_back();
+            watch.isListed = false;
+            updateInterest(fd, watch);
+        }
+
+        return false;
+    }
+
+    void armTimer() _ut_noexcept
+    {
+        Timepoint deadline = mTimers.empty() ? Timepoint::max() : mTimers.front().deadline;
+
+        if (deadline == mArmedDeadline)
+            return;
+
+        mArmedDeadline = deadline;
+
+        itimerspec spec = itimerspec(); // all zero disarms the timer
+        if (deadline != Timepoint::max()) {
+            // Relative, since Timepoint may not be based on CLOCK_MONOTONIC.
+            int64_t us = std::max((int64_t) 1, (int64_t) (deadline - monotonicTime()).count());
+
+            spec.it_value.tv_sec = (time_t) (us / 1000000);
+            spec.it_value.tv_nsec = (long) (us % 1000000) * 1000;
+        }
+
+        timerfd_settime(mTimerFd, 0, &spec, nullptr);
+    }
+
+    void wait()
+    {
+        armTimer();
+
+        int numEvents = epoll_wait(mEpollFd, mEvents, MAX_EVENTS, mPosted.empty() ? -1 : 0);
+        if (numEvents < 0) {
+            assert(errno == EINTR);
+            return;
+        }
+
+        // Awaiters resumed below may cancel everything, the rest of the batch is stale then.
+        uint64_t generation = mGeneration;
+
+        for (int i = 0; i < numEvents && !mQuit && generation == mGeneration; i++) {
+            const epoll_event& event = mEvents[i];
+
+            if (event.data.fd == mWakeupFd) {
+                acceptRemotePosts();
+            } else if (event.data.fd == mTimerFd) {
+                uint64_t numExpirations;
+                ssize_t result = read(mTimerFd, &numExpirations, sizeof(numExpirations));
+                (void) result;
+
+                // Timers get collected on the next round. Rearm even if the earliest
+                // deadline is still ahead, clocks may disagree by a few microseconds.
+                mArmedDeadline = Timepoint::min();
+            } else {
+                dispatch(event);
+            }
+        }
+    }
+
+    void acceptRemotePosts()
+    {
+        uint64_t count;
+        ssize_t result = read(mWakeupFd, &count, sizeof(count));
+        (void) result;
+
+        LockGuard _(mRemoteMutex);
+
+        for (auto& action : mRemotePosted)
+            mPosted.push_back(std::move(action));
+        mRemotePosted.clear();
+        mHasRemotePosted.store(false, std::memory_order_relaxed);
+    }
+
+    void dispatch(const epoll_event& event)
+    {
+        int fd = event.data.fd;
+        assert((std::size_t) fd < mWatches.size()); // safe cast
+
+        FdWatch& watch = mWatches[fd];
+
+        bool isFailed = (event.events & (EPOLLERR | EPOLLHUP)) != 0;
+
+        ut::Promise<void> reader, writer;
+        if (isFailed || (event.events & (EPOLLIN | EPOLLRDHUP)) != 0)
+            reader = std::move(watch.reader);
+        if (isFailed || (event.events & EPOLLOUT) != 0)
+            writer = std::move(watch.writer);
+
+        if (!reader.isCompletable() && !writer.isCompletable()) {
+            // Nobody is waiting for this event anymore.
+            updateInterest(fd, watch);
+            return;
+        }
+
+        // Keep interest, the awaiters are likely to await the same fd again.
+        if (reader.isCompletable())
+            reader.complete();
+        if (writer.isCompletable())
+            writer.complete();
+    }
+
+    void releaseAll() _ut_noexcept
+    {
+        // Move everything out first, canceled tasks may reenter the loop.
+        std::vector<Action> posted;
+        std::vector<TimerEntry> timers;
+        std::vector<FdWatch> watches;
+
+        mGeneration++;
+
+        posted.swap(mPosted);
+        mRunning.clear();
+        timers.swap(mTimers);
+        watches.swap(mWatches);
+        mWaitedFds.clear();
+
+        for (std::size_t fd = 0; fd < watches.size(); fd++) {
+            if (watches[fd].events != 0) {
+                epoll_event event = epoll_event();
+                epoll_ctl(mEpollFd, EPOLL_CTL_DEL, (int) fd, &event); // safe cast
+            }
+        }
+
+        std::vector<Action> remotePosted;
+
+        LockGuard _(mRemoteMutex);
+        remotePosted.swap(mRemotePosted);
+        mHasRemotePosted.store(false, std::memory_order_relaxed);
+    }
+
+    int mEpollFd;
+    int mWakeupFd;
+    int mTimerFd;
+
+    std::vector<Action> mPosted;
+    std::vector<Action> mRunning;
+
+    // Indexed by fd
+    std::vector<FdWatch> mWatches;
+
+    // Descriptors that got awaited since they were last found idle
+    std::vector<int> mWaitedFds;
+
+    // Min-heap on (deadline, sequence)
+    std::vector<TimerEntry> mTimers;
+    uint64_t mTimerCounter;
+    Timepoint mArmedDeadline;
+
+    Mutex mRemoteMutex;
+    std::vector<Action> mRemotePosted;
+    std::atomic<bool> mHasRemotePosted;
+
+    // Bumped by releaseAll(), invalidates the epoll_wait() batch being dispatched
+    uint64_t mGeneration;
+
+    epoll_event mEvents[MAX_EVENTS];
+    bool mQuit;
+};
+
+}
+
+#endif // __linux__
@@ -17,188 +17,616 @@
 #pragma once
 
 #include "../Common.h"
+#include <CppAsync/Scheduler.h>
 #include <CppAsync/util/TypeTraits.h>
+#include <CppAsync/util/UniqueFunction.h>
 #include "Chrono.h"
-#include "Function.h"
+#include "MpscQueue.h"
 #include "Thread.h"
+#include "WakeupEvent.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <utility>
 #include <vector>
 
 namespace util {
 
-using Ticket = uint32_t;
+/**
+ * Identifies a scheduled action. Encodes slot generation and index for actions
+ * scheduled from the loop thread, or a sequence number for remote actions.
+ */
+using Ticket = uint64_t;
+
+/**
+ * Scheduled action. Closures up to ut::default_function_capacity are stored
+ * inline, so posting them doesn't allocate (besides growing the slot table).
+ */
+using Action = ut::UniqueFunction<void ()>;
 
 namespace detail
 {
-    class LoopContext
+    struct FourPointerClosure
+    {
+        void *captures[4];
+
+        void operator()() { }
+    };
+}
+
+// ut::scheduleWithTicket() keeps the closure in its ticket slot, and schedules
+// only the slot pointer and generation.
+static_assert(ut::detail::TicketSlot::function_type::IsInline<detail::FourPointerClosure>::value
+    && Action::IsInline<ut::detail::TicketedAction>::value,
+    "Ticketed closures of up to four pointers should be stored inline");
+
+namespace detail
+{
+    //
+    // Maps remote tickets to slot indices with open addressing and linear
+    // probing. Its size follows the number of live remote actions, however far
+    // apart their tickets are.
+    //
+
+    class RemoteSlotMap
     {
     public:
-        LoopContext() _ut_noexcept
-            : mTicketCounter(0) { }
+        static const uint32_t NO_INDEX = UINT32_MAX;
 
-        void runQueued(bool *quit)
+        RemoteSlotMap() _ut_noexcept
+            : mSize(0) { }
+
+        /** Make room for one more entry, so that insert() can't fail */
+        void reserveOne()
         {
-            Timepoint now = monotonicTime();
+            if (2 * (mSize + 1) > mEntries.size())
+                rehash(std::max<std::size_t>(16, 2 * mEntries.size()));
+        }
 
-            for (auto& action : mQueuedActions) {
-                if (action.isCanceled)
-                    continue;
+        void insert(Ticket ticket, uint32_t index) _ut_noexcept
+        {
+            ut_dcheck(ticket != 0);
+            ut_dcheck(2 * (mSize + 1) <= mEntries.size());
 
-                if (action.triggerTime <= now) {
-#ifdef UT_NO_EXCEPTIONS
-                    action.f();
-#else
-                    try {
-                        action.f();
-                    } catch (const std::exception& e) {
-                        fprintf(stderr, "Uncaught exception while running loop action: %s\n",
-                            e.what());
-                        assert (false);
-                    }
-#endif
-                    action.isCanceled = true;
+            std::size_t pos = home(ticket);
+            while (mEntries[pos].ticket != 0)
+                pos = (pos + 1) & mask();
+
+            mEntries[pos] = Entry { ticket, index };
+            mSize++;
+        }
+
+        uint32_t find(Ticket ticket) const _ut_noexcept
+        {
+            std::size_t pos = findPosition(ticket);
+            if (pos == NO_POSITION)
+                return NO_INDEX;
+
+            return mEntries[pos].index;
+        }
 
-                    if (*quit) // running the action may have triggered quit
-                        break;
+        void erase(Ticket ticket) _ut_noexcept
+        {
+            std::size_t hole = findPosition(ticket);
+            if (hole == NO_POSITION)
+                return;
+
+            // Shift back later entries of the probe run, no tombstones needed.
+            for (std::size_t pos = (hole + 1) & mask(); mEntries[pos].ticket != 0;
+                pos = (pos + 1) & mask()) {
+                std::size_t entryHome = home(mEntries[pos].ticket);
+
+                // Entry may move to the hole unless its home lies in (hole, pos].
+                bool isReachable = (hole <= pos)
+                    ? (entryHome <= hole || entryHome > pos)
+                    : (entryHome <= hole && entryHome > pos);
+
+                if (isReachable) {
+                    mEntries[hole] = mEntries[pos];
+                    hole = pos;
                 }
             }
+
+            mEntries[hole].ticket = 0;
+            mSize--;
         }
 
-        Timepoint queuePending() _ut_noexcept // must have lock
+        std::size_t size() const _ut_noexcept
         {
-            for (auto& action : mQueuedActions) {
-                if (!action.isCanceled)
-                    mPendingActions.push_back(std::move(action));
-            }
+            return mSize;
+        }
 
-            mQueuedActions.clear();
-            mQueuedActions.swap(mPendingActions);
+        std::size_t capacity() const _ut_noexcept
+        {
+            return mEntries.size();
+        }
+
+    private:
+        static const std::size_t NO_POSITION = SIZE_MAX;
 
-            auto wakeTime = Timepoint::max();
+        struct Entry
+        {
+            Ticket ticket; // 0 if empty
+            uint32_t index;
+        };
 
-            for (auto& action : mQueuedActions) {
-                if (action.triggerTime < wakeTime)
-                    wakeTime = action.triggerTime;
+        std::size_t mask() const _ut_noexcept
+        {
+            return mEntries.size() - 1;
+        }
+
+        std::size_t home(Ticket ticket) const _ut_noexcept
+        {
+            // Fibonacci hashing spreads consecutive tickets.
+            return (std::size_t) ((ticket * 0x9e3779b97f4a7c15ull) >> 32) & mask(); // safe cast
+        }
+
+        std::size_t findPosition(Ticket ticket) const _ut_noexcept
+        {
+            if (mSize == 0)
+                return NO_POSITION;
+
+            for (std::size_t pos = home(ticket); mEntries[pos].ticket != 0;
+                pos = (pos + 1) & mask()) {
+                if (mEntries[pos].ticket == ticket)
+                    return pos;
             }
 
-            return wakeTime;
+            return NO_POSITION;
         }
 
-        bool hasPending() const _ut_noexcept // must have lock
+        void rehash(std::size_t capacity)
         {
-            return !mPendingActions.empty();
+            std::vector<Entry> entries(capacity, Entry { 0, 0 });
+            entries.swap(mEntries);
+            mSize = 0;
+
+            for (const Entry& entry : entries) {
+                if (entry.ticket != 0)
+                    insert(entry.ticket, entry.index);
+            }
+        }
+
+        std::vector<Entry> mEntries; // power of two
+        std::size_t mSize;
+    };
+
+    //
+    // Actions live in a slot table. Delayed actions are ordered by an indexed
+    // min-heap on (trigger time, sequence number), while posted actions are
+    // simply appended to a ready list. Tickets resolve to slots in O(1), so
+    // canceling doesn't involve any searching.
+    //
+    // The context is accessed only from the loop thread. Actions scheduled from
+    // other threads are handed over through a lock-free queue, see Looper.
+    //
+
+    class LoopContext
+    {
+    public:
+        static const Ticket REMOTE_TICKET_FLAG = (Ticket) 1 << 63;
+
+        LoopContext() _ut_noexcept
+            : mFreeSlot(NO_INDEX)
+            , mSequenceCounter(0) { }
+
+        Timepoint nextTriggerTime() const _ut_noexcept
+        {
+            if (!mReady.empty())
+                return mReady.front().triggerTime;
+
+            return mHeap.empty() ? Timepoint::max() : mHeap.front().triggerTime;
         }
 
-        template <typename F>
-        Ticket schedule(F&& f, Timepoint triggerTime) // must have lock
+        Ticket schedule(Action&& f, Timepoint triggerTime, Ticket remoteTicket = 0)
         {
-            return scheduleImpl(std::forward<F>(f), triggerTime);
+            return insert(mHeap, std::move(f), triggerTime, SLOT_QUEUED, remoteTicket);
         }
 
-        bool tryCancelQueued(Ticket ticket) _ut_noexcept
+        Ticket post(Action&& f, Timepoint now, Ticket remoteTicket = 0)
         {
-            for (auto& action : mQueuedActions) {
-                if (action.ticket == ticket) {
-                    if (!action.isCanceled) {
-                        action.isCanceled = true;
-                        return true;
-                    }
+            return insert(mReady, std::move(f), now, SLOT_READY, remoteTicket);
+        }
 
+        void collectDue(Timepoint now)
+        {
+            // Merge ready and expired actions, preserving (trigger time, sequence) order.
+            auto ready = mReady.begin(), readyEnd = mReady.end();
+
+            while (true) {
+                while (ready != readyEnd && ready->slot == NO_INDEX)
+                    ++ready; // skip canceled
+
+                bool hasReady = (ready != readyEnd);
+                bool hasExpired = !mHeap.empty() && mHeap.front().triggerTime <= now;
+
+                if (hasExpired && (!hasReady || mHeap.front() < *ready)) {
+                    uint32_t index = mHeap.front().slot;
+                    removeFromHeap(0);
+                    collect(index);
+                } else if (hasReady) {
+                    collect(ready->slot);
+                    ++ready;
+                } else {
                     break;
                 }
             }
 
-            return false;
+            mReady.clear();
         }
 
-        bool tryCancelPending(Ticket ticket) _ut_noexcept // must have lock
+        void runCollected(bool *quit)
         {
-            for (auto it = mPendingActions.begin(), end = mPendingActions.end(); it != end; ++it) {
-                auto& action = *it;
+            // Slots have stable addresses, actions may schedule more actions while running.
+            for (ActionSlot *slot : mCollected) {
+                if (slot->state != SLOT_COLLECTED)
+                    continue; // canceled
 
-                if (action.ticket == ticket) {
-                    assert (!action.isCanceled);
+                slot->state = SLOT_FINISHED;
 
-                    mPendingActions.erase(it);
-                    return true;
+#ifdef UT_NO_EXCEPTIONS
+                slot->f();
+#else
+                try {
+                    slot->f();
+                } catch (const std::exception& e) {
+                    fprintf(stderr, "Uncaught exception while running loop action: %s\n",
+                        e.what());
+                    assert (false);
                 }
+#endif
+                slot->f = nullptr;
+
+                if (*quit) // running the action may have triggered quit
+                    break;
             }
+        }
 
-            return false;
+        void releaseCollected() _ut_noexcept
+        {
+            for (ActionSlot *slot : mCollected) {
+                Action f(std::move(slot->f));
+                freeSlot(slot->index);
+            }
+
+            mCollected.clear();
         }
 
-        void cancelAllQueued() _ut_noexcept
+        bool tryCancel(Ticket ticket) _ut_noexcept
         {
-            for (auto& action : mQueuedActions) {
-                action.isCanceled = true;
+            uint32_t index;
+
+            if ((ticket & REMOTE_TICKET_FLAG) != 0) {
+                // Released already, or not accepted yet.
+                index = mRemoteSlots.find(ticket);
+                if (index == NO_INDEX)
+                    return false;
+            } else {
+                index = (uint32_t) ticket; // safe cast
+                uint32_t generation = (uint32_t) (ticket >> 32); // safe cast
+
+                if (index >= mSlots.size() || mSlots[index].generation != generation)
+                    return false;
             }
+
+            ActionSlot& slot = mSlots[index];
+
+            switch (slot.state) {
+            case SLOT_QUEUED:
+                removeFromHeap(slot.position);
+                break;
+            case SLOT_READY:
+                mReady[slot.position].slot = NO_INDEX;
+                break;
+            case SLOT_COLLECTED:
+                // Functor is released after running the batch.
+                slot.state = SLOT_FINISHED;
+                return true;
+            default:
+                return false;
+            }
+
+            // Release functor after updating state, it might reenter the loop.
+            Action f(std::move(slot.f));
+            freeSlot(index);
+
+            return true;
         }
 
-        void cancelAllPending() _ut_noexcept // must have lock
+        void cancelAll() _ut_noexcept
         {
-            mPendingActions.clear();
+            std::vector<Action> fs;
+
+            for (ActionSlot *slot : mCollected)
+                slot->state = SLOT_FINISHED;
+
+            for (auto *queue : { &mReady, &mHeap }) {
+                for (auto& entry : *queue) {
+                    if (entry.slot == NO_INDEX)
+                        continue;
+
+                    fs.push_back(std::move(mSlots[entry.slot].f));
+                    freeSlot(entry.slot);
+                }
+
+                queue->clear();
+            }
+        }
+
+        std::size_t remoteSlotCapacity() const _ut_noexcept
+        {
+            return mRemoteSlots.capacity();
         }
 
     private:
-        class ManagedAction
+        static const uint32_t NO_INDEX = RemoteSlotMap::NO_INDEX;
+
+        enum SlotState
+        {
+            SLOT_FREE,
+            SLOT_QUEUED,
+            SLOT_READY,
+            SLOT_COLLECTED,
+            SLOT_FINISHED
+        };
+
+        struct ActionSlot
+        {
+            Action f;
+            Ticket remoteTicket;
+            uint32_t index;
+            uint32_t generation;
+            SlotState state;
+
+            // Heap index if queued, ready list index if ready, next free slot if free.
+            uint32_t position;
+        };
+
+        struct QueueEntry
         {
-        public:
-            Ticket ticket;
             Timepoint triggerTime;
-            bool isCanceled;
-            Function<void ()> f;
-
-            template <class F>
-            ManagedAction(Ticket ticket, Timepoint triggerTime, const F& f)
-                : ticket(ticket)
-                , triggerTime(triggerTime)
-                , isCanceled(false)
-                , f(f) { }
-
-            template <class F>
-            ManagedAction(Ticket ticket, Timepoint triggerTime, F&& f)
-                : ticket(ticket)
-                , triggerTime(triggerTime)
-                , isCanceled(false)
-                , f(std::move(f)) { }
-
-            ManagedAction(ManagedAction&& other) _ut_noexcept // noexcept abuse
-                : ticket(other.ticket)
-                , triggerTime(other.triggerTime)
-                , isCanceled(other.isCanceled)
-                , f(std::move(other.f)) { }
-
-            ManagedAction& operator=(ManagedAction&& other) _ut_noexcept // noexcept abuse
-            {
-                ticket = other.ticket;
-                triggerTime = other.triggerTime;
-                isCanceled = other.isCanceled;
-                f = std::move(other.f);
+            uint64_t sequence;
+            uint32_t slot;
 
-                return *this;
+            bool operator<(const QueueEntry& other) const _ut_noexcept
+            {
+                return triggerTime < other.triggerTime
+                    || (triggerTime == other.triggerTime && sequence < other.sequence);
             }
         };
 
+        static Ticket makeTicket(uint32_t generation, uint32_t index) _ut_noexcept
+        {
+            return ((Ticket) generation << 32) | index;
+        }
+
+        Ticket insert(std::vector<QueueEntry>& queue, Action&& f,
+            Timepoint triggerTime, SlotState state, Ticket remoteTicket)
+        {
+            // Grow first, so the slot doesn't leak if allocation fails.
+            if (queue.size() == queue.capacity())
+                queue.reserve(2 * queue.size() + 16);
+
+            if (remoteTicket != 0)
+                mRemoteSlots.reserveOne();
+
+            uint32_t index = allocateSlot();
+            ActionSlot& slot = mSlots[index];
+
+            slot.f = std::move(f);
+            slot.remoteTicket = remoteTicket;
+            slot.state = state;
+            slot.position = (uint32_t) queue.size(); // safe cast
+
+            queue.push_back(QueueEntry { triggerTime, ++mSequenceCounter, index });
+
+            if (state == SLOT_QUEUED)
+                siftUp(slot.position);
+
+            if (remoteTicket != 0) {
+                mRemoteSlots.insert(remoteTicket, index);
+                return remoteTicket;
+            }
+
+            return makeTicket(slot.generation, index);
+        }
+
+        void collect(uint32_t index)
+        {
+            ActionSlot& slot = mSlots[index];
+            slot.state = SLOT_COLLECTED;
+
+            mCollected.push_back(&slot);
+        }
+
+        uint32_t allocateSlot()
+        {
+            if (mFreeSlot == NO_INDEX) {
+                mSlots.emplace_back();
+
+                ActionSlot& slot = mSlots.back();
+                slot.index = (uint32_t) mSlots.size() - 1; // safe cast
+                slot.generation = 1;
+                slot.state = SLOT_FREE;
+
+                return slot.index;
+            }
+
+            uint32_t index = mFreeSlot;
+            mFreeSlot = mSlots[index].position;
+
+            return index;
+        }
+
+        void freeSlot(uint32_t index) _ut_noexcept
+        {
+            ActionSlot& slot = mSlots[index];
+
+            if (slot.remoteTicket != 0)
+                mRemoteSlots.erase(slot.remoteTicket);
+
+            // Invalidate ticket. Keep generation within 31 bits, so that local
+            // tickets never collide with remote ones.
+            slot.generation = (slot.generation & 0x7fffffff) + 1;
+            slot.state = SLOT_FREE;
+            slot.position = mFreeSlot;
+            mFreeSlot = index;
+        }
+
+        void placeInHeap(uint32_t position, const QueueEntry& entry) _ut_noexcept
+        {
+            mHeap[position] = entry;
+            mSlots[entry.slot].position = position;
+        }
+
+        void siftUp(uint32_t position) _ut_noexcept
+        {
+            QueueEntry entry = mHeap[position];
+
+            while (position > 0) {
+                uint32_t parent = (position - 1) / 2;
+
+                if (!(entry < mHeap[parent]))
+                    break;
+
+                placeInHeap(position, mHeap[parent]);
+                position = parent;
+            }
+
+            placeInHeap(position, entry);
+        }
+
+        void siftDown(uint32_t position) _ut_noexcept
+        {
+            QueueEntry entry = mHeap[position];
+            uint32_t size = (uint32_t) mHeap.size(); // safe cast
+
+            while (true) {
+                uint32_t child = 2 * position + 1;
+                if (child >= size)
+                    break;
+
+                if (child + 1 < size && mHeap[child + 1] < mHeap[child])
+                    child++;
+
+                if (!(mHeap[child] < entry))
+                    break;
+
+                placeInHeap(position, mHeap[child]);
+                position = child;
+            }
+
+            placeInHeap(position, entry);
+        }
+
+        void removeFromHeap(uint32_t position) _ut_noexcept
+        {
+            uint32_t last = (uint32_t) mHeap.size() - 1; // safe cast
+
+            if (position != last) {
+                QueueEntry moved = mHeap[last];
+                bool isEarlier = moved < mHeap[position];
+
+                placeInHeap(position, moved);
+                mHeap.pop_back();
+
+                if (isEarlier)
+                    siftUp(position);
+                else
+                    siftDown(position);
+            } else {
+                mHeap.pop_back();
+            }
+        }
+
+        uint32_t mFreeSlot;
+        uint64_t mSequenceCounter;
+
+        // Deque keeps slot addresses stable while growing.
+        std::deque<ActionSlot> mSlots;
+        std::vector<QueueEntry> mHeap;
+        std::vector<QueueEntry> mReady;
+        std::vector<ActionSlot*> mCollected;
+
+        // Remote tickets are sequence numbers assigned before reaching the loop
+        // thread, they get mapped to slots once accepted.
+        RemoteSlotMap mRemoteSlots;
+    };
+
+    //
+    // Remote nodes are either actions scheduled from another thread, or promise
+    // completions (see RemotePromise). Completions are allocated up front by the
+    // thread owning the promise, so handing them back costs no allocation.
+    //
+
+    struct RemoteNode : MpscNode
+    {
+        // Called on the loop thread, takes ownership of node. Null for actions.
+        using deliver_type = void (*)(RemoteNode *node, bool isCanceled);
+
+        deliver_type deliver;
+        Timepoint scheduleTime;
+
+        RemoteNode(deliver_type deliver, Timepoint scheduleTime) _ut_noexcept
+            : deliver(deliver)
+            , scheduleTime(scheduleTime) { }
+    };
+
+    struct RemoteAction : RemoteNode
+    {
+        Ticket ticket;
+        long delay;
+        Action f;
+
         template <class F>
-        Ticket scheduleImpl(F&& f, Timepoint triggerTime)
+        RemoteAction(Ticket ticket, long delay, Timepoint scheduleTime, F&& f)
+            : RemoteNode(nullptr, scheduleTime)
+            , ticket(ticket)
+            , delay(delay)
+            , f(std::forward<F>(f)) { }
+    };
+
+    // Runs as a regular posted action. Releases the node even if canceled.
+    class RemoteDelivery
+    {
+    public:
+        explicit RemoteDelivery(RemoteNode *node) _ut_noexcept
+            : mNode(node) { }
+
+        RemoteDelivery(RemoteDelivery&& other) _ut_noexcept
+            : mNode(other.mNode)
         {
-            mPendingActions.emplace_back(
-                ++mTicketCounter, triggerTime, std::forward<F>(f));
+            other.mNode = nullptr;
+        }
 
-            return mPendingActions.back().ticket;
+        ~RemoteDelivery() _ut_noexcept
+        {
+            if (mNode != nullptr)
+                mNode->deliver(mNode, true);
         }
 
-        unsigned int mTicketCounter;
+        void operator()()
+        {
+            RemoteNode *node = mNode;
+            mNode = nullptr;
 
-        // Queued actions are accessed only from run loop thread. No locking required.
-        std::vector<ManagedAction> mQueuedActions;
+            node->deliver(node, false);
+        }
 
-        // Pending actions may be enqueued from any thread. Locking is required.
-        std::vector<ManagedAction> mPendingActions;
+    private:
+        RemoteDelivery(const RemoteDelivery& other) = delete;
+        RemoteDelivery& operator=(const RemoteDelivery& other) = delete;
+
+        RemoteNode *mNode;
     };
 }
 
+template <class R>
+class RemotePromise;
+
 //
 // Looper
 //
@@ -207,62 +635,60 @@ class Looper
 {
 public:
     Looper() _ut_noexcept
-        : mQuit(false) { }
+        : mQuit(false)
+        , mRemoteTicketCounter(0) { }
 
     ~Looper() _ut_noexcept
     {
-        mContext.cancelAllQueued();
-
-        {
-            LockGuard _(mMutex);
-            mContext.cancelAllPending();
-        }
+        mContext.cancelAll();
+        deleteRemoteActions();
     }
 
     void run()
     {
         mThreadId = util::threading::this_thread::get_id();
 
+        Looper*& current = currentLooper();
+        Looper *outer = current;
+        current = this;
+
         mQuit = false;
         do {
-            {
-                UniqueLock lock(mMutex);
-                do {
-                    Timepoint sleepUntil = mContext.queuePending();
-                    if (sleepUntil == Timepoint::max()) {
-                        mQuit = true;
-                        break;
-                    }
-
-                    Timepoint now = monotonicTime();
-                    if (sleepUntil <= now)
-                        break;
-
-                    Timepoint::duration timeout = sleepUntil - now;
-
-                    if (timeout < util::chrono::milliseconds(2)) {
-                        // Busy wait if less than 2ms until trigger
-                        do {
-                            mMutex.unlock();
-                            util::threading::this_thread::yield();
-                            mMutex.lock();
-                        } while (monotonicTime() < sleepUntil && !mContext.hasPending());
-                    } else {
-                        mMutexCond.wait_for(lock, timeout);
-                    }
-                } while (true);
+            acceptRemoteActions();
+
+            Timepoint sleepUntil = mContext.nextTriggerTime();
+
+            if (sleepUntil == Timepoint::max() && mRemoteActions.isEmpty()) {
+                mQuit = true;
+                break;
             }
 
-            if (!mQuit)
-                mContext.runQueued(&mQuit);
+            Timepoint now = monotonicTime();
+
+            if (sleepUntil > now) {
+                uint32_t epoch = mWakeupEvent.prepareWait();
+
+                if (mRemoteActions.isEmpty()) {
+                    Timepoint::duration timeout = (sleepUntil == Timepoint::max())
+                        ? util::chrono::hours(1)
+                        : sleepUntil - now;
 
-            // util::threading::this_thread::yield();
+                    mWakeupEvent.wait(epoch, timeout);
+                } else {
+                    // Some producer may be halfway through a push.
+                    util::threading::this_thread::yield();
+                }
+
+                mWakeupEvent.cancelWait();
+                continue;
+            }
+
+            mContext.collectDue(now);
+            mContext.runCollected(&mQuit);
+            mContext.releaseCollected();
         } while (!mQuit);
 
-        {
-            LockGuard _(mMutex);
-            mContext.queuePending(); // Delete canceled actions.
-        }
+        current = outer;
     }
 
     void quit()
@@ -279,16 +705,10 @@ public:
         assert (util::threading::this_thread::get_id() == mThreadId &&
             "tryCancel() called from outside the loop!");
 
-        bool didCancel = mContext.tryCancelQueued(ticket);
-
-        if (!didCancel) {
-            {
-                LockGuard _(mMutex);
-                didCancel = mContext.tryCancelPending(ticket);
-            }
-        }
+        if ((ticket & detail::LoopContext::REMOTE_TICKET_FLAG) != 0)
+            acceptRemoteActions();
 
-        return didCancel;
+        return mContext.tryCancel(ticket);
     }
 
     void cancelAll()
@@ -296,12 +716,8 @@ public:
         assert (util::threading::this_thread::get_id() == mThreadId &&
             "cancelAll() called from outside the loop!");
 
-        mContext.cancelAllQueued();
-
-        {
-            LockGuard _(mMutex);
-            mContext.cancelAllPending();
-        }
+        acceptRemoteActions();
+        mContext.cancelAll();
     }
 
     /** thread safe */
@@ -309,14 +725,17 @@ public:
     Ticket schedule(F&& f, long delay = 0)
     {
         // TODO: consider overflow
-        Timepoint triggerTime = monotonicTime() + util::chrono::milliseconds(delay);
+        Timepoint now = monotonicTime();
 
-        {
-            LockGuard _(mMutex);
-            mMutexCond.notify_one();
+        if (currentLooper() != this)
+            return scheduleRemote(std::forward<F>(f), delay, now);
 
-            return mContext.schedule(std::forward<F>(f), triggerTime);
-        }
+        Action action(std::forward<F>(f));
+
+        if (delay <= 0)
+            return mContext.post(std::move(action), now);
+        else
+            return mContext.schedule(std::move(action), now + util::chrono::milliseconds(delay));
     }
 
     /** thread safe */
@@ -332,19 +751,88 @@ public:
         return schedule(std::forward<F>(f), 0);
     }
 
+    /**
+     * Entries in the table mapping remote tickets to actions. Grows with the
+     * number of pending remote actions only. Call from the loop thread.
+     */
+    std::size_t remoteSlotCapacity() const _ut_noexcept
+    {
+        return mContext.remoteSlotCapacity();
+    }
+
 private:
     Looper(const Looper& other) = delete;
     Looper& operator=(const Looper& other) = delete;
 
-    using Mutex = util::threading::timed_mutex;
-    using LockGuard = util::threading::lock_guard<Mutex>;
-    using UniqueLock = util::threading::unique_lock<Mutex>;
+    template <class R>
+    friend class RemotePromise;
+
+    static Looper*& currentLooper() _ut_noexcept
+    {
+        static _ut_thread_local Looper *sCurrent = nullptr;
+        return sCurrent;
+    }
+
+    template <typename F>
+    Ticket scheduleRemote(F&& f, long delay, Timepoint now)
+    {
+        Ticket ticket = detail::LoopContext::REMOTE_TICKET_FLAG
+            | (mRemoteTicketCounter.fetch_add(1, std::memory_order_relaxed) + 1);
+
+        submitRemote(new detail::RemoteAction(ticket, delay, now, std::forward<F>(f)));
+
+        return ticket;
+    }
+
+    /** thread safe */
+    void submitRemote(detail::RemoteNode *node) _ut_noexcept
+    {
+        mRemoteActions.push(node);
+        mWakeupEvent.signal();
+    }
+
+    void acceptRemoteActions()
+    {
+        while (detail::RemoteNode *node = mRemoteActions.pop()) {
+            if (node->deliver != nullptr) {
+                // Completions drained in one pass run in arrival order, interleaved
+                // with remote actions. If posting throws, the promise is dropped.
+                mContext.post(detail::RemoteDelivery(node), node->scheduleTime);
+                continue;
+            }
+
+            std::unique_ptr<detail::RemoteAction> guard(
+                static_cast<detail::RemoteAction*>(node)); // safe cast
+
+            // Keep original schedule time, the action may have been queued for a while.
+            if (guard->delay <= 0) {
+                mContext.post(std::move(guard->f), guard->scheduleTime, guard->ticket);
+            } else {
+                mContext.schedule(std::move(guard->f),
+                    guard->scheduleTime + util::chrono::milliseconds(guard->delay),
+                    guard->ticket);
+            }
+        }
+    }
+
+    void deleteRemoteActions() _ut_noexcept
+    {
+        while (detail::RemoteNode *node = mRemoteActions.pop()) {
+            if (node->deliver != nullptr)
+                node->deliver(node, true);
+            else
+                delete static_cast<detail::RemoteAction*>(node); // safe cast
+        }
+    }
 
     detail::LoopContext mContext;
     bool mQuit;
     util::threading::thread::id mThreadId;
-    Mutex mMutex;
-    util::threading::condition_variable_any mMutexCond;
+
+    // Actions scheduled and promises completed from outside the loop thread.
+    MpscQueue<detail::RemoteNode> mRemoteActions;
+    std::atomic<uint64_t> mRemoteTicketCounter;
+    WakeupEvent mWakeupEvent;
 };
 
 }
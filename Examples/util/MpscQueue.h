@@ -0,0 +1,115 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+#include <atomic>
+
+namespace util {
+
+//
+// MpscQueue
+//
+
+/** Base for nodes of an intrusive MpscQueue */
+struct MpscNode
+{
+    std::atomic<MpscNode*> mpscNext;
+
+    MpscNode() _ut_noexcept
+        : mpscNext(nullptr) { }
+};
+
+/**
+ * Lock-free intrusive multi-producer / single-consumer FIFO queue. Node type
+ * must derive from MpscNode. Algorithm by Dmitry Vyukov.
+ *
+ * Pushing takes a single atomic exchange. A pop may fail while some producer is
+ * halfway through a push, in which case isEmpty() still returns false.
+ */
+template <class T>
+class MpscQueue
+{
+public:
+    MpscQueue() _ut_noexcept
+        : mHead(&mStub)
+        , mTail(&mStub) { }
+
+    /** thread safe */
+    void push(T *node) _ut_noexcept
+    {
+        pushNode(node);
+    }
+
+    /** Consumer only */
+    bool isEmpty() const _ut_noexcept
+    {
+        return mTail == &mStub && mHead.load(std::memory_order_seq_cst) == &mStub;
+    }
+
+    /** Consumer only */
+    T* pop() _ut_noexcept
+    {
+        MpscNode *tail = mTail;
+        MpscNode *next = tail->mpscNext.load(std::memory_order_acquire);
+
+        if (tail == &mStub) {
+            if (next == nullptr)
+                return nullptr;
+
+            mTail = next;
+            tail = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            mTail = next;
+            return static_cast<T*>(tail);
+        }
+
+        if (tail != mHead.load(std::memory_order_acquire))
+            return nullptr; // producer in the middle of a push
+
+        // Last node, put stub behind it before detaching.
+        pushNode(&mStub);
+        next = tail->mpscNext.load(std::memory_order_acquire);
+
+        if (next != nullptr) {
+            mTail = next;
+            return static_cast<T*>(tail);
+        }
+
+        return nullptr;
+    }
+
+private:
+    MpscQueue(const MpscQueue& other) = delete;
+    MpscQueue& operator=(const MpscQueue& other) = delete;
+
+    void pushNode(MpscNode *node) _ut_noexcept
+    {
+        node->mpscNext.store(nullptr, std::memory_order_relaxed);
+        MpscNode *prev = mHead.exchange(node, std::memory_order_seq_cst);
+        prev->mpscNext.store(node, std::memory_order_release);
+    }
+
+    std::atomic<MpscNode*> mHead;
+    MpscNode *mTail;
+    MpscNode mStub;
+};
+
+}
@@ -0,0 +1,215 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+#include "Looper.h"
+#include <CppAsync/Task.h>
+#include <CppAsync/util/Optional.h>
+#include <memory>
+#include <utility>
+
+namespace util {
+
+namespace detail
+{
+    template <class R>
+    struct RemoteResult
+    {
+        ut::Optional<R> value;
+
+        template <class ...Args>
+        void set(Args&&... args)
+        {
+            value.emplace(std::forward<Args>(args)...);
+        }
+
+        bool isSet() const _ut_noexcept
+        {
+            return (bool) value;
+        }
+
+        void completeInto(ut::Promise<R>& promise) _ut_noexcept
+        {
+            promise.complete(std::move(*value));
+        }
+    };
+
+    template <>
+    struct RemoteResult<void>
+    {
+        bool hasValue;
+
+        RemoteResult() _ut_noexcept
+            : hasValue(false) { }
+
+        void set() _ut_noexcept
+        {
+            hasValue = true;
+        }
+
+        bool isSet() const _ut_noexcept
+        {
+            return hasValue;
+        }
+
+        void completeInto(ut::Promise<void>& promise) _ut_noexcept
+        {
+            promise.complete();
+        }
+    };
+
+    template <class R>
+    struct RemoteCompletion : RemoteNode
+    {
+        ut::Promise<R> promise;
+        RemoteResult<R> result;
+        ut::Error error;
+        bool hasError;
+
+        explicit RemoteCompletion(ut::Promise<R>&& promise) _ut_noexcept
+            : RemoteNode(&RemoteCompletion::deliver, Timepoint())
+            , promise(std::move(promise))
+            , hasError(false) { }
+
+        static void deliver(RemoteNode *node, bool isCanceled) _ut_noexcept
+        {
+            std::unique_ptr<RemoteCompletion> self(
+                static_cast<RemoteCompletion*>(node)); // safe cast
+
+            // Nothing to do if the task got canceled in the meantime. Otherwise
+            // dropping the promise cancels the task.
+            if (isCanceled || !self->promise.isCompletable())
+                return;
+
+            if (self->result.isSet())
+                self->result.completeInto(self->promise);
+            else if (self->hasError)
+                self->promise.fail(std::move(self->error));
+        }
+    };
+}
+
+//
+// RemotePromise
+//
+
+/**
+ * Completes a promise from any thread. The promise is moved into a node allocated
+ * by the thread owning it, and the node is later handed back to the Looper through
+ * its lock-free remote queue. The loop drains all pending completions in one pass
+ * and completes the promises on its own thread, with no further allocation or
+ * locking.
+ *
+ * Compared to posting a closure over a SharedPromise, this saves the shared state
+ * and the remote action allocations.
+ *
+ * Movable, not copyable. Destroying a RemotePromise before completing it cancels
+ * the task (on the loop thread). The Looper must outlive it.
+ */
+template <class R>
+class RemotePromise
+{
+public:
+    RemotePromise() _ut_noexcept
+        : mLooper(nullptr)
+        , mNode(nullptr) { }
+
+    /** Call from the thread owning the promise */
+    RemotePromise(Looper& looper, ut::Promise<R>&& promise)
+        : mLooper(&looper)
+        , mNode(new detail::RemoteCompletion<R>(std::move(promise))) { }
+
+    RemotePromise(RemotePromise&& other) _ut_noexcept
+        : mLooper(other.mLooper)
+        , mNode(other.mNode)
+    {
+        other.mNode = nullptr;
+    }
+
+    RemotePromise& operator=(RemotePromise&& other) _ut_noexcept
+    {
+        ut_assert(this != &other);
+
+        reset();
+        mLooper = other.mLooper;
+        mNode = other.mNode;
+        other.mNode = nullptr;
+
+        return *this;
+    }
+
+    ~RemotePromise() _ut_noexcept
+    {
+        reset();
+    }
+
+    /** Check if complete() or fail() may be called */
+    bool isValid() const _ut_noexcept
+    {
+        return mNode != nullptr;
+    }
+
+    /** thread safe, may be called once */
+    template <class ...Args>
+    void complete(Args&&... args)
+    {
+        ut_dcheck(isValid());
+
+        mNode->result.set(std::forward<Args>(args)...);
+        submit();
+    }
+
+    /** thread safe, may be called once */
+    void fail(ut::Error error) _ut_noexcept
+    {
+        ut_dcheck(isValid());
+
+        mNode->error = std::move(error);
+        mNode->hasError = true;
+        submit();
+    }
+
+    /** Hand the promise back without completing it, canceling the task */
+    void reset() _ut_noexcept
+    {
+        if (mNode != nullptr)
+            submit();
+    }
+
+private:
+    RemotePromise(const RemotePromise& other) = delete;
+    RemotePromise& operator=(const RemotePromise& other) = delete;
+
+    void submit() _ut_noexcept
+    {
+        mNode->scheduleTime = monotonicTime();
+        mLooper->submitRemote(mNode);
+        mNode = nullptr;
+    }
+
+    Looper *mLooper;
+    detail::RemoteCompletion<R> *mNode;
+};
+
+template <class R>
+RemotePromise<R> makeRemotePromise(Looper& looper, ut::Promise<R>&& promise)
+{
+    return RemotePromise<R>(looper, std::move(promise));
+}
+
+}
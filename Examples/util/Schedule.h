@@ -0,0 +1,100 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+#include <CppAsync/Scheduler.h>
+#include <CppAsync/util/UniqueFunction.h>
+#include <cassert>
+#include <utility>
+
+//
+// The single definition of ut::schedule() for all examples. Actions are posted
+// to whichever executor is currently installed with util::ScheduleGuard.
+//
+
+namespace util {
+
+namespace detail
+{
+    using ScheduledAction = ut::UniqueFunction<void ()>;
+
+    struct ScheduleTarget
+    {
+        void (*post)(void *executor, ScheduledAction&& action);
+        void *executor;
+    };
+
+    inline ScheduleTarget& scheduleTarget() _ut_noexcept
+    {
+        static ScheduleTarget target = { nullptr, nullptr };
+        return target;
+    }
+
+    template <class Executor>
+    void postTo(void *executor, ScheduledAction&& action)
+    {
+        static_cast<Executor*>(executor)->post(std::move(action)); // safe cast
+    }
+}
+
+/**
+ * Routes ut::schedule() to an executor with a thread safe post() method, such as
+ * Looper, EpollLoop or WorkStealingPool, until the guard goes out of scope.
+ * Guards may be nested, the previous executor is restored on exit.
+ *
+ * Install and remove guards while no other thread is scheduling. The executor
+ * must outlive the guard.
+ */
+class ScheduleGuard
+{
+public:
+    template <class Executor>
+    explicit ScheduleGuard(Executor& executor) _ut_noexcept
+        : mPrevTarget(detail::scheduleTarget())
+    {
+        detail::scheduleTarget().post = &detail::postTo<Executor>;
+        detail::scheduleTarget().executor = &executor;
+    }
+
+    ~ScheduleGuard() _ut_noexcept
+    {
+        detail::scheduleTarget() = mPrevTarget;
+    }
+
+private:
+    ScheduleGuard(const ScheduleGuard& other) = delete;
+    ScheduleGuard& operator=(const ScheduleGuard& other) = delete;
+
+    detail::ScheduleTarget mPrevTarget;
+};
+
+}
+
+namespace ut {
+
+template <class F>
+void schedule(F&& action)
+{
+    const util::detail::ScheduleTarget& target = util::detail::scheduleTarget();
+
+    assert(target.post != nullptr && "No executor installed for ut::schedule()");
+
+    target.post(target.executor, std::forward<F>(action));
+}
+
+}
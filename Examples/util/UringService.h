@@ -0,0 +1,696 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+
+#ifdef HAVE_IO_URING
+
+#include "EpollLoop.h"
+#include <CppAsync/StacklessAsync.h>
+#include <CppAsync/Task.h>
+#include <CppAsync/util/TypeTraits.h>
+#include <CppAsync/util/UniqueFunction.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace util {
+
+class UringService;
+
+namespace detail
+{
+    namespace uring
+    {
+        inline int setup(unsigned numEntries, io_uring_params *params) _ut_noexcept
+        {
+            return (int) syscall(__NR_io_uring_setup, numEntries, params); // safe cast
+        }
+
+        inline int enter(int ringFd, unsigned toSubmit, unsigned minComplete,
+            unsigned flags) _ut_noexcept
+        {
+            return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, // safe cast
+                flags, nullptr, 0);
+        }
+
+        // Ring indices are shared with the kernel.
+        inline unsigned loadAcquire(const unsigned *p) _ut_noexcept
+        {
+            return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+        }
+
+        inline void storeRelease(unsigned *p, unsigned value) _ut_noexcept
+        {
+            __atomic_store_n(p, value, __ATOMIC_RELEASE);
+        }
+
+        // Completes a promise from the result of a CQE.
+        template <class R>
+        class Completion
+        {
+        public:
+            explicit Completion(ut::Promise<R>&& promise) _ut_noexcept
+                : mPromise(std::move(promise)) { }
+
+            Completion(Completion&& other) _ut_noexcept
+                : mPromise(std::move(other.mPromise)) { }
+
+            void operator()(int result)
+            {
+                if (!mPromise.isCompletable())
+                    return; // task got canceled
+
+                if (result < 0)
+                    mPromise.fail(epoll::makeSystemError(-result));
+                else
+                    complete(result);
+            }
+
+        private:
+            template <class U = R, ut::EnableIfVoid<U> = nullptr>
+            void complete(int /* result */)
+            {
+                mPromise.complete();
+            }
+
+            template <class U = R, ut::DisableIfVoid<U> = nullptr>
+            void complete(int result)
+            {
+                mPromise.complete((R) result); // safe cast
+            }
+
+            ut::Promise<R> mPromise;
+        };
+
+        // Waits for the ring to have completions while any operation is pending.
+        struct ReaperFrame : ut::AsyncFrame<void>
+        {
+            explicit ReaperFrame(UringService *service)
+                : service(service) { }
+
+            void operator()();
+
+        private:
+            UringService *service;
+        };
+    }
+}
+
+//
+// UringService
+//
+
+/**
+ * Asynchronous reads, writes, accepts and connects through io_uring, with
+ * completions delivered on an EpollLoop. Operations return ut::Task<R> just
+ * like the asio::asTask adaptors, so awaiting code looks the same:
+ *
+ *   task = service.asyncRead(fd, buf, sizeof(buf));
+ *   ut_await_(task);
+ *
+ * Operations started during one loop round are submitted in a single
+ * io_uring_enter() call, posted to run after the round. Completions are reaped
+ * when the ring descriptor polls readable, and the matching promises are
+ * completed on the loop thread. Failed operations fail their task with a
+ * std::system_error, or errno when UT_NO_EXCEPTIONS is defined. Starting an
+ * operation never resumes other tasks.
+ *
+ * At most as many operations as the completion queue holds are handed to the
+ * kernel at a time, so completions can't overflow. Half of it is kept for
+ * cancel requests. Operations beyond that, or beyond a full submission queue,
+ * wait in user space until there is room.
+ *
+ * Talks to the kernel through raw syscalls, liburing is not needed. Requires
+ * Linux 5.6 or later.
+ *
+ * Buffers and addresses must stay valid until the operation completes, even
+ * if its task gets canceled in the meantime -- the kernel may still access
+ * them. Use cancel() to abort pending operations on a descriptor. The service
+ * must be destroyed before its loop. Destroying it waits until all pending
+ * operations have been canceled by the kernel.
+ */
+class UringService
+{
+public:
+    static const unsigned DEFAULT_NUM_ENTRIES = 256;
+
+    /** For reads and writes that use and advance the file position */
+    static const uint64_t CURRENT_POSITION = (uint64_t) -1;
+
+    explicit UringService(EpollLoop& loop, unsigned numEntries = DEFAULT_NUM_ENTRIES)
+        : mLoop(loop)
+        , mRingFd(-1)
+        , mSqRing(MAP_FAILED)
+        , mCqRing(MAP_FAILED)
+        , mSqes(static_cast<io_uring_sqe*>(MAP_FAILED)) // safe cast
+        , mSqRingSize(0)
+        , mCqRingSize(0)
+        , mSqesSize(0)
+        , mSqTailLocal(0)
+        , mNumUnsubmitted(0)
+        , mNumInKernel(0)
+        , mMaxInKernel(0)
+        , mFreeSlot(NO_SLOT)
+        , mIsReaping(false)
+        , mIsFlushPosted(false)
+        , mSelf(std::make_shared<UringService*>(this))
+    {
+        io_uring_params params = io_uring_params();
+
+        mRingFd = detail::uring::setup(numEntries, &params);
+        if (mRingFd < 0)
+            fail("io_uring_setup");
+
+        mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+        bool isSingleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (isSingleMmap)
+            mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+
+        mSqRing = mapRegion(mSqRingSize, IORING_OFF_SQ_RING);
+        mCqRing = isSingleMmap ? mSqRing : mapRegion(mCqRingSize, IORING_OFF_CQ_RING);
+        mSqes = static_cast<io_uring_sqe*>(mapRegion(mSqesSize, IORING_OFF_SQES)); // safe cast
+
+        char *sq = static_cast<char*>(mSqRing); // safe cast
+        mSqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        mSqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        mSqEntries = params.sq_entries;
+        mSqTailLocal = *mSqTail;
+
+        char *cq = static_cast<char*>(mCqRing); // safe cast
+        mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        mCqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        mMaxInKernel = params.cq_entries;
+    }
+
+    ~UringService() _ut_noexcept
+    {
+        // Posted flushes may outlive the service.
+        *mSelf = nullptr;
+        mReaper = ut::Task<void>();
+        mIsReaping = true; // reaped synchronously from now on
+
+        // Kernel may still be using buffers of pending operations. Cancel them,
+        // and wait until they're done. Tasks get canceled without being resumed.
+        // Queued operations never reached the kernel, they are just dropped.
+        for (uint32_t slot = 0; slot < mSlots.size(); slot++) {
+            if (!mSlots[slot].completion)
+                continue;
+
+            if (mSlots[slot].isQueued)
+                mSlots[slot].completion = nullptr;
+            else
+                submitCancel(slot);
+        }
+
+        publishQueued();
+
+        while (mNumInKernel > 0) {
+            // Don't block while cancel requests wait for room in the ring.
+            unsigned minComplete = mQueuedCancels.empty() ? 1 : 0;
+
+            int result = detail::uring::enter(mRingFd, mNumUnsubmitted, minComplete,
+                IORING_ENTER_GETEVENTS);
+
+            if (result > 0)
+                mNumUnsubmitted -= (unsigned) result; // safe cast
+            else if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                break;
+
+            reap(false);
+            publishQueued();
+        }
+
+        closeRing();
+    }
+
+    EpollLoop& loop() _ut_noexcept
+    {
+        return mLoop;
+    }
+
+    /** Number of operations handed to the kernel or queued, but not yet reaped */
+    int numPending() const _ut_noexcept
+    {
+        return (int) (mNumInKernel + mQueued.size() + mQueuedCancels.size()); // safe cast
+    }
+
+    /** Task completes with the number of bytes read, 0 at end of file */
+    ut::Task<std::size_t> asyncRead(int fd, void *buf, std::size_t size,
+        uint64_t offset = CURRENT_POSITION)
+    {
+        io_uring_sqe sqe = prepare(IORING_OP_READ, fd);
+        sqe.addr = (uint64_t) reinterpret_cast<uintptr_t>(buf);
+        sqe.len = (uint32_t) size; // safe cast
+        sqe.off = offset;
+
+        return commit<std::size_t>(sqe);
+    }
+
+    /** Task completes with the number of bytes written */
+    ut::Task<std::size_t> asyncWrite(int fd, const void *buf, std::size_t size,
+        uint64_t offset = CURRENT_POSITION)
+    {
+        io_uring_sqe sqe = prepare(IORING_OP_WRITE, fd);
+        sqe.addr = (uint64_t) reinterpret_cast<uintptr_t>(buf);
+        sqe.len = (uint32_t) size; // safe cast
+        sqe.off = offset;
+
+        return commit<std::size_t>(sqe);
+    }
+
+    /** Task completes with the accepted socket */
+    ut::Task<int> asyncAccept(int fd, sockaddr *addr = nullptr, socklen_t *addrLen = nullptr)
+    {
+        io_uring_sqe sqe = prepare(IORING_OP_ACCEPT, fd);
+        sqe.addr = (uint64_t) reinterpret_cast<uintptr_t>(addr);
+        sqe.addr2 = (uint64_t) reinterpret_cast<uintptr_t>(addrLen);
+        sqe.accept_flags = SOCK_CLOEXEC;
+
+        return commit<int>(sqe);
+    }
+
+    ut::Task<void> asyncConnect(int fd, const sockaddr *addr, socklen_t addrLen)
+    {
+        io_uring_sqe sqe = prepare(IORING_OP_CONNECT, fd);
+        sqe.addr = (uint64_t) reinterpret_cast<uintptr_t>(addr);
+        sqe.off = addrLen;
+
+        return commit<void>(sqe);
+    }
+
+    /**
+     * Aborts operations pending on fd. Their tasks fail with ECANCELED, once the
+     * kernel confirms or, for operations still queued, on the next loop round.
+     */
+    void cancel(int fd)
+    {
+        for (uint32_t slot = 0; slot < mSlots.size(); slot++) {
+            Slot& entry = mSlots[slot];
+
+            if (!entry.completion || entry.fd != fd)
+                continue;
+
+            if (entry.isQueued) {
+                // Skipped when its turn comes. Never resume tasks from here.
+                Completion completion(std::move(entry.completion));
+                mLoop.post(DeferredCancel(std::move(completion)));
+            } else {
+                submitCancel(slot);
+            }
+        }
+    }
+
+private:
+    UringService(const UringService& other) = delete;
+    UringService& operator=(const UringService& other) = delete;
+
+    friend struct detail::uring::ReaperFrame;
+
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    // CQEs of cancel requests, which have no slot. Never a valid slot tag,
+    // since NO_SLOT isn't a slot index.
+    static const uint64_t CANCEL_TAG = UINT64_MAX;
+
+    using Completion = ut::UniqueFunction<void (int)>;
+
+    struct Slot
+    {
+        Completion completion;
+        int fd;
+        bool isQueued; // waiting in mQueued, not handed to the kernel yet
+        uint32_t generation; // bumped when freed, so reused slots get a new tag
+        uint32_t nextFree;
+    };
+
+    struct DeferredCancel
+    {
+        Completion completion;
+
+        explicit DeferredCancel(Completion&& completion) _ut_noexcept
+            : completion(std::move(completion)) { }
+
+        void operator()()
+        {
+            completion(-ECANCELED);
+        }
+    };
+
+    void* mapRegion(std::size_t size, off_t offset)
+    {
+        void *region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, mRingFd, offset);
+
+        if (region == MAP_FAILED)
+            fail("mmap");
+
+        return region;
+    }
+
+    void fail(const char *what)
+    {
+        int error = errno;
+        closeRing();
+
+        errno = error;
+        detail::epoll::checkSyscall(-1, what);
+    }
+
+    void closeRing() _ut_noexcept
+    {
+        if (mSqes != MAP_FAILED)
+            munmap(mSqes, mSqesSize);
+        if (mCqRing != MAP_FAILED && mCqRing != mSqRing)
+            munmap(mCqRing, mCqRingSize);
+        if (mSqRing != MAP_FAILED)
+            munmap(mSqRing, mSqRingSize);
+        if (mRingFd >= 0)
+            close(mRingFd);
+    }
+
+    static io_uring_sqe prepare(uint8_t opcode, int fd) _ut_noexcept
+    {
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(io_uring_sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+
+        return sqe;
+    }
+
+    template <class R>
+    ut::Task<R> commit(io_uring_sqe& sqe)
+    {
+        uint32_t slot = allocateSlot();
+        ut::Task<R> task;
+
+        mSlots[slot].completion = detail::uring::Completion<R>(task.takePromise());
+        mSlots[slot].fd = sqe.fd;
+
+        sqe.user_data = tagOf(slot);
+        submit(sqe);
+
+        return task;
+    }
+
+    // SQE user data of an operation. Slot indices get recycled, the generation
+    // keeps a late cancel from hitting a newer operation in the same slot.
+    uint64_t tagOf(uint32_t slot) const _ut_noexcept
+    {
+        return slot | ((uint64_t) mSlots[slot].generation << 32);
+    }
+
+    static uint32_t slotOf(uint64_t tag) _ut_noexcept
+    {
+        return (uint32_t) tag; // safe cast
+    }
+
+    bool isCurrent(uint64_t tag) const _ut_noexcept
+    {
+        uint32_t slot = slotOf(tag);
+
+        return slot < mSlots.size() && tagOf(slot) == tag;
+    }
+
+    void submitCancel(uint32_t slot)
+    {
+        io_uring_sqe sqe = prepare(IORING_OP_ASYNC_CANCEL, -1);
+        sqe.addr = tagOf(slot);
+        sqe.user_data = CANCEL_TAG;
+
+        submit(sqe);
+    }
+
+    bool canPublish(bool isCancel) const _ut_noexcept
+    {
+        // Cancel requests may use the reserved half of the completion queue,
+        // otherwise the operations they target could keep them out.
+        unsigned maxInKernel = isCancel ? mMaxInKernel : mMaxInKernel / 2;
+
+        return mNumInKernel < maxInKernel
+            && mSqTailLocal - detail::uring::loadAcquire(mSqHead) < mSqEntries;
+    }
+
+    void submit(const io_uring_sqe& sqe)
+    {
+        bool isCancel = (sqe.user_data == CANCEL_TAG);
+        std::deque<io_uring_sqe>& queue = isCancel ? mQueuedCancels : mQueued;
+
+        // Keep submission order, nothing overtakes queued operations.
+        if (queue.empty() && canPublish(isCancel)) {
+            publish(sqe);
+        } else {
+            queue.push_back(sqe);
+            if (!isCancel)
+                mSlots[slotOf(sqe.user_data)].isQueued = true;
+        }
+
+        postFlush();
+        ensureReaping();
+    }
+
+    void ensureReaping()
+    {
+        // The loop may have dropped the readiness wait in cancelAll().
+        if (!mIsReaping || !mReadable.isValid()) {
+            mReaper = ut::Task<void>();
+            mReaper = ut::startAsyncOf<detail::uring::ReaperFrame>(this);
+        }
+    }
+
+    void publish(const io_uring_sqe& sqe) _ut_noexcept
+    {
+        unsigned index = mSqTailLocal & mSqMask;
+
+        mSqes[index] = sqe;
+        mSqArray[index] = index;
+        detail::uring::storeRelease(mSqTail, ++mSqTailLocal);
+
+        mNumUnsubmitted++;
+        mNumInKernel++;
+    }
+
+    // Moves queued operations to the ring while there is room.
+    void publishQueued() _ut_noexcept
+    {
+        while (!mQueuedCancels.empty() && canPublish(true)) {
+            io_uring_sqe& sqe = mQueuedCancels.front();
+
+            // Target completed while the cancel waited, its slot may be reused.
+            if (isCurrent(sqe.addr))
+                publish(sqe);
+
+            mQueuedCancels.pop_front();
+        }
+
+        while (!mQueued.empty() && canPublish(false)) {
+            io_uring_sqe& sqe = mQueued.front();
+            uint32_t slot = slotOf(sqe.user_data);
+            mSlots[slot].isQueued = false;
+
+            // Canceled while queued.
+            if (mSlots[slot].completion)
+                publish(sqe);
+            else
+                freeSlot(slot);
+
+            mQueued.pop_front();
+        }
+    }
+
+    void postFlush()
+    {
+        if (mIsFlushPosted)
+            return;
+
+        mIsFlushPosted = true;
+
+        std::shared_ptr<UringService*> self = mSelf;
+        mLoop.post([self]() {
+            if (*self != nullptr)
+                (*self)->flush();
+        });
+    }
+
+    void flush()
+    {
+        mIsFlushPosted = false;
+
+        while (true) {
+            publishQueued();
+
+            if (mNumUnsubmitted == 0)
+                break;
+
+            int result = detail::uring::enter(mRingFd, mNumUnsubmitted, 0, 0);
+
+            if (result > 0) {
+                mNumUnsubmitted -= (unsigned) result; // safe cast
+            } else if (result == 0 || errno == EAGAIN || errno == EBUSY) {
+                // Out of kernel resources. Retry next round.
+                postFlush();
+                break;
+            } else if (errno != EINTR) {
+                detail::epoll::checkSyscall(-1, "io_uring_enter");
+            }
+        }
+
+        if (mNumInKernel > 0)
+            ensureReaping();
+    }
+
+    void reap(bool shouldComplete)
+    {
+        unsigned head = *mCqHead;
+
+        while (head != detail::uring::loadAcquire(mCqTail)) {
+            const io_uring_cqe& cqe = mCqes[head & mCqMask];
+            uint64_t userData = cqe.user_data;
+            int result = cqe.res;
+
+            detail::uring::storeRelease(mCqHead, ++head);
+            mNumInKernel--;
+
+            if (userData == CANCEL_TAG)
+                continue;
+
+            assert(isCurrent(userData));
+
+            uint32_t slot = slotOf(userData);
+            Completion completion(std::move(mSlots[slot].completion));
+            freeSlot(slot);
+
+            if (shouldComplete)
+                completion(result);
+        }
+
+        // Completions made room for queued operations.
+        if (shouldComplete && (!mQueued.empty() || !mQueuedCancels.empty()))
+            postFlush();
+    }
+
+    uint32_t allocateSlot()
+    {
+        uint32_t slot;
+
+        if (mFreeSlot == NO_SLOT) {
+            mSlots.emplace_back();
+            slot = (uint32_t) mSlots.size() - 1; // safe cast
+            mSlots[slot].generation = 0;
+        } else {
+            slot = mFreeSlot;
+            mFreeSlot = mSlots[slot].nextFree;
+        }
+
+        mSlots[slot].isQueued = false;
+        return slot;
+    }
+
+    void freeSlot(uint32_t slot) _ut_noexcept
+    {
+        mSlots[slot].generation++;
+        mSlots[slot].nextFree = mFreeSlot;
+        mFreeSlot = slot;
+    }
+
+    EpollLoop& mLoop;
+    int mRingFd;
+
+    void *mSqRing;
+    void *mCqRing;
+    io_uring_sqe *mSqes;
+    std::size_t mSqRingSize;
+    std::size_t mCqRingSize;
+    std::size_t mSqesSize;
+
+    unsigned *mSqHead;
+    unsigned *mSqTail;
+    unsigned *mSqArray;
+    unsigned mSqMask;
+    unsigned mSqEntries;
+    unsigned mSqTailLocal;
+
+    unsigned *mCqHead;
+    unsigned *mCqTail;
+    io_uring_cqe *mCqes;
+    unsigned mCqMask;
+
+    unsigned mNumUnsubmitted;
+    unsigned mNumInKernel;  // published to the ring and not yet reaped
+    unsigned mMaxInKernel;  // completion queue size
+
+    // Operations waiting for room in the ring
+    std::deque<io_uring_sqe> mQueued;
+    std::deque<io_uring_sqe> mQueuedCancels;
+
+    // Indexed by SQE user data
+    std::vector<Slot> mSlots;
+    uint32_t mFreeSlot;
+
+    bool mIsReaping;
+    bool mIsFlushPosted;
+    ut::Task<void> mReaper;
+    ut::Task<void> mReadable;
+    std::shared_ptr<UringService*> mSelf;
+};
+
+namespace detail
+{
+    namespace uring
+    {
+        inline void ReaperFrame::operator()()
+        {
+            ut_begin();
+
+            service->mIsReaping = true;
+
+            while (service->mNumInKernel > 0) {
+                service->mReadable = service->mLoop.asyncReadable(service->mRingFd);
+                ut_await_no_throw_(service->mReadable);
+
+                service->reap(true);
+            }
+
+            service->mIsReaping = false;
+
+            ut_end();
+        }
+    }
+}
+
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,138 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+#include "Chrono.h"
+#include "Thread.h"
+#include <atomic>
+#include <cstdint>
+
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+//
+// WakeupEvent
+//
+
+/**
+ * Lets a single consumer sleep until signaled by some producer. Producers
+ * only pay for a signal if the consumer has announced it's going to sleep.
+ *
+ * Consumer protocol:
+ *
+ *   uint32_t epoch = event.prepareWait();
+ *   if (!<work available>)
+ *       event.wait(epoch, timeout);
+ *   event.cancelWait();
+ *
+ * Producer protocol:
+ *
+ *   <make work available>
+ *   event.signal();
+ *
+ * Uses a futex on Linux, and a condition variable elsewhere.
+ */
+class WakeupEvent
+{
+public:
+    WakeupEvent() _ut_noexcept
+        : mEpoch(0)
+        , mIsWaiting(false) { }
+
+    uint32_t prepareWait() _ut_noexcept
+    {
+        uint32_t epoch = mEpoch.load(std::memory_order_acquire);
+        mIsWaiting.store(true, std::memory_order_seq_cst);
+
+        return epoch;
+    }
+
+    void cancelWait() _ut_noexcept
+    {
+        mIsWaiting.store(false, std::memory_order_relaxed);
+    }
+
+    /** May return spuriously */
+    void wait(uint32_t epoch, Timepoint::duration timeout)
+    {
+#ifdef __linux__
+        auto us = util::chrono::duration_cast<util::chrono::microseconds>(timeout).count();
+
+        struct timespec ts;
+        ts.tv_sec = (time_t) (us / 1000000);
+        ts.tv_nsec = (long) (us % 1000000) * 1000;
+
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mEpoch), // safe cast
+            FUTEX_WAIT_PRIVATE, epoch, &ts, nullptr, 0);
+#else
+        UniqueLock lock(mMutex);
+
+        if (mEpoch.load(std::memory_order_relaxed) == epoch)
+            mCond.wait_for(lock, timeout);
+#endif
+    }
+
+    /** thread safe */
+    void signal() _ut_noexcept
+    {
+        // Pairs with the consumer announcing itself before checking for work,
+        // so either the consumer sees the work or we see the consumer.
+        if (!mIsWaiting.load(std::memory_order_seq_cst)
+                || !mIsWaiting.exchange(false, std::memory_order_seq_cst))
+            return;
+
+#ifdef __linux__
+        mEpoch.fetch_add(1, std::memory_order_release);
+
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mEpoch), // safe cast
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+        LockGuard _(mMutex);
+        mEpoch.fetch_add(1, std::memory_order_release);
+        mCond.notify_one();
+#endif
+    }
+
+private:
+    WakeupEvent(const WakeupEvent& other) = delete;
+    WakeupEvent& operator=(const WakeupEvent& other) = delete;
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+        "Futex word must be a plain 32-bit integer");
+
+    std::atomic<uint32_t> mEpoch;
+    std::atomic<bool> mIsWaiting;
+
+#ifndef __linux__
+    using Mutex = util::threading::mutex;
+    using LockGuard = util::threading::lock_guard<Mutex>;
+    using UniqueLock = util::threading::unique_lock<Mutex>;
+
+    Mutex mMutex;
+    util::threading::condition_variable mCond;
+#endif
+};
+
+}
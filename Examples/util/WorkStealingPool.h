@@ -0,0 +1,396 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "../Common.h"
+#include <CppAsync/util/UniqueFunction.h>
+#include "Thread.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+namespace detail
+{
+    //
+    // Chase-Lev work-stealing deque. Memory orderings follow "Correct and Efficient
+    // Work-Stealing for Weak Memory Models" (Le et al., 2013).
+    //
+    // Only the owner thread may push() and pop() at the bottom end. Any thread may
+    // steal() from the top end.
+    //
+
+    template <class T>
+    class WorkStealingDeque
+    {
+    public:
+        explicit WorkStealingDeque(std::size_t capacity = 256)
+            : mTop(0)
+            , mBottom(0)
+            , mArray(new Array(capacity))
+        {
+            assert((capacity & (capacity - 1)) == 0 && "capacity must be a power of 2");
+        }
+
+        ~WorkStealingDeque() _ut_noexcept
+        {
+            delete mArray.load(std::memory_order_relaxed);
+        }
+
+        bool isEmpty() const _ut_noexcept
+        {
+            int64_t b = mBottom.load(std::memory_order_relaxed);
+            int64_t t = mTop.load(std::memory_order_relaxed);
+
+            return b <= t;
+        }
+
+        void push(T *item) // owner only
+        {
+            int64_t b = mBottom.load(std::memory_order_relaxed);
+            int64_t t = mTop.load(std::memory_order_acquire);
+            Array *a = mArray.load(std::memory_order_relaxed);
+
+            if (b - t > (int64_t) a->capacity - 1) {
+                // Thieves may still be reading from the old array, keep it around.
+                mRetired.emplace_back(a);
+                a = a->grow(t, b);
+                mArray.store(a, std::memory_order_release);
+            }
+
+            a->put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            mBottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        T* pop() _ut_noexcept // owner only
+        {
+            int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+            Array *a = mArray.load(std::memory_order_relaxed);
+            mBottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = mTop.load(std::memory_order_relaxed);
+
+            T *item = nullptr;
+
+            if (t <= b) {
+                item = a->get(b);
+
+                if (t == b) {
+                    // Last item, race against thieves.
+                    if (!mTop.compare_exchange_strong(t, t + 1,
+                            std::memory_order_seq_cst, std::memory_order_relaxed))
+                        item = nullptr;
+
+                    mBottom.store(b + 1, std::memory_order_relaxed);
+                }
+            } else {
+                mBottom.store(b + 1, std::memory_order_relaxed);
+            }
+
+            return item;
+        }
+
+        /** thread safe, may fail spuriously under contention */
+        T* steal() _ut_noexcept
+        {
+            int64_t t = mTop.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = mBottom.load(std::memory_order_acquire);
+
+            if (t < b) {
+                Array *a = mArray.load(std::memory_order_acquire);
+                T *item = a->get(t);
+
+                if (mTop.compare_exchange_strong(t, t + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return item;
+            }
+
+            return nullptr;
+        }
+
+    private:
+        WorkStealingDeque(const WorkStealingDeque& other) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque& other) = delete;
+
+        struct Array
+        {
+            const std::size_t capacity;
+            const std::size_t mask;
+            std::unique_ptr<std::atomic<T*>[]> items;
+
+            explicit Array(std::size_t capacity)
+                : capacity(capacity)
+                , mask(capacity - 1)
+                , items(new std::atomic<T*>[capacity]) { }
+
+            T* get(int64_t index) const _ut_noexcept
+            {
+                return items[(std::size_t) index & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t index, T *item) _ut_noexcept
+            {
+                items[(std::size_t) index & mask].store(item, std::memory_order_relaxed);
+            }
+
+            Array* grow(int64_t top, int64_t bottom) const
+            {
+                Array *a = new Array(2 * capacity);
+
+                for (int64_t i = top; i < bottom; i++)
+                    a->put(i, get(i));
+
+                return a;
+            }
+        };
+
+        // Keep top and bottom on separate cache lines, thieves hammer on top.
+        std::atomic<int64_t> mTop;
+        char mPadding[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> mBottom;
+        std::atomic<Array*> mArray;
+        std::vector<std::unique_ptr<Array>> mRetired;
+    };
+}
+
+//
+// WorkStealingPool
+//
+
+/**
+ * Multi-threaded executor. Each worker owns a work-stealing deque; jobs scheduled
+ * from a worker thread are pushed to its own deque, while jobs scheduled from
+ * outside go to a shared injection queue. Idle workers steal from each other.
+ *
+ * Plug it into CppAsync with util::ScheduleGuard (see util/Schedule.h).
+ * Tasks and promises are not thread safe, so actions that touch them must be
+ * posted back to the thread owning the task (see ex_workStealingPool).
+ */
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(int numWorkers = defaultConcurrency())
+        : mNumQueued(0)
+        , mNumInjected(0)
+        , mNumSleeping(0)
+        , mIsStopping(false)
+    {
+        assert(numWorkers > 0);
+
+        mWorkers.reserve(numWorkers);
+        for (int i = 0; i < numWorkers; i++)
+            mWorkers.emplace_back(new Worker());
+
+        // Start threads only after all deques exist, they may steal right away.
+        for (int i = 0; i < numWorkers; i++)
+            mWorkers[i]->thread = util::threading::thread(&WorkStealingPool::run, this, i);
+    }
+
+    /** Stops the workers. Jobs still queued are discarded. */
+    ~WorkStealingPool() _ut_noexcept
+    {
+        {
+            LockGuard _(mMutex);
+            mIsStopping = true;
+            mCond.notify_all();
+        }
+
+        for (auto& worker : mWorkers) {
+            worker->thread.join();
+
+            while (Job *job = worker->deque.pop())
+                delete job;
+        }
+
+        for (Job *job : mInjectedJobs)
+            delete job;
+    }
+
+    int numWorkers() const _ut_noexcept
+    {
+        return (int) mWorkers.size(); // safe cast
+    }
+
+    /** Check if called from one of the pool threads */
+    bool isWorkerThread() const _ut_noexcept
+    {
+        return threadContext().pool == this;
+    }
+
+    /** thread safe */
+    template <class F>
+    void schedule(F&& f)
+    {
+        submit(new Job(std::forward<F>(f)));
+    }
+
+    /** thread safe, same as schedule() */
+    template <class F>
+    void post(F&& f)
+    {
+        schedule(std::forward<F>(f));
+    }
+
+    static int defaultConcurrency() _ut_noexcept
+    {
+        int n = (int) util::threading::thread::hardware_concurrency(); // safe cast
+
+        return n > 0 ? n : 1;
+    }
+
+private:
+    WorkStealingPool(const WorkStealingPool& other) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool& other) = delete;
+
+    using Mutex = util::threading::mutex;
+    using LockGuard = util::threading::lock_guard<Mutex>;
+    using UniqueLock = util::threading::unique_lock<Mutex>;
+
+    struct Job
+    {
+        ut::UniqueFunction<void ()> f;
+
+        template <class F>
+        explicit Job(F&& f)
+            : f(std::forward<F>(f)) { }
+    };
+
+    struct Worker
+    {
+        detail::WorkStealingDeque<Job> deque;
+        util::threading::thread thread;
+    };
+
+    struct ThreadContext
+    {
+        const WorkStealingPool *pool;
+        int workerIndex;
+    };
+
+    static ThreadContext& threadContext() _ut_noexcept
+    {
+        static _ut_thread_local ThreadContext sContext = { nullptr, -1 };
+        return sContext;
+    }
+
+    void submit(Job *job)
+    {
+        ThreadContext& context = threadContext();
+
+        if (context.pool == this) {
+            mWorkers[context.workerIndex]->deque.push(job);
+            mNumQueued.fetch_add(1);
+        } else {
+            LockGuard _(mMutex);
+            mInjectedJobs.push_back(job);
+            mNumInjected.fetch_add(1);
+            mNumQueued.fetch_add(1);
+        }
+
+        // Pairs with the sleeper incrementing mNumSleeping before rechecking mNumQueued,
+        // so either we see a sleeper or the sleeper sees the job.
+        if (mNumSleeping.load() > 0) {
+            LockGuard _(mMutex);
+            mCond.notify_one();
+        }
+    }
+
+    void run(int index)
+    {
+        threadContext() = { this, index };
+
+        while (!mIsStopping.load(std::memory_order_relaxed)) {
+            if (Job *job = findJob(index)) {
+                mNumQueued.fetch_sub(1);
+                execute(job);
+                continue;
+            }
+
+            UniqueLock lock(mMutex);
+            mNumSleeping.fetch_add(1);
+
+            while (mNumQueued.load() <= 0 && !mIsStopping)
+                mCond.wait(lock);
+
+            mNumSleeping.fetch_sub(1);
+        }
+    }
+
+    Job* findJob(int index)
+    {
+        if (Job *job = mWorkers[index]->deque.pop())
+            return job;
+
+        if (mNumInjected.load(std::memory_order_relaxed) > 0) {
+            LockGuard _(mMutex);
+
+            if (!mInjectedJobs.empty()) {
+                Job *job = mInjectedJobs.front();
+                mInjectedJobs.pop_front();
+                mNumInjected.fetch_sub(1);
+                return job;
+            }
+        }
+
+        int numWorkers = this->numWorkers();
+
+        for (int i = 1; i < numWorkers; i++) {
+            if (Job *job = mWorkers[(index + i) % numWorkers]->deque.steal())
+                return job;
+        }
+
+        return nullptr;
+    }
+
+    static void execute(Job *job)
+    {
+        std::unique_ptr<Job> guard(job);
+
+#ifdef UT_NO_EXCEPTIONS
+        job->f();
+#else
+        try {
+            job->f();
+        } catch (const std::exception& e) {
+            fprintf(stderr, "Uncaught exception while running pool job: %s\n",
+                e.what());
+            assert (false);
+        }
+#endif
+    }
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+
+    // Jobs scheduled from outside the pool. Locking is required.
+    std::deque<Job*> mInjectedJobs;
+
+    std::atomic<int> mNumQueued;
+    std::atomic<int> mNumInjected;
+    std::atomic<int> mNumSleeping;
+    std::atomic<bool> mIsStopping;
+    Mutex mMutex;
+    util::threading::condition_variable mCond;
+};
+
+}
@@ -0,0 +1,103 @@
+/*
+* Copyright 2015-2016 Valentin Milea
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Common.h"
+#include "../Examples/util/Looper.h"
+#include <CppAsync/Cpp20Async.h>
+#include <CppAsync/util/Arena.h>
+
+// Requires a compiler with C++20 coroutines, see HAVE_CPP20_COROUTINES in CMakeLists.txt.
+#if _ut_has_cpp20_coroutines
+
+namespace {
+
+// Custom run loop
+static util::Looper sLooper;
+
+static ut::Task<void> asyncDelay(long milliseconds)
+{
+    ut::Task<void> task;
+
+    // Finish task after delay. Assuming scheduler can't fail.
+    sLooper.schedule(task.takePromise(), milliseconds);
+
+    return task;
+}
+
+enum ErrorId
+{
+    BlownUpError = -1
+};
+
+static ut::Task<void> asyncBlowUp()
+{
+    ut::Task<void> task;
+    task.takePromise().fail(BlownUpError);
+
+    return task;
+}
+
+template <class Alloc>
+static ut::Task<void> asyncTick(std::allocator_arg_t, const Alloc& /* alloc */, int i)
+{
+    printf("%d...\n", i);
+
+    // Suspend for 1 second.
+    co_await asyncDelay(1000);
+
+    // Awaiting a failed task destroys this frame and fails our own task.
+    if (i == 1)
+        co_await asyncBlowUp();
+}
+
+template <class Alloc>
+static ut::Task<void> asyncCountdown(std::allocator_arg_t, const Alloc& alloc, int n)
+{
+    for (int i = n; i > 0; i--)
+        co_await asyncTick(std::allocator_arg, alloc, i);
+
+    printf("liftoff!\n");
+}
+
+}
+
+void ex_countdown_cpp20()
+{
+    // Use a custom allocator. When exceptions are disabled, allocate() may return
+    // null to indicate failure.
+    ut::LinearStackArena<1024> arena;
+    auto alloc = ut::makeArenaAlloc(arena);
+
+    // 5 second countdown
+    const int n = 5;
+
+    ut::Task<void> task = asyncCountdown(std::allocator_arg, alloc, n);
+
+    // If allocation fails, the returned Task will be invalid.
+    if (!task.isValid()) {
+        printf("error: allocation failed\n");
+        return;
+    }
+
+    // Loop until there are no more scheduled operations.
+    sLooper.run();
+
+    assert(task.isReady());
+    if (task.hasError())
+        printf("error: %d\n", task.error().get());
+}
+
+#endif
@@ -25,11 +25,17 @@ struct Example
 
 void ex_fibo();
 void ex_countdown();
+#ifdef HAVE_CPP20_COROUTINES
+void ex_countdown_cpp20();
+#endif
 
 static const Example EXAMPLES[] =
 {
     { &ex_fibo,                 "coro  - Fibonacci generator (no exceptions)" },
     { &ex_countdown,            "async - countdown (no exceptions)" },
+#ifdef HAVE_CPP20_COROUTINES
+    { &ex_countdown_cpp20,      "async (C++20 coroutines) - countdown (no exceptions)" },
+#endif
 };
 
 int main()